@@ -0,0 +1,231 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "childcount.h"
+#include "util.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SUBDOC_HAVE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace Subdoc;
+
+namespace {
+// Scanning state, carried from one byte (or block) to the next
+struct CountState {
+    size_t depth = 0;
+    size_t commas = 0;
+    bool in_string = false;
+    bool escaped = false;
+
+    // Process one byte; returns true if it closes the container
+    bool feed(char c) {
+        if (in_string) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            return false;
+        }
+        if (c == '"') {
+            in_string = true;
+            return false;
+        }
+        return structural(c);
+    }
+
+    // Process a byte outside of any string
+    bool structural(char c) {
+        switch (c) {
+        case '[':
+        case '{':
+            depth++;
+            break;
+        case ']':
+        case '}':
+            return --depth == 0;
+        case ',':
+            if (depth == 1) {
+                commas++;
+            }
+            break;
+        default:
+            break;
+        }
+        return false;
+    }
+};
+}
+
+/*
+ * Handle the opening bracket, and the (common) case of an empty container.
+ * Returns true if the count is already known.
+ */
+static bool
+count_prologue(const char *s, size_t n, size_t& nchildren, size_t& length,
+    CountState& state)
+{
+    state.depth = 1;
+    size_t ii = 1;
+    while (ii < n && Util::is_json_ws(s[ii])) {
+        ii++;
+    }
+    if (ii < n && (s[ii] == ']' || s[ii] == '}')) {
+        nchildren = 0;
+        length = ii + 1;
+        return true;
+    }
+    return false;
+}
+
+static bool
+count_tail(const char *s, size_t n, size_t pos, size_t& nchildren,
+    size_t& length, CountState& state)
+{
+    for (; pos < n; pos++) {
+        if (state.feed(s[pos])) {
+            nchildren = state.commas + 1;
+            length = pos + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+ChildCounter::count_scalar(const char *s, size_t n, size_t& nchildren,
+    size_t& length)
+{
+    CountState state;
+    if (count_prologue(s, n, nchildren, length, state)) {
+        return true;
+    }
+    return count_tail(s, n, 1, nchildren, length, state);
+}
+
+#ifdef SUBDOC_HAVE_SSE2
+static inline unsigned
+popcount16(unsigned x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_popcount(x));
+#else
+    return static_cast<unsigned>(__popcnt(x));
+#endif
+}
+
+static inline unsigned
+lowest_bit(unsigned x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(x));
+#else
+    unsigned long ix;
+    _BitScanForward(&ix, x);
+    return static_cast<unsigned>(ix);
+#endif
+}
+
+// For each bit, the parity of the bits at or below it. Applied to the
+// positions of quotes, this gives the positions within strings (including
+// the opening quote, but not the closing one).
+static inline unsigned
+prefix_xor16(unsigned x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    return x & 0xffff;
+}
+
+static inline unsigned
+mask_eq(__m128i block, char c)
+{
+    return static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+}
+
+bool
+ChildCounter::count(const char *s, size_t n, size_t& nchildren,
+    size_t& length)
+{
+    CountState state;
+    if (count_prologue(s, n, nchildren, length, state)) {
+        return true;
+    }
+
+    size_t pos = 1;
+    for (; pos + 16 <= n; pos += 16) {
+        const __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(s + pos));
+        const unsigned backslash = mask_eq(block, '\\');
+        if (backslash || state.escaped) {
+            // Escapes may hide quotes; take the slow path for this block
+            for (size_t ii = pos; ii < pos + 16; ii++) {
+                if (state.feed(s[ii])) {
+                    nchildren = state.commas + 1;
+                    length = ii + 1;
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        const unsigned quote = mask_eq(block, '"');
+        unsigned inside = prefix_xor16(quote);
+        if (state.in_string) {
+            inside ^= 0xffff;
+        }
+        if (popcount16(quote) & 1) {
+            state.in_string = !state.in_string;
+        }
+
+        const unsigned outside = ~inside & 0xffff;
+        const unsigned brackets = (mask_eq(block, '[') | mask_eq(block, '{') |
+                mask_eq(block, ']') | mask_eq(block, '}')) & outside;
+        const unsigned commas = mask_eq(block, ',') & outside;
+        if (brackets == 0) {
+            // The depth does not change within the block
+            if (state.depth == 1) {
+                state.commas += popcount16(commas);
+            }
+            continue;
+        }
+
+        // Visit the structural characters in order
+        for (unsigned bits = brackets | commas; bits; bits &= bits - 1) {
+            const unsigned ix = lowest_bit(bits);
+            if (state.structural(s[pos + ix])) {
+                nchildren = state.commas + 1;
+                length = pos + ix + 1;
+                return true;
+            }
+        }
+    }
+    return count_tail(s, n, pos, nchildren, length, state);
+}
+
+#else
+bool
+ChildCounter::count(const char *s, size_t n, size_t& nchildren,
+    size_t& length)
+{
+    return count_scalar(s, n, nchildren, length);
+}
+#endif
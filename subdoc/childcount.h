@@ -0,0 +1,50 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace Subdoc {
+
+/**
+ * Counts the children of a container without tokenizing it: only the commas
+ * and brackets outside of strings are examined. Where SSE2 is available, 16
+ * bytes are classified at a time; blocks containing escapes (which are rare
+ * in most documents) are handled one byte at a time.
+ *
+ * The contents of the container are not validated, so this may only be
+ * used on documents known to be valid JSON (see
+ * Operation::set_doc_validated()).
+ */
+class ChildCounter {
+public:
+    /**
+     * Count the children of the container beginning at `s`
+     * @param s the opening bracket (or brace) of the container
+     * @param n the number of bytes available from `s`
+     * @param[out] nchildren the number of elements (or members) of the
+     *             container
+     * @param[out] length the length of the container, including its
+     *             brackets
+     * @return false if the container does not end within `n` bytes
+     */
+    static bool count(const char *s, size_t n,
+                      size_t& nchildren, size_t& length);
+
+    /** As count(), one byte at a time */
+    static bool count_scalar(const char *s, size_t n,
+                             size_t& nchildren, size_t& length);
+
+private:
+    ChildCounter();
+};
+
+} // namespace Subdoc
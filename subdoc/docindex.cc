@@ -0,0 +1,321 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#define INCLUDE_JSONSL_SRC
+#include "docindex.h"
+#include "hkesc.h"
+#include "jsonsl_header.h"
+#include <array>
+
+using namespace Subdoc;
+
+uint64_t
+KeyFilter::hash(const char *key, size_t nkey)
+{
+    // FNV-1a, followed by a final avalanche (from MurmurHash3) so that all
+    // bits of the result are usable for probing.
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t ii = 0; ii < nkey; ++ii) {
+        h ^= static_cast<uint8_t>(key[ii]);
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void
+KeyFilter::reset(size_t nkeys)
+{
+    // About 10 bits per key (rounded up to a power of two) with 4 probes
+    // gives a false positive rate of around 1%
+    size_t nbits = 64;
+    while (nbits < nkeys * 10) {
+        nbits <<= 1;
+    }
+    m_bits.assign(nbits / 64, 0);
+    m_mask = nbits - 1;
+}
+
+void
+KeyFilter::add(uint64_t h)
+{
+    // Probe positions are derived from the two halves of the hash
+    // (Kirsch-Mitzenmacher double hashing)
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint64_t ii = 0; ii < NUM_PROBES; ++ii) {
+        const uint64_t bit = (h + ii * h2) & m_mask;
+        m_bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+bool
+KeyFilter::maybe_contains(uint64_t h) const
+{
+    if (m_bits.empty()) {
+        return true;
+    }
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint64_t ii = 0; ii < NUM_PROBES; ++ii) {
+        const uint64_t bit = (h + ii * h2) & m_mask;
+        if (!(m_bits[bit >> 6] & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+DocIndex::append_component(std::string& out, const char *key, size_t n)
+{
+    out += '\x01';
+    out.append(reinterpret_cast<const char*>(&n), sizeof n);
+    out.append(key, n);
+}
+
+void
+DocIndex::append_component(std::string& out, size_t index)
+{
+    out += '\x02';
+    out.append(reinterpret_cast<const char*>(&index), sizeof index);
+}
+
+void
+DocIndex::append_component(std::string& out, const Path::Component& comp)
+{
+    if (comp.ptype == JSONSL_PATH_NUMERIC) {
+        append_component(out, static_cast<size_t>(comp.idx));
+    } else {
+        append_component(out, comp.pstr, comp.len);
+    }
+}
+
+/* Build the key of the element at the first `n` components of the path.
+ * Returns false if one of them is a negative index */
+static bool
+path_key(const Path::CompInfo& path, size_t n, std::string& key)
+{
+    // Skip the root
+    for (size_t ii = 1; ii < n; ++ii) {
+        const auto& comp = path[ii];
+        if (comp.is_neg) {
+            return false;
+        }
+        DocIndex::append_component(key, comp);
+    }
+    return true;
+}
+
+const DocIndex::Entry*
+DocIndex::find_parent(const Path::CompInfo& path) const
+{
+    if (m_entries.empty() || path.size() < 2) {
+        return nullptr;
+    }
+
+    // Skip the last component (which is the child itself)
+    std::string key;
+    if (!path_key(path, path.size() - 1, key)) {
+        return nullptr;
+    }
+
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const DocIndex::ArrayEntry*
+DocIndex::find_array(const Path::CompInfo& path) const
+{
+    std::string key;
+    if (m_arrays.empty() || !path_key(path, path.size(), key)) {
+        return nullptr;
+    }
+
+    auto it = m_arrays.find(key);
+    if (it == m_arrays.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void
+DocIndex::clear()
+{
+    m_entries.clear();
+    m_arrays.clear();
+    m_doc.clear();
+}
+
+namespace {
+struct IndexContext : public HashKey {
+    std::unordered_map<std::string, DocIndex::Entry>* entries = nullptr;
+    std::unordered_map<std::string, DocIndex::ArrayEntry>* arrays = nullptr;
+    const char *doc = nullptr;
+    size_t min_keys = 0;
+    size_t min_elems = 0;
+    int status = JSONSL_ERROR_SUCCESS;
+
+    // Canonical path of the current element, and the length of that path
+    // for each of its ancestors
+    std::string path;
+    std::array<size_t, Limits::PARSER_DEPTH + 1> pathlen{};
+
+    // Hashes of the keys seen so far in each of the open objects. The hashes
+    // for the object at a given level begin at hashbegin[level]
+    std::vector<uint64_t> hashes;
+    std::array<size_t, Limits::PARSER_DEPTH + 1> hashbegin{};
+
+    // Likewise, the primitive elements seen so far in each of the open
+    // arrays, and whether any of their elements is a container
+    std::vector<std::string_view> elems;
+    std::array<size_t, Limits::PARSER_DEPTH + 1> elembegin{};
+    std::array<bool, Limits::PARSER_DEPTH + 1> has_containers{};
+};
+}
+
+static int
+index_err_callback(jsonsl_t jsn, jsonsl_error_t err, jsonsl_state_st*,
+    jsonsl_char_t*)
+{
+    static_cast<IndexContext*>(jsn->data)->status = err;
+    return 0;
+}
+
+static void
+index_callback(jsonsl_t jsn, jsonsl_action_t action, jsonsl_state_st *st,
+    const jsonsl_char_t *at)
+{
+    auto* ctx = static_cast<IndexContext*>(jsn->data);
+    const unsigned level = st->level;
+
+    if (action == JSONSL_ACTION_PUSH) {
+        if (st->type == JSONSL_T_HKEY) {
+            ctx->set_hk_begin(st, at);
+            return;
+        }
+
+        const jsonsl_state_st *parent = jsonsl_last_state(jsn, st);
+        if (parent == nullptr) {
+            ctx->path.clear();
+        } else {
+            ctx->path.resize(ctx->pathlen[level - 1]);
+            if (parent->type == JSONSL_T_OBJECT) {
+                size_t nkey;
+                const char *key = ctx->get_hk(nkey);
+                DocIndex::append_component(ctx->path, key, nkey);
+            } else {
+                DocIndex::append_component(
+                        ctx->path, static_cast<size_t>(parent->nelem - 1));
+            }
+        }
+        ctx->pathlen[level] = ctx->path.size();
+        if (st->type == JSONSL_T_OBJECT) {
+            ctx->hashbegin[level] = ctx->hashes.size();
+        } else if (st->type == JSONSL_T_LIST) {
+            ctx->elembegin[level] = ctx->elems.size();
+            ctx->has_containers[level] = false;
+        }
+        if (parent != nullptr && parent->type == JSONSL_T_LIST &&
+                JSONSL_STATE_IS_CONTAINER(st)) {
+            ctx->has_containers[level - 1] = true;
+        }
+
+    } else if (action == JSONSL_ACTION_POP) {
+        if (st->type == JSONSL_T_HKEY) {
+            ctx->set_hk_end(st);
+            size_t nkey;
+            const char *key = ctx->get_hk(nkey);
+            ctx->hashes.push_back(KeyFilter::hash(key, nkey));
+            return;
+        }
+        if (st->type == JSONSL_T_LIST) {
+            const size_t begin = ctx->elembegin[level];
+            if (st->nelem >= ctx->min_elems) {
+                DocIndex::ArrayEntry& ent = (*ctx->arrays)[ctx->path.substr(
+                        0, ctx->pathlen[level])];
+                ent.has_containers = ctx->has_containers[level];
+                if (!ent.has_containers) {
+                    ent.values.insert(ctx->elems.begin() + begin,
+                                      ctx->elems.end());
+                }
+                ent.offset = st->pos_begin;
+                ent.length = jsn->pos - st->pos_begin + 1;
+                ent.nelems = st->nelem;
+            }
+            ctx->elems.resize(begin);
+            return;
+        }
+        if (st->type != JSONSL_T_OBJECT) {
+            const jsonsl_state_st *parent = jsonsl_last_state(jsn, st);
+            if (parent != nullptr && parent->type == JSONSL_T_LIST) {
+                size_t len = jsn->pos - st->pos_begin;
+                if (st->type == JSONSL_T_STRING) {
+                    len++; // Include the closing quote
+                }
+                ctx->elems.emplace_back(ctx->doc + st->pos_begin, len);
+            }
+            return;
+        }
+
+        const size_t begin = ctx->hashbegin[level];
+        const size_t nkeys = st->nelem / 2;
+        if (nkeys >= ctx->min_keys) {
+            DocIndex::Entry& ent = (*ctx->entries)[ctx->path.substr(
+                    0, ctx->pathlen[level])];
+            ent.filter.reset(nkeys);
+            for (size_t ii = begin; ii < ctx->hashes.size(); ++ii) {
+                ent.filter.add(ctx->hashes[ii]);
+            }
+            ent.offset = st->pos_begin;
+            ent.length = jsn->pos - st->pos_begin + 1;
+            ent.nkeys = nkeys;
+        }
+        ctx->hashes.resize(begin);
+    }
+}
+
+int
+DocIndex::build(const char *doc, size_t n, jsonsl_t jsn, size_t min_keys,
+                size_t min_elems)
+{
+    clear();
+
+    IndexContext ctx;
+    ctx.entries = &m_entries;
+    ctx.arrays = &m_arrays;
+    ctx.doc = doc;
+    ctx.min_keys = min_keys;
+    ctx.min_elems = min_elems;
+
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->action_callback_PUSH = nullptr;
+    jsn->action_callback_POP = nullptr;
+    jsn->action_callback = index_callback;
+    jsn->error_callback = index_err_callback;
+    jsn->max_callback_level = Limits::PARSER_DEPTH + 1;
+    jsn->data = &ctx;
+
+    jsonsl_feed(jsn, doc, n);
+    jsonsl_reset(jsn);
+
+    if (ctx.status != JSONSL_ERROR_SUCCESS) {
+        m_entries.clear();
+        m_arrays.clear();
+        return ctx.status;
+    }
+    m_doc.assign(doc, n);
+    return JSONSL_ERROR_SUCCESS;
+}
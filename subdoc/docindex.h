@@ -0,0 +1,157 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "loc.h"
+#include "path.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Subdoc {
+
+/**
+ * Small Bloom filter over the keys of a single JSON object. A negative
+ * answer from maybe_contains() is definite; a positive answer means the
+ * object must still be scanned.
+ *
+ * Keys are hashed in the same form in which they are compared during a
+ * match, i.e. as they appear in the document (with any u-escapes converted)
+ * and as they appear in a parsed Path component.
+ */
+class KeyFilter {
+public:
+    /// Size the filter for `nkeys` keys. Any existing contents are discarded
+    void reset(size_t nkeys);
+    void add(uint64_t hash);
+    bool maybe_contains(uint64_t hash) const;
+    bool maybe_contains(const char *key, size_t nkey) const {
+        return maybe_contains(hash(key, nkey));
+    }
+
+    static uint64_t hash(const char *key, size_t nkey);
+
+private:
+    static const unsigned NUM_PROBES = 4;
+    std::vector<uint64_t> m_bits;
+    uint64_t m_mask = 0;
+};
+
+/**
+ * A document index carries precomputed information about a single version
+ * of a document, so that some lookups may be answered without scanning
+ * it. It is built once (typically by whoever owns the document, e.g. when it
+ * is stored), and is only valid for as long as the buffer it was built from
+ * remains unmodified.
+ *
+ * Currently the index contains a KeyFilter for each sufficiently wide object
+ * in the document, allowing a lookup (or insertion) of a key which does not
+ * exist to be resolved without scanning the parent object. It also contains
+ * the set of values of each sufficiently long array of primitives, so that
+ * Command::ARRAY_ADD_UNIQUE need not compare the value against each element.
+ */
+class DocIndex {
+public:
+    /**
+     * Information about an indexed object
+     */
+    class Entry {
+    public:
+        KeyFilter filter;
+        /// Offset of the object (its opening brace) within the document
+        size_t offset = 0;
+        /// Length of the object, including its closing brace
+        size_t length = 0;
+        /// Number of keys in the object
+        size_t nkeys = 0;
+    };
+
+    /**
+     * Information about an indexed array
+     */
+    class ArrayEntry {
+    public:
+        /// The elements as they appear in the document (strings including
+        /// their quotes). Empty if #has_containers
+        std::unordered_set<std::string_view> values;
+        /// Offset of the array (its opening bracket) within the document
+        size_t offset = 0;
+        /// Length of the array, including its closing bracket
+        size_t length = 0;
+        /// Number of elements in the array
+        size_t nelems = 0;
+        /// Whether any of the elements is a container
+        bool has_containers = false;
+    };
+
+    /**
+     * Build the index from the given document.
+     *
+     * @param doc the document to index. The buffer must remain valid and
+     *        unmodified for as long as the index is used with it.
+     * @param n length of the document
+     * @param jsn parser to use
+     * @param min_keys only index objects with at least this many keys. Small
+     *        objects are cheaper to scan than to look up in the index.
+     * @param min_elems likewise, only index arrays with at least this many
+     *        elements
+     * @return JSONSL_ERROR_SUCCESS, or the parse error if the document could
+     *         not be indexed (in which case the index is empty).
+     */
+    int build(const char *doc, size_t n, jsonsl_t jsn, size_t min_keys = 16,
+              size_t min_elems = 64);
+    int build(const std::string& s, jsonsl_t jsn, size_t min_keys = 16,
+              size_t min_elems = 64) {
+        return build(s.c_str(), s.size(), jsn, min_keys, min_elems);
+    }
+
+    void clear();
+
+    /// Whether this index was built from the given buffer
+    bool indexes(const char *doc, size_t n) const {
+        return m_doc.at == doc && m_doc.length == n && doc != nullptr;
+    }
+
+    /**
+     * Find the entry for the object which is the immediate parent of the
+     * last component in `path`.
+     * @return the entry, or NULL if the parent object has not been indexed
+     */
+    const Entry* find_parent(const Path::CompInfo& path) const;
+
+    /**
+     * Find the entry for the array at `path`.
+     * @return the entry, or NULL if the array has not been indexed
+     */
+    const ArrayEntry* find_array(const Path::CompInfo& path) const;
+
+    /// Number of indexed objects
+    size_t size() const { return m_entries.size(); }
+
+    /// Number of indexed arrays
+    size_t num_arrays() const { return m_arrays.size(); }
+
+    /// Append the canonical form of a path component to `out`. Used as the
+    /// key for the index entries
+    static void append_component(std::string& out, const Path::Component&);
+    static void append_component(std::string& out, const char *key, size_t n);
+    static void append_component(std::string& out, size_t index);
+
+private:
+    Loc m_doc;
+    std::unordered_map<std::string, Entry> m_entries;
+    std::unordered_map<std::string, ArrayEntry> m_arrays;
+};
+
+} // namespace Subdoc
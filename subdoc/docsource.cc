@@ -0,0 +1,151 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "docsource.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Subdoc;
+
+MmapSource::~MmapSource()
+{
+    close();
+}
+
+#ifdef _WIN32
+int
+MmapSource::open(const char *path, size_t chunk_size)
+{
+    close();
+    m_chunk_size = chunk_size;
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return static_cast<int>(GetLastError());
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        int rv = static_cast<int>(GetLastError());
+        close();
+        return rv;
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    if (m_size == 0) {
+        return 0;
+    }
+
+    HANDLE mapping = CreateFileMappingA(
+        file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        int rv = static_cast<int>(GetLastError());
+        close();
+        return rv;
+    }
+    m_mapping = mapping;
+
+    m_data = static_cast<const char*>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        int rv = static_cast<int>(GetLastError());
+        close();
+        return rv;
+    }
+    return 0;
+}
+
+void
+MmapSource::close()
+{
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+#else
+int
+MmapSource::open(const char *path, size_t chunk_size)
+{
+    close();
+    m_chunk_size = chunk_size;
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) {
+        return errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int rv = errno;
+        ::close(fd);
+        return rv;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size == 0) {
+        ::close(fd);
+        return 0;
+    }
+
+    void *addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int rv = errno;
+    // The mapping remains valid once the descriptor is closed
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        m_size = 0;
+        return rv;
+    }
+    // Lookups read the document from the beginning, and usually stop early
+    madvise(addr, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(addr);
+    return 0;
+}
+
+void
+MmapSource::close()
+{
+    if (m_data != nullptr) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+#endif
+
+Loc
+MmapSource::next()
+{
+    const size_t n = std::min(m_chunk_size, m_size - m_pos);
+    Loc chunk(m_data + m_pos, n);
+    m_pos += n;
+    return chunk;
+}
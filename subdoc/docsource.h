@@ -0,0 +1,79 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "loc.h"
+
+namespace Subdoc {
+
+/**
+ * Source from which a document is read lazily, one chunk at a time. A
+ * lookup stops reading once its path has been resolved, so only a prefix of
+ * a large document might ever be requested (see Operation::set_doc()).
+ */
+class DocSource {
+public:
+    virtual ~DocSource() = default;
+
+    /**
+     * Return the next chunk of the document, or an empty Loc once the end of
+     * the document has been reached.
+     *
+     * Chunks must not overlap, and must remain valid (and unmodified) for as
+     * long as the document, or any result referring to it, is in use.
+     */
+    virtual Loc next() = 0;
+};
+
+/**
+ * Document source reading a file through a memory mapping. The whole file
+ * is mapped, but pages are only read in as the chunks covering them are
+ * parsed.
+ */
+class MmapSource : public DocSource {
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    MmapSource() = default;
+    MmapSource(const MmapSource&) = delete;
+    MmapSource& operator=(const MmapSource&) = delete;
+    ~MmapSource() override;
+
+    /**
+     * Map a file
+     * @param path the file to map
+     * @param chunk_size the size of the chunks returned by next()
+     * @return 0 on success, or an errno value (or, on Windows, the value of
+     *         GetLastError()) on failure
+     */
+    int open(const char *path, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    void close();
+
+    Loc next() override;
+
+    /// Start again from the beginning of the file
+    void rewind() { m_pos = 0; }
+
+    /// Size of the file
+    size_t size() const { return m_size; }
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_pos = 0;
+    size_t m_chunk_size = DEFAULT_CHUNK_SIZE;
+#ifdef _WIN32
+    void *m_file = nullptr;
+    void *m_mapping = nullptr;
+#endif
+};
+
+} // namespace Subdoc
@@ -0,0 +1,74 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "docstats.h"
+
+using namespace Subdoc;
+
+Error
+DocStats::add(const char *pth, size_t npth)
+{
+    Error status = m_batch.parse(pth, npth);
+    if (!status.success()) {
+        return status;
+    }
+    m_nodes.push_back(m_batch.add());
+    m_stats.emplace_back();
+    return Error::SUCCESS;
+}
+
+void
+DocStats::clear()
+{
+    m_batch.clear();
+    m_nodes.clear();
+    m_stats.clear();
+}
+
+Error
+DocStats::finish(Error status)
+{
+    for (auto& stat : m_stats) {
+        stat = {};
+    }
+    if (!status.success()) {
+        return status;
+    }
+
+    for (size_t ii = 0; ii < m_nodes.size(); ++ii) {
+        const auto& node = m_batch.match()[m_nodes[ii]];
+        if (!node.found) {
+            continue;
+        }
+        Stat& stat = m_stats[ii];
+        stat.status = Error::SUCCESS;
+        stat.type = node.type;
+        stat.sflags = node.sflags;
+        stat.length = node.loc.length;
+        if (node.type == JSONSL_T_OBJECT) {
+            stat.count = node.num_children / 2;
+        } else if (node.type == JSONSL_T_LIST) {
+            stat.count = node.num_children;
+        }
+    }
+    return Error::SUCCESS;
+}
+
+Error
+DocStats::exec(const char *doc, size_t n)
+{
+    return finish(m_batch.exec(doc, n));
+}
+
+Error
+DocStats::exec(Segments& doc)
+{
+    return finish(m_batch.exec(doc));
+}
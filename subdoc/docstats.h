@@ -0,0 +1,76 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+#include "pathbatch.h"
+
+namespace Subdoc {
+
+/**
+ * Describes several elements of a document (whether they exist, their type,
+ * size and number of children) in a single scan. This answers what would
+ * otherwise be one Command::GET_COUNT or Command::EXISTS per path, without
+ * returning the elements themselves.
+ */
+class DocStats {
+public:
+    struct Stat {
+        /** Error::SUCCESS, or Error::PATH_ENOENT if the path is missing */
+        Error status = Error::PATH_ENOENT;
+        /** The element's type (jsonsl_type_t) */
+        uint32_t type = 0;
+        /** Flags, if #type is JSONSL_TYPE_SPECIAL (see Match::sflags) */
+        int sflags = 0;
+        /** Length of the element, in bytes */
+        size_t length = 0;
+        /** For containers, the number of children (as for GET_COUNT) */
+        size_t count = 0;
+    };
+
+    /**
+     * Add a path. The statistics of the paths are reported in the order in
+     * which they were added. The path need not remain valid afterwards.
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, or Error::GLOBAL_ENOSUPPORT if it contains negative
+     *         array indexes
+     */
+    Error add(const char *pth, size_t npth);
+    Error add(const std::string& s) { return add(s.c_str(), s.size()); }
+
+    /// Remove all paths
+    void clear();
+
+    /**
+     * Describe the paths in a document
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document
+     *         could not be parsed
+     */
+    Error exec(const char *doc, size_t n);
+    Error exec(const std::string& s) { return exec(s.c_str(), s.size()); }
+    Error exec(Segments& doc);
+
+    /// Number of paths added
+    size_t size() const { return m_stats.size(); }
+
+    /// The statistics of the `ix`th path added, as of the last exec()
+    const Stat& operator[](size_t ix) const { return m_stats[ix]; }
+
+private:
+    Error finish(Error status);
+
+    PathBatch m_batch;
+    // The node of each path, and its statistics
+    std::vector<size_t> m_nodes;
+    std::vector<Stat> m_stats;
+};
+
+} // namespace Subdoc
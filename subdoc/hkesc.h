@@ -25,6 +25,7 @@ public:
     void set_hk_begin(const StateType *, const char *at) {
         m_strvalid = false;
         m_hkbuf = at + 1;
+        m_hkcopy = nullptr;
     }
 
     template <typename StateType>
@@ -37,10 +38,21 @@ public:
         }
     }
 
+    /**
+     * Use a copy of the key's contents, made by the caller, rather than the
+     * contents at the location given to set_hk_begin(). This is needed if
+     * the key was not contiguous in the input. The raw location of the key
+     * (see hk_rawloc()) is not affected.
+     */
+    void set_hk_copy(const char *copy) {
+        m_hkcopy = copy;
+    }
+
     const char *get_hk(size_t &nkey) {
+        const char *hkbuf = m_hkcopy ? m_hkcopy : m_hkbuf;
         if (!m_hkesc) {
             nkey = m_hklen;
-            return m_hkbuf;
+            return hkbuf;
         }
 
         if (m_strvalid) {
@@ -52,7 +64,7 @@ public:
 
         // TODO: use jsonsl_util_unescape_ex() instead. However this requires
         // a dedicated character table
-        UescapeConverter::convert(m_hkbuf, m_hklen, m_hkstr);
+        UescapeConverter::convert(hkbuf, m_hklen, m_hkstr);
         m_strvalid = true;
         return get_hk(nkey);
     }
@@ -64,6 +76,7 @@ public:
 
 private:
     const char* m_hkbuf = nullptr;
+    const char* m_hkcopy = nullptr;
     size_t m_hklen = 0;
     bool m_hkesc = false;
     bool m_strvalid = false;
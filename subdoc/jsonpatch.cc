@@ -0,0 +1,387 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "jsonpatch.h"
+#include "predicate.h"
+#include "util.h"
+#include <cstring>
+
+using namespace Subdoc;
+
+struct JsonPatch::Step {
+    enum Kind { ADD, REMOVE, REPLACE, MOVE, COPY, TEST };
+    Kind kind = ADD;
+    std::unique_ptr<Path> path;
+    std::unique_ptr<Path> from;
+    // Whether the path ends with `-`, i.e. refers past the end of an array;
+    // the array itself is then the path
+    bool append = false;
+    Loc value;
+    // For the `test` operations at the beginning of the patch, their node
+    // within m_tests
+    size_t node = MultiMatch::NONE;
+};
+
+static bool
+key_is(const Loc& key, const char *name)
+{
+    // The key includes its quotes
+    const size_t n = strlen(name);
+    return key.length == n + 2 && memcmp(key.at + 1, name, n) == 0;
+}
+
+/* Parses the pointer in the string token `str`. If `append` is given, a
+ * final `-` token is stripped, and indicated there */
+static Error
+parse_pointer(Path& path, const Loc& str, bool *append)
+{
+    const char *ptr = str.at + 1;
+    size_t n = str.length - 2;
+    if (append != nullptr && n >= 2 && ptr[n-1] == '-' && ptr[n-2] == '/') {
+        // The separator may be written as `\/`, unless that backslash is
+        // itself escaped (i.e. an even number of them precede the '/')
+        size_t nbs = 0;
+        while (nbs < n - 2 && ptr[n-3-nbs] == '\\') {
+            nbs++;
+        }
+        *append = true;
+        n -= nbs % 2 ? 3 : 2;
+    }
+    return Util::path_status(path.parse_pointer(ptr, n));
+}
+
+/* Whether the pointer `prefix` is equal to `path`, or one of its parents.
+ * Both were parsed by parse_pointer(), which leaves a single spelling for
+ * each token */
+static bool
+is_prefix(const Path& prefix, const Path& path)
+{
+    if (prefix.size() > path.size()) {
+        return false;
+    }
+    for (size_t ii = 1; ii < prefix.size(); ii++) {
+        const auto& a = prefix[ii];
+        const auto& b = path[ii];
+        if (a.ptype != b.ptype || a.len != b.len ||
+                memcmp(a.pstr, b.pstr, a.len) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+JsonPatch::JsonPatch() : m_jsn(Match::jsn_alloc()) {
+}
+
+JsonPatch::~JsonPatch()
+{
+    Match::jsn_free(m_jsn);
+}
+
+void
+JsonPatch::clear()
+{
+    m_steps.clear();
+    m_tests.clear();
+    m_failed = NONE;
+    m_cur.clear();
+    m_results.clear();
+    m_docs.clear();
+}
+
+size_t
+JsonPatch::size() const
+{
+    return m_steps.size();
+}
+
+Error
+JsonPatch::compile_step(const Loc& op)
+{
+    Path root;
+    root.parse("", 0);
+    ContainerCursor cur;
+    cur.open(op.at, op.length, &root, m_jsn);
+
+    Loc name, path, from;
+    Step step;
+    bool has_value = false;
+    while (cur.next()) {
+        const auto& member = cur.child();
+        if (key_is(member.loc_key, "value")) {
+            step.value = member.loc;
+            has_value = true;
+            continue;
+        }
+        Loc *dst = nullptr;
+        if (key_is(member.loc_key, "op")) {
+            dst = &name;
+        } else if (key_is(member.loc_key, "path")) {
+            dst = &path;
+        } else if (key_is(member.loc_key, "from")) {
+            dst = &from;
+        } else {
+            continue;
+        }
+        if (member.type != JSONSL_T_STRING) {
+            cur.close();
+            return Error::VALUE_CANTINSERT;
+        }
+        *dst = member.loc;
+    }
+    const int status = cur.status();
+    cur.close();
+    if (status != JSONSL_ERROR_SUCCESS || cur.type != JSONSL_T_OBJECT ||
+            name.empty() || path.empty()) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    static const struct {
+        const char *name;
+        Step::Kind kind;
+    } kinds[] = {{"add", Step::ADD},         {"remove", Step::REMOVE},
+                 {"replace", Step::REPLACE}, {"move", Step::MOVE},
+                 {"copy", Step::COPY},       {"test", Step::TEST}};
+    bool known = false;
+    for (const auto& kind : kinds) {
+        if (key_is(name, kind.name)) {
+            step.kind = kind.kind;
+            known = true;
+        }
+    }
+    if (!known) {
+        return Error::GLOBAL_ENOSUPPORT;
+    }
+
+    const bool is_add = step.kind == Step::ADD || step.kind == Step::MOVE ||
+                        step.kind == Step::COPY;
+    const bool needs_from = step.kind == Step::MOVE || step.kind == Step::COPY;
+    const bool needs_value = step.kind == Step::ADD ||
+                             step.kind == Step::REPLACE ||
+                             step.kind == Step::TEST;
+    if ((needs_from && from.empty()) || (needs_value && !has_value)) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    step.path.reset(new Path());
+    Error rv = parse_pointer(*step.path, path, is_add ? &step.append : nullptr);
+    if (!rv.success()) {
+        return rv;
+    }
+    if (needs_from) {
+        step.from.reset(new Path());
+        rv = parse_pointer(*step.from, from, nullptr);
+        if (!rv.success()) {
+            return rv;
+        }
+        // A value cannot be moved into one of its own children
+        if (step.kind == Step::MOVE && is_prefix(*step.from, *step.path) &&
+                (step.path->size() > step.from->size() || step.append)) {
+            return Error::PATH_EINVAL;
+        }
+    }
+    if (!needs_value) {
+        step.value = Loc();
+    }
+    m_steps.push_back(std::move(step));
+    return Error::SUCCESS;
+}
+
+Error
+JsonPatch::compile(const char *patch, size_t n)
+{
+    clear();
+
+    Path root;
+    root.parse("", 0);
+    ContainerCursor cur;
+    cur.open(patch, n, &root, m_jsn);
+    std::vector<std::pair<Loc, bool>> ops; // And whether it is an object
+    while (cur.next()) {
+        ops.emplace_back(cur.child().loc, cur.child().type == JSONSL_T_OBJECT);
+    }
+    const int status = cur.status();
+    cur.close();
+    if (status != JSONSL_ERROR_SUCCESS || cur.type != JSONSL_T_LIST) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    for (size_t ii = 0; ii < ops.size(); ii++) {
+        Error rv = ops[ii].second ? compile_step(ops[ii].first)
+                                  : Error::VALUE_CANTINSERT;
+        if (!rv.success()) {
+            clear();
+            m_failed = ii;
+            return rv;
+        }
+    }
+
+    // Tests which precede any change share a scan of the original document
+    for (auto& step : m_steps) {
+        if (step.kind != Step::TEST) {
+            break;
+        }
+        step.node = m_tests.add(*step.path);
+    }
+    return Error::SUCCESS;
+}
+
+Error
+JsonPatch::run(Command code, const Path& path, const Loc& value, bool lookup)
+{
+    m_results.push_back(std::make_unique<Result>());
+    Result& res = *m_results.back();
+    m_op.clear();
+    m_op.set_doc(Buffer<Loc>(m_cur.data(), m_cur.size()));
+    m_op.set_code(code);
+    if (!value.empty()) {
+        m_op.set_value(value.at, value.length);
+    }
+    m_op.set_result_buf(&res);
+    Error rv = m_op.op_exec(path);
+    if (!rv.success() || lookup) {
+        return rv;
+    }
+
+    // The new segments may share memory (e.g. constant tokens), which the
+    // next command would otherwise copy again
+    auto segs = std::make_unique<Segments>();
+    segs->assign(res.newdoc());
+    m_cur.clear();
+    for (size_t ii = 0; ii < segs->count(); ii++) {
+        m_cur.push_back(segs->segment(ii));
+    }
+    m_docs.push_back(std::move(segs));
+    return rv;
+}
+
+Error
+JsonPatch::add(const Path& path, bool append, const Loc& value)
+{
+    if (append) {
+        return run(Command::ARRAY_APPEND, path, value, false);
+    }
+    if (path.size() == 1) {
+        // The whole document is replaced
+        m_cur.assign(1, value);
+        return Error::SUCCESS;
+    }
+    if (path.back().ptype == JSONSL_PATH_NUMERIC) {
+        Error rv = run(Command::ARRAY_INSERT, path, value, false);
+        if (rv != Error::PATH_MISMATCH) {
+            return rv;
+        }
+        // The parent may be an object, in which the index is a key
+        m_results.pop_back();
+    }
+    return run(Command::DICT_UPSERT, path, value, false);
+}
+
+Error
+JsonPatch::apply(const Step& step)
+{
+    Error rv;
+    switch (step.kind) {
+    case Step::ADD:
+        return add(*step.path, step.append, step.value);
+
+    case Step::REMOVE:
+        return run(Command::REMOVE, *step.path, Loc(), false);
+
+    case Step::REPLACE:
+        if (step.path->size() == 1) {
+            m_cur.assign(1, step.value);
+            return Error::SUCCESS;
+        }
+        return run(Command::REPLACE, *step.path, step.value, false);
+
+    case Step::TEST:
+        rv = run(Command::GET, *step.path, Loc(), true);
+        if (rv.success() &&
+                !json_equal(m_results.back()->matchloc(), step.value, m_jsn)) {
+            return Error::VALUE_MISMATCH;
+        }
+        return rv;
+
+    case Step::MOVE:
+    case Step::COPY: {
+        rv = run(Command::GET, *step.from, Loc(), true);
+        if (!rv.success()) {
+            return rv;
+        }
+        // Refers to the current document (or to the lookup's result), both
+        // of which remain valid
+        const Loc value = m_results.back()->matchloc();
+        if (step.kind == Step::MOVE) {
+            rv = run(Command::REMOVE, *step.from, Loc(), false);
+            if (!rv.success()) {
+                return rv;
+            }
+        }
+        return add(*step.path, step.append, value);
+    }
+    }
+    return Error::GLOBAL_ENOSUPPORT;
+}
+
+Error
+JsonPatch::exec(const char *doc, size_t n, Result& res)
+{
+    m_owndoc.assign(doc, n);
+    return exec(m_owndoc, res);
+}
+
+Error
+JsonPatch::exec(Segments& doc, Result& res)
+{
+    m_failed = NONE;
+    m_cur.clear();
+    m_results.clear();
+    m_docs.clear();
+    doc.pull_all();
+
+    size_t ii = 0;
+    if (!m_steps.empty() && m_steps[0].node != MultiMatch::NONE) {
+        m_tests.exec_match(doc, m_jsn);
+        if (m_tests.status != JSONSL_ERROR_SUCCESS) {
+            m_failed = 0;
+            return Util::doc_status(m_tests.status);
+        }
+        std::string copy;
+        for (; ii < m_steps.size() && m_steps[ii].node != MultiMatch::NONE;
+                ii++) {
+            const auto& node = m_tests[m_steps[ii].node];
+            if (!node.found) {
+                m_failed = ii;
+                return Error::PATH_ENOENT;
+            }
+            const Loc value = doc.flatten(node.loc, copy);
+            if (!json_equal(value, m_steps[ii].value, m_jsn)) {
+                m_failed = ii;
+                return Error::VALUE_MISMATCH;
+            }
+        }
+    }
+
+    for (size_t ix = 0; ix < doc.count(); ix++) {
+        m_cur.push_back(doc.segment(ix));
+    }
+    for (; ii < m_steps.size(); ii++) {
+        Error rv = apply(m_steps[ii]);
+        if (!rv.success()) {
+            m_failed = ii;
+            return rv;
+        }
+    }
+
+    res.clear();
+    res.m_newsegs = m_cur;
+    return Error::SUCCESS;
+}
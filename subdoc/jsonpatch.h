@@ -0,0 +1,107 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+
+#include <memory>
+
+namespace Subdoc {
+
+/**
+ * Applies a JSON Patch (RFC 6902), i.e. an array of operations such as
+ *
+ * @code
+ * [{"op":"test","path":"/a","value":1},{"op":"remove","path":"/b/0"}]
+ * @endcode
+ *
+ * The patch is compiled once into subdoc commands, whose paths are converted
+ * from JSON Pointers (see Path::parse_pointer()). Each command is applied to
+ * the segments produced by the previous one, so that nothing is copied until
+ * the final document (Result::newdoc()) is. The `test` operations at the
+ * beginning of the patch are evaluated together in a single scan, before
+ * any other operation; a patch stops at the first failing operation.
+ *
+ * A `test` compares values structurally, as json_equal() does: e.g. `1` is
+ * equal to `1.0`, and objects are equal regardless of the order of their
+ * members.
+ *
+ * A reference token consisting only of digits is an index within an array,
+ * and a key within an object. An `add` to such a path first tries inserting
+ * into an array, and only if the parent is not one adds (or replaces) the
+ * member of an object.
+ */
+class JsonPatch {
+public:
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    JsonPatch();
+    ~JsonPatch();
+    JsonPatch(const JsonPatch&) = delete;
+    JsonPatch& operator=(const JsonPatch&) = delete;
+
+    /**
+     * Compile a patch, replacing any previous one. The values of the patch
+     * are not copied, so it must remain valid while in use.
+     * @return Error::VALUE_CANTINSERT if the patch is not an array of
+     *         operations, Error::PATH_EINVAL or Error::PATH_E2BIG if a
+     *         pointer cannot be parsed (or a value would be moved into
+     *         itself), or Error::GLOBAL_ENOSUPPORT for an unknown operation.
+     *         failed() is the index of the offending operation.
+     */
+    Error compile(const char *patch, size_t n);
+    Error compile(const std::string& s) { return compile(s.c_str(), s.size()); }
+
+    /// Remove the patch
+    void clear();
+
+    /// Number of operations in the patch
+    size_t size() const;
+
+    /**
+     * Apply the patch to a document. The new document refers to `doc`, the
+     * patch, `res` and this object, which must all remain valid (and the
+     * patch may not be applied again) while it is in use.
+     * @return the error of the first operation which failed (see failed()),
+     *         Error::VALUE_MISMATCH if this was a `test`
+     */
+    Error exec(const char *doc, size_t n, Result& res);
+    Error exec(const std::string& s, Result& res) {
+        return exec(s.c_str(), s.size(), res);
+    }
+    Error exec(Segments& doc, Result& res);
+
+    /// Index of the operation which failed, or NONE
+    size_t failed() const { return m_failed; }
+
+private:
+    struct Step;
+    Error compile_step(const Loc& op);
+    Error run(Command code, const Path& path, const Loc& value, bool lookup);
+    Error add(const Path& path, bool append, const Loc& value);
+    Error apply(const Step& step);
+
+    std::vector<Step> m_steps;
+    // The `test` operations at the beginning of the patch
+    MultiMatch m_tests;
+    size_t m_failed = NONE;
+    Operation m_op;
+    jsonsl_t m_jsn;
+
+    // State of the last exec(): the segments of the current document, and
+    // what they refer to
+    Segments m_owndoc;
+    std::vector<Loc> m_cur;
+    std::vector<std::unique_ptr<Result>> m_results;
+    std::vector<std::unique_ptr<Segments>> m_docs;
+};
+
+} // namespace Subdoc
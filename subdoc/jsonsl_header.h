@@ -20,7 +20,9 @@
 #define JSONSL_STATE_USER_FIELDS \
     int mres;
 #define JSONSL_JPR_COMPONENT_USER_FIELDS \
-    bool is_neg;
+    bool is_neg; \
+    bool maybe_key; \
+    unsigned long idx_end;
 
 #ifdef INCLUDE_JSONSL_SRC
 #if defined(__GNUC__) || defined(__clang__)
@@ -14,6 +14,8 @@
 #include <string>
 
 namespace Subdoc {
+class Segments;
+
 /** Structure describing a position and length of a buffer (e.g. IOV) */
 class Loc {
 public:
@@ -137,6 +139,13 @@ public:
         }
     }
 
+    // Equivalents of the above, for a base which may be segmented. These
+    // are defined in segments.h
+    inline void end_at_begin(const Segments& base, const Loc& until, OverlapMode overlap);
+    inline void begin_at_end(const Segments& base, const Loc& from, OverlapMode overlap);
+    inline void begin_at_begin(const Segments& base, const Loc& from);
+    inline void end_at_end(const Segments& base, const Loc& until, OverlapMode overlap);
+
     bool empty() const {
         return length == 0;
     }
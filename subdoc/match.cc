@@ -13,16 +13,50 @@
 
 #define INCLUDE_JSONSL_SRC
 #include "match.h"
+#include "docindex.h"
 #include "hkesc.h"
 #include "jsonsl_header.h"
+#include "predicate.h"
+#include "segments.h"
 #include "util.h"
 #include "validate.h"
 #include <algorithm>
 
 using namespace Subdoc;
 
-namespace {
-struct ParseContext : public HashKey {
+namespace Subdoc {
+// State common to the scans of a document which may be segmented
+struct ScanContext : public HashKey {
+    // The document being matched, if it is segmented, and the offset of the
+    // segment currently being fed to the parser. Tokens beginning before this
+    // offset may not be contiguous.
+    Segments* doc = nullptr;
+    size_t seg_begin = 0;
+
+    // Storage for a key which had to be copied out of a segmented document
+    std::string hkcopy;
+
+    const char *pointer_at(const jsonsl_t jsn, size_t pos) const {
+        return doc ? doc->pointer_at(pos) : jsn->base + pos;
+    }
+
+    bool is_split(size_t pos_begin) const {
+        return doc != nullptr && pos_begin < seg_begin;
+    }
+
+    // Record the end of the current key, copying it if it is not contiguous
+    void set_hk_done(const jsonsl_state_st *state) {
+        set_hk_end(state);
+        if (is_split(state->pos_begin)) {
+            Loc rawkey;
+            hk_rawloc(rawkey);
+            doc->copy(rawkey, hkcopy);
+            set_hk_copy(hkcopy.data() + 1);
+        }
+    }
+};
+
+struct ParseContext : public ScanContext {
     ParseContext(Match *match, Path::CompInfo *jpr) : jpr(jpr), match(match){
     }
 
@@ -39,8 +73,51 @@ struct ParseContext : public HashKey {
     }
 
     const char *get_unique() const { return uniquebuf; }
+
+    // Storage for a unique value copied out of a segmented document
+    std::string uniquecopy;
+
+    // A child of the matched array, if Match::get_last_nth is greater than 1
+    struct ChildPos {
+        size_t pos_begin;
+        size_t length;
+        uint32_t type;
+        int sflags;
+        size_t nelem;
+    };
+
+    // The last Match::get_last_nth children seen (a ring buffer, which only
+    // grows up to that size), and the number of children seen
+    std::vector<ChildPos> lastchildren;
+    size_t nchildren = 0;
+
+    void add_last_child(const jsonsl_t jsn, const jsonsl_state_st *st,
+                        size_t nth) {
+        size_t len = jsn->pos - st->pos_begin;
+        if (st->type != JSONSL_T_SPECIAL) {
+            len++; // Include the terminating token
+        }
+        ChildPos child;
+        child.pos_begin = st->pos_begin;
+        child.length = len;
+        child.type = st->type;
+        child.sflags = st->special_flags;
+        child.nelem = st->nelem;
+        if (lastchildren.size() < nth) {
+            lastchildren.push_back(child);
+        } else {
+            lastchildren[nchildren % nth] = child;
+        }
+        nchildren++;
+    }
+
+    // The child `nth` from the end; at least `nth` children must have been
+    // seen
+    const ChildPos& last_child(size_t nth) const {
+        return lastchildren[nchildren % nth];
+    }
 };
-}
+} // namespace Subdoc
 
 static void push_callback(jsonsl_t jsn,
                           jsonsl_action_t,
@@ -95,6 +172,29 @@ static void unique_callback(jsonsl_t jsn,
 
     Expects(st->level == m->match_level + 1U);
 
+    const char *unique = ctx->get_unique();
+
+    if (m->unique_set != nullptr && !JSONSL_STATE_IS_CONTAINER(st)) {
+        if (st->type == JSONSL_T_STRING) {
+            slen++;
+        }
+        if (ctx->is_split(st->pos_begin)) {
+            ctx->doc->copy(Loc(unique, slen), ctx->uniquecopy);
+            unique = ctx->uniquecopy.data();
+        }
+        auto it = m->unique_set->find(std::string_view(unique, slen));
+        if (it != m->unique_set->end()) {
+            m->unique_item_found = 1;
+            m->unique_items.emplace_back(it->data(), it->size());
+        }
+        return;
+    }
+
+    if (m->unique_absent && !JSONSL_STATE_IS_CONTAINER(st)) {
+        // The value can't be equal to any element
+        return;
+    }
+
     if (st->type == JSONSL_T_STRING) {
         slen++;
 
@@ -106,13 +206,24 @@ static void unique_callback(jsonsl_t jsn,
             return; /* Length mismatch */
         }
 
-        rv = strncmp(ctx->get_unique() + 1, m->ensure_unique.at + 1, slen-2);
+        if (ctx->is_split(st->pos_begin)) {
+            ctx->doc->copy(Loc(unique, slen), ctx->uniquecopy);
+            unique = ctx->uniquecopy.data();
+        }
+        rv = strncmp(unique + 1, m->ensure_unique.at + 1, slen-2);
 
     } else if (st->type == JSONSL_T_SPECIAL) {
         if (m->ensure_unique.length != slen) {
             return;
         }
-        rv = strncmp(ctx->get_unique(), m->ensure_unique.at, slen);
+        if (ctx->is_split(st->pos_begin)) {
+            ctx->doc->copy(Loc(unique, slen), ctx->uniquecopy);
+            unique = ctx->uniquecopy.data();
+        }
+        rv = strncmp(unique, m->ensure_unique.at, slen);
+    } else if (m->find_all_unique) {
+        // A container is never equal to a primitive
+        return;
     } else {
         /* We can't reliably indicate uniqueness for non-primitives */
         m->matchres = JSONSL_MATCH_TYPE_MISMATCH;
@@ -122,13 +233,106 @@ static void unique_callback(jsonsl_t jsn,
 
     if (rv == 0) {
         m->unique_item_found = 1;
+        if (m->find_all_unique) {
+            m->unique_items.emplace_back(ctx->get_unique(), slen);
+            return;
+        }
+        jsonsl_stop(jsn);
+    }
+}
+
+/*
+ * Installed (if Match::contains is set) once an array has been matched. This
+ * is invoked for the array itself and for its children, which are tested
+ * against the predicate as they are popped.
+ */
+static void contains_callback(jsonsl_t jsn,
+                              jsonsl_action_t action,
+                              jsonsl_state_st* st,
+                              const jsonsl_char_t* at) {
+    ParseContext *ctx = get_ctx(jsn);
+    Match *m = ctx->match;
+
+    if (st->level == m->match_level) {
+        // Popping the array itself
+        jsn->action_callback_POP = pop_callback;
+        jsn->action_callback_PUSH = push_callback;
+        jsn->max_callback_level = st->level + 1;
+        pop_callback(jsn, action, st, at);
+        return;
+    }
+
+    if (action == JSONSL_ACTION_PUSH) {
+        ctx->set_unique_begin(st, at);
+        return;
+    }
+    if (JSONSL_STATE_IS_CONTAINER(st)) {
+        // Not comparable to a primitive
+        return;
+    }
+
+    size_t slen = st->pos_cur - st->pos_begin;
+    if (st->type == JSONSL_T_STRING) {
+        slen++;
+    }
+    const char *elem = ctx->get_unique();
+    if (ctx->is_split(st->pos_begin)) {
+        ctx->doc->copy(Loc(elem, slen), ctx->uniquecopy);
+        elem = ctx->uniquecopy.data();
+    }
+    if (m->contains->test(elem, slen)) {
+        m->contains_found = 1;
         jsonsl_stop(jsn);
     }
 }
 
+/*
+ * Installed (if Match::get_last_nth is greater than 1) once an array has
+ * been matched. The locations of its last children are recorded as they
+ * are popped, so that pop_callback() can pick the requested one once the
+ * array ends.
+ */
+static void last_nth_callback(jsonsl_t jsn,
+                              jsonsl_action_t action,
+                              jsonsl_state_st* st,
+                              const jsonsl_char_t* at) {
+    ParseContext *ctx = get_ctx(jsn);
+    Match *m = ctx->match;
+
+    if (st->level == m->match_level) {
+        // Popping the array itself
+        jsn->action_callback_POP = pop_callback;
+        jsn->action_callback_PUSH = push_callback;
+        jsn->max_callback_level = st->level + 1;
+        pop_callback(jsn, action, st, at);
+        return;
+    }
+    if (action == JSONSL_ACTION_POP) {
+        ctx->add_last_child(jsn, st, m->get_last_nth);
+    }
+}
+
 /* Make code a bit more readable */
 #define M_POSSIBLE JSONSL_MATCH_POSSIBLE
 
+/*
+ * As jsonsl_path_match(), but a numeric component with `maybe_key` set (an
+ * all-digit JSON Pointer token) may also continue into an object, where it
+ * is compared as a key.
+ */
+static jsonsl_jpr_match_t
+path_match(Path::CompInfo *jpr, const jsonsl_state_st *parent,
+    const jsonsl_state_st *child, const char *key, size_t nkey)
+{
+    auto rv = jsonsl_path_match(jpr, parent, child, key, nkey);
+    if (rv == JSONSL_MATCH_TYPE_MISMATCH && child->type == JSONSL_T_OBJECT &&
+            child->level < jpr->ncomponents &&
+            jpr->components[child->level].maybe_key) {
+        return JSONSL_MATCH_POSSIBLE;
+    }
+    return rv;
+}
+
 static void push_callback(jsonsl_t jsn,
                           jsonsl_action_t action,
                           jsonsl_state_st* st,
@@ -150,7 +354,7 @@ static void push_callback(jsonsl_t jsn,
         key = ctx->get_hk(nkey);
 
         /* Run the match */
-        st->mres = jsonsl_path_match(ctx->jpr, parent, st, key, nkey);
+        st->mres = path_match(ctx->jpr, parent, st, key, nkey);
 
         if (st->mres == JSONSL_MATCH_COMPLETE) {
             m->matchres = JSONSL_MATCH_COMPLETE;
@@ -169,6 +373,12 @@ static void push_callback(jsonsl_t jsn,
                 m->position = static_cast<unsigned>(parent->nelem - 1);
             }
 
+            if (m->skip_container && JSONSL_STATE_IS_CONTAINER(st)) {
+                m->container_skipped = 1;
+                jsonsl_stop(jsn);
+                return;
+            }
+
             if (m->ensure_unique.at) {
                 if (st->type != JSONSL_T_LIST) {
                     // Can't check "uniquness" in an array!
@@ -181,6 +391,17 @@ static void push_callback(jsonsl_t jsn,
                 jsn->action_callback_POP = unique_callback;
                 jsn->action_callback_PUSH = unique_callback;
                 jsn->max_callback_level = st->level + 2;
+
+            } else if (m->get_last && m->get_last_nth > 1 &&
+                    st->type == JSONSL_T_LIST) {
+                jsn->action_callback_POP = last_nth_callback;
+                jsn->action_callback_PUSH = last_nth_callback;
+                jsn->max_callback_level = st->level + 2;
+
+            } else if (m->contains != nullptr && st->type == JSONSL_T_LIST) {
+                jsn->action_callback_POP = contains_callback;
+                jsn->action_callback_PUSH = contains_callback;
+                jsn->max_callback_level = st->level + 2;
             }
 
         } else if (st->mres == JSONSL_MATCH_NOMATCH) {
@@ -243,6 +464,47 @@ next_sibling_push_callback(jsonsl_t jsn, jsonsl_action_t action,
     jsonsl_stop(jsn);
 }
 
+/*
+ * Called (if Match::keys_sorted is set) once a key within an object has been
+ * read. If the object is on the match path and the key sorts after the one
+ * being looked for, the wanted key cannot appear later in the object and
+ * the search ends here, as if the object had been scanned to its end.
+ */
+static void
+check_sorted_key(jsonsl_t jsn, ParseContext *ctx, const jsonsl_state_st *state)
+{
+    Match *m = ctx->match;
+    const jsonsl_state_st *parent = jsonsl_last_state(jsn, state);
+    if (parent == nullptr || parent->mres != M_POSSIBLE ||
+            parent->level >= ctx->jpr->ncomponents) {
+        return;
+    }
+
+    const Path::Component& comp = ctx->jpr->components[parent->level];
+    if (comp.ptype != JSONSL_PATH_STRING) {
+        return;
+    }
+
+    size_t nkey;
+    const char *key = ctx->get_hk(nkey);
+    int rv = memcmp(key, comp.pstr, std::min(nkey, comp.len));
+    if (rv < 0 || (rv == 0 && nkey <= comp.len)) {
+        // Key sorts before (or is) the one we want
+        return;
+    }
+
+    ctx->hk_rawloc(m->loc_next_key);
+    // The parent has not been scanned to its end; only its beginning (up to
+    // the next key) is known
+    m->loc_deepest.length = state->pos_begin - parent->pos_begin;
+    m->num_siblings = static_cast<unsigned>((parent->nelem + 1) / 2);
+    m->type = parent->type;
+    if (parent->level == ctx->jpr->ncomponents-1) {
+        m->immediate_parent_found = 1;
+    }
+    jsonsl_stop(jsn);
+}
+
 static void pop_callback(jsonsl_t jsn,
                          jsonsl_action_t,
                          jsonsl_state_st* state,
@@ -253,7 +515,10 @@ static void pop_callback(jsonsl_t jsn,
     if (state->type == JSONSL_T_HKEY) {
         // All we care about is recording the length of the key. We'll use
         // this later on when matching (in the PUSH callback of a new element)
-        ctx->set_hk_end(state);
+        ctx->set_hk_done(state);
+        if (m->keys_sorted) {
+            check_sorted_key(jsn, ctx, state);
+        }
         return;
     }
 
@@ -277,13 +542,30 @@ static void pop_callback(jsonsl_t jsn,
                 jsonsl_stop(jsn);
                 return;
             }
-            if (!state->nelem) {
-                // List is empty
+            if (state->nelem < m->get_last_nth) {
+                // List is empty, or too short
                 m->matchres = JSONSL_MATCH_UNKNOWN;
                 jsonsl_stop(jsn);
                 return;
             }
 
+            if (m->get_last_nth > 1) {
+                // Transpose the match to the child recorded by
+                // last_nth_callback()
+                const auto& child = ctx->last_child(m->get_last_nth);
+                m->loc_deepest.at = ctx->pointer_at(jsn, child.pos_begin);
+                m->loc_deepest.length = child.length;
+                m->match_level = state->level + 1;
+                m->sflags = child.sflags;
+                m->type = child.type;
+                m->num_children = child.nelem;
+                m->num_siblings = state->nelem - 1;
+                m->position = state->nelem - m->get_last_nth;
+                m->loc_key.clear();
+                jsonsl_stop(jsn);
+                return;
+            }
+
             // Transpose the match
             const jsonsl_state_st *child = jsonsl_last_child(jsn, state);
 
@@ -291,12 +573,13 @@ static void pop_callback(jsonsl_t jsn,
             size_t child_endpos = jsn->pos;
 
             m->loc_deepest.length = child_endpos - child->pos_begin;
-            m->loc_deepest.at = jsn->base + child->pos_begin;
+            m->loc_deepest.at = ctx->pointer_at(jsn, child->pos_begin);
 
             // Remove trailing whitespace. This is because the child is
             // deemed to end one character before the parent does, however
             // there may be whitespace. This is usually OK but confuses tests.
-            while (isspace(m->loc_deepest.at[m->loc_deepest.length-1])) {
+            while (isspace(*ctx->pointer_at(jsn,
+                    child->pos_begin + m->loc_deepest.length - 1))) {
                 --m->loc_deepest.length;
             }
 
@@ -371,28 +654,61 @@ static void pop_callback(jsonsl_t jsn,
     jsonsl_stop(jsn);
 }
 
-int
-Match::exec_match_simple(const char *value, size_t nvalue,
-    const Path::CompInfo *jpr, jsonsl_t jsn)
+static void
+init_parser(jsonsl_t jsn, ParseContext *ctx)
 {
-    ParseContext ctx(this, const_cast<Path::CompInfo*>(jpr));
-    status = JSONSL_ERROR_SUCCESS;
+    ctx->match->status = JSONSL_ERROR_SUCCESS;
 
     jsonsl_enable_all_callbacks(jsn);
     jsn->action_callback_PUSH = push_callback;
     jsn->action_callback_POP = pop_callback;
     jsn->error_callback = err_callback;
-    jsn->max_callback_level = ctx.jpr->ncomponents + 1;
-    jsn->data = &ctx;
+    jsn->max_callback_level = ctx->jpr->ncomponents + 1;
+    jsn->data = ctx;
+}
 
-    jsonsl_feed(jsn, value, nvalue);
+/*
+ * Feed the segments of ctx->doc which have not been parsed yet, pulling more
+ * of the document from its source as needed. Returns false if the end of the
+ * data received so far was reached, and the document is partial.
+ */
+static bool
+feed_segments(jsonsl_t jsn, ScanContext *ctx, const int& status)
+{
+    Segments *segs = ctx->doc;
+    // Note that jsonsl_feed() may not be called again once parsing was
+    // stopped or failed.
+    while (!jsn->stopfl && status == JSONSL_ERROR_SUCCESS) {
+        if (jsn->pos == segs->size() && !segs->pull()) {
+            return !segs->partial();
+        }
+        const Loc seg = segs->segment_from(jsn->pos);
+        ctx->seg_begin = jsn->pos;
+        jsonsl_feed(jsn, seg.at, seg.length);
+    }
+    return true;
+}
+
+int
+Match::exec_match_simple(const char *value, size_t nvalue,
+    Segments *segs, const Path::CompInfo *jpr, jsonsl_t jsn)
+{
+    ParseContext ctx(this, const_cast<Path::CompInfo*>(jpr));
+    init_parser(jsn, &ctx);
+
+    if (segs == nullptr || (segs->contiguous() && !segs->has_more())) {
+        jsonsl_feed(jsn, value, nvalue);
+    } else {
+        ctx.doc = segs;
+        feed_segments(jsn, &ctx, status);
+    }
     jsonsl_reset(jsn);
     return 0;
 }
 
 int
-Match::exec_match_negix(const char *value, size_t nvalue, const Path *pth,
-    jsonsl_t jsn)
+Match::exec_match_negix(const char *value, size_t nvalue,
+    Segments *segs, const Path *pth, jsonsl_t jsn)
 {
     /* First component to scan in next iteration */
     size_t cur_start = 1;
@@ -407,8 +723,28 @@ Match::exec_match_negix(const char *value, size_t nvalue, const Path *pth,
     size_t last_len = nvalue;
     /* Pointer to the beginning of the current subdocument */
     const char *last_start = value;
+    /* The current subdocument, if the document is segmented */
+    Segments subdoc;
+    Segments *last_segs = segs;
     std::ranges::copy(orig, comp_s.begin());
 
+    // Request fields which apply to the element matched by the whole path.
+    // clear() resets them, so they are restored for the final scan only
+    const Loc req_unique = ensure_unique;
+    const unsigned char req_find_all = find_all_unique;
+    const std::unordered_set<std::string_view>* req_set = unique_set;
+    const unsigned char req_absent = unique_absent;
+    const Predicate* req_contains = contains;
+    const unsigned char req_skip = skip_container;
+    auto restore_request = [&]() {
+        ensure_unique = req_unique;
+        find_all_unique = req_find_all;
+        unique_set = req_set;
+        unique_absent = req_absent;
+        contains = req_contains;
+        skip_container = req_skip;
+    };
+
     while (cur_start < orig.size()) {
         size_t ii;
         int rv, is_last_neg = 0;
@@ -447,12 +783,15 @@ Match::exec_match_negix(const char *value, size_t nvalue, const Path *pth,
          * unfortunately. */
         clear();
 
-        // Transpose array's last element as the match itself
+        // Transpose array's nth-last element as the match itself
         if (is_last_neg) {
             get_last = 1;
+            get_last_nth = static_cast<size_t>(-static_cast<long>(orig[ii].idx));
+        } else {
+            restore_request();
         }
 
-        rv = exec_match_simple(last_start, last_len, &tmp, jsn);
+        rv = exec_match_simple(last_start, last_len, last_segs, &tmp, jsn);
         match_level += level_offset;
         if (level_offset) {
             // 'nth iteration
@@ -473,17 +812,113 @@ Match::exec_match_negix(const char *value, size_t nvalue, const Path *pth,
 
         last_start = loc_deepest.at;
         last_len = loc_deepest.length;
+        if (segs != nullptr) {
+            subdoc.assign(*segs, segs->offset_of(last_start), last_len);
+            last_segs = &subdoc;
+        }
 
         /* Chomp off the current component */
         cur_start = ii + 1;
     }
 
+    if (orig.back().is_neg && matchres == JSONSL_MATCH_COMPLETE &&
+            (req_unique.at != nullptr || req_contains != nullptr)) {
+        // The match was transposed from its parent array, which is what the
+        // request fields would have applied to. Scan the element itself
+        // again, as the root of a path of its own. (#skip_container needs
+        // no such scan, as the element has been parsed already.)
+        const size_t level = match_level;
+        const size_t pos = position;
+        const size_t siblings = num_siblings;
+        clear();
+        restore_request();
+
+        Path::Component& root = comp_s[orig.size() - 1];
+        root.ptype = JSONSL_PATH_ROOT;
+        Path::CompInfo tmp(&root, 1);
+        int rv = exec_match_simple(last_start, last_len, last_segs, &tmp, jsn);
+        if (rv != 0) {
+            return rv;
+        }
+        match_level = level;
+        position = pos;
+        num_siblings = siblings;
+    }
+
     // This is currently only used by GET_COUNT, in which an element is
     // artificially added.
     immediate_parent_found = match_level >= pth->ncomponents-1;
     return 0;
 }
 
+/**
+ * Attempts to resolve the match using #index. This is only possible if the
+ * final component is a dictionary key whose parent has been indexed, and the
+ * key is definitely not present.
+ *
+ * @return true if the match was resolved, false if a scan is required
+ */
+bool
+Match::exec_match_index(const char *value, size_t nvalue, const Path *pth)
+{
+    if (!index->indexes(value, nvalue) || pth->has_negix) {
+        return false;
+    }
+
+    if (ensure_unique.at != nullptr && !find_all_unique) {
+        // Only if all elements are primitives; a scan would otherwise stop
+        // at the first container (unless an equal value precedes it)
+        const auto* arr = index->find_array(*pth);
+        if (arr != nullptr && !arr->has_containers) {
+            status = JSONSL_ERROR_SUCCESS;
+            matchres = JSONSL_MATCH_COMPLETE;
+            type = JSONSL_T_LIST;
+            match_level = pth->size();
+            loc_deepest.assign(value + arr->offset, arr->length);
+            num_children = arr->nelems;
+            if (unique_set != nullptr) {
+                for (const auto& value : *unique_set) {
+                    if (arr->values.count(value)) {
+                        unique_items.emplace_back(value.data(), value.size());
+                    }
+                }
+                unique_item_found = !unique_items.empty();
+            } else {
+                unique_item_found = arr->values.count(std::string_view(
+                        ensure_unique.at, ensure_unique.length)) != 0;
+            }
+            index_resolved = 1;
+            return true;
+        }
+    }
+
+    if (pth->back().ptype != JSONSL_PATH_STRING) {
+        return false;
+    }
+
+    const auto* ent = index->find_parent(*pth);
+    if (ent == nullptr) {
+        return false;
+    }
+
+    const auto& comp = pth->back();
+    if (ent->filter.maybe_contains(comp.pstr, comp.len)) {
+        return false;
+    }
+
+    // Definite miss. Fill in the same information as pop_callback() would
+    // have, had the parent been scanned to the end.
+    status = JSONSL_ERROR_SUCCESS;
+    matchres = JSONSL_MATCH_POSSIBLE;
+    type = JSONSL_T_OBJECT;
+    match_level = pth->size() - 1;
+    loc_deepest.assign(value + ent->offset, ent->length);
+    num_siblings = ent->nkeys;
+    immediate_parent_found = 1;
+    index_resolved = 1;
+    return true;
+}
+
 /**
  * Retrieves a buffer for the designated _path_ in the JSON document. The
  * actual length of the remaining components may be determined by using
@@ -498,16 +933,73 @@ Match::exec_match_negix(const char *value, size_t nvalue, const Path *pth,
 int
 Match::exec_match(const char *value, size_t nvalue, const Path *pth, jsonsl_t jsn)
 {
+    if (index != nullptr && exec_match_index(value, nvalue, pth)) {
+        return 0;
+    }
     if (!pth->has_negix) {
-        return exec_match_simple(value, nvalue, pth, jsn);
+        return exec_match_simple(value, nvalue, nullptr, pth, jsn);
     }
-    return exec_match_negix(value, nvalue, pth, jsn);
+    return exec_match_negix(value, nvalue, nullptr, pth, jsn);
+}
+
+/**
+ * Like the above, but for a document which may be segmented. Any locations
+ * in the match are then as described in the Segments documentation, i.e.
+ * they may extend past the end of the segment they begin in.
+ *
+ * If the document is read from a source, chunks are pulled (and appended to
+ * `doc`) only until the match is resolved.
+ */
+int
+Match::exec_match(Segments& doc, const Path *pth, jsonsl_t jsn)
+{
+    if (doc.contiguous() && !doc.has_more()) {
+        return exec_match(doc.begin(), doc.size(), pth, jsn);
+    }
+    if (!pth->has_negix) {
+        return exec_match_simple(doc.begin(), doc.size(), &doc, pth, jsn);
+    }
+    return exec_match_negix(doc.begin(), doc.size(), &doc, pth, jsn);
+}
+
+int
+Match::exec_match_begin(Segments& doc, const Path *pth, jsonsl_t jsn)
+{
+    Expects(!pth->has_negix);
+    // The context is referenced by the parser until the match is resolved,
+    // which may be after this call returns
+    m_suspended = std::make_unique<ParseContext>(
+        this, const_cast<Path*>(pth));
+    m_suspended->doc = &doc;
+    init_parser(jsn, m_suspended.get());
+    return exec_match_resume(jsn);
+}
+
+int
+Match::exec_match_resume(jsonsl_t jsn)
+{
+    Expects(m_suspended != nullptr);
+    if (feed_segments(jsn, m_suspended.get(), status)) {
+        exec_match_abort(jsn);
+    }
+    return 0;
+}
+
+void
+Match::exec_match_abort(jsonsl_t jsn)
+{
+    jsonsl_reset(jsn);
+    m_suspended.reset();
 }
 
 Match::Match() = default;
 
 Match::~Match() = default;
 
+Match::Match(Match&&) noexcept = default;
+
+Match& Match::operator=(Match&&) noexcept = default;
+
 void Match::clear() {
     *this = {};
 }
@@ -524,6 +1016,590 @@ Match::jsn_free(jsonsl_t jsn)
     jsonsl_destroy(jsn);
 }
 
+namespace {
+struct MultiContext : public ScanContext {
+    explicit MultiContext(MultiMatch *mm) : mm(mm) {
+    }
+
+    MultiMatch *mm;
+
+    // The node corresponding to the element at each level of the parser
+    // (NONE for the elements of a node with MultiMatch::Node::elements set,
+    // which are not nodes themselves), and the beginning of each element
+    std::array<size_t, Limits::PARSER_DEPTH + 1> nodes;
+    std::array<const char*, Limits::PARSER_DEPTH + 1> begins;
+
+    // Storage for an element copied out of a segmented document
+    std::string elemcopy;
+
+    // Whether the element at `level` is an element of an array node whose
+    // elements are reported to the listener
+    bool is_reported(const jsonsl_state_st *parent) const {
+        return parent != nullptr && parent->type == JSONSL_T_LIST
+                && nodes[parent->level] != MultiMatch::NONE
+                && (*mm)[nodes[parent->level]].elements;
+    }
+};
+}
+
+static MultiContext* get_multi_ctx(const jsonsl_t jsn) {
+    return static_cast<MultiContext*>(jsn->data);
+}
+
+static int
+multi_err_callback(jsonsl_t jsn, jsonsl_error_t err, jsonsl_state_st *,
+    jsonsl_char_t *)
+{
+    get_multi_ctx(jsn)->mm->status = err;
+    return 0;
+}
+
+static void
+multi_push_callback(jsonsl_t jsn, jsonsl_action_t, jsonsl_state_st *st,
+    const jsonsl_char_t *at)
+{
+    MultiContext *ctx = get_multi_ctx(jsn);
+    MultiMatch *mm = ctx->mm;
+
+    if (st->type == JSONSL_T_HKEY) {
+        ctx->set_hk_begin(st, at);
+        return;
+    }
+
+    size_t ix = 0;
+    const jsonsl_state_st *parent = jsonsl_last_state(jsn, st);
+    if (parent != nullptr) {
+        size_t nkey = 0;
+        const char *key = nullptr;
+        if (parent->type == JSONSL_T_OBJECT) {
+            key = ctx->get_hk(nkey);
+        }
+        ix = mm->find_child(ctx->nodes[parent->level], parent->type,
+            key, nkey, static_cast<unsigned long>(parent->nelem - 1));
+    }
+
+    // Elements which are not on any path, or whose paths were all resolved
+    // by an earlier occurrence of the same key, are skipped entirely (unless
+    // they are primitives to be reported to the listener)
+    if (ix != MultiMatch::NONE &&
+            (*mm)[ix].nresolved == (*mm)[ix].nterminal) {
+        ix = MultiMatch::NONE;
+    }
+    if (ix == MultiMatch::NONE) {
+        if (JSONSL_STATE_IS_CONTAINER(st) || !ctx->is_reported(parent)) {
+            st->ignore_callback = 1;
+            return;
+        }
+        ctx->nodes[st->level] = ix;
+        ctx->begins[st->level] = at;
+        return;
+    }
+
+    MultiMatch::Node& node = (*mm)[ix];
+    node.type = st->type;
+    node.loc.at = at;
+    if (parent != nullptr && parent->type == JSONSL_T_OBJECT) {
+        ctx->hk_rawloc(node.loc_key);
+    }
+    ctx->nodes[st->level] = ix;
+    ctx->begins[st->level] = at;
+}
+
+static void
+multi_pop_callback(jsonsl_t jsn, jsonsl_action_t, jsonsl_state_st *st,
+    const jsonsl_char_t *)
+{
+    MultiContext *ctx = get_multi_ctx(jsn);
+    MultiMatch *mm = ctx->mm;
+
+    if (st->type == JSONSL_T_HKEY) {
+        ctx->set_hk_done(st);
+        return;
+    }
+
+    size_t len = jsn->pos - st->pos_begin;
+    if (st->type != JSONSL_T_SPECIAL) {
+        len++; // Include the terminating token
+    }
+
+    MultiMatch::Listener *listener = mm->listener();
+    const jsonsl_state_st *parent = jsonsl_last_state(jsn, st);
+    if (listener != nullptr && !JSONSL_STATE_IS_CONTAINER(st) &&
+            ctx->is_reported(parent)) {
+        const char *elem = ctx->begins[st->level];
+        if (ctx->is_split(st->pos_begin)) {
+            ctx->doc->copy(Loc(elem, len), ctx->elemcopy);
+            elem = ctx->elemcopy.data();
+        }
+        if (listener->element(*mm, ctx->nodes[parent->level], elem, len)) {
+            jsonsl_stop(jsn);
+            return;
+        }
+    }
+
+    const size_t ix = ctx->nodes[st->level];
+    if (ix == MultiMatch::NONE) {
+        return;
+    }
+    MultiMatch::Node& node = (*mm)[ix];
+    node.loc.length = len;
+    node.num_children = st->nelem;
+    node.sflags = st->special_flags;
+
+    // Anything below this element which was not found is missing
+    mm->resolve(ix);
+    if ((listener != nullptr && listener->resolved(*mm, ix)) ||
+            mm->remaining() == 0) {
+        jsonsl_stop(jsn);
+    }
+}
+
+MultiMatch::MultiMatch() : m_nodes(1) {
+}
+
+void
+MultiMatch::clear()
+{
+    m_nodes.resize(1);
+    m_nodes[0] = {};
+}
+
+size_t
+MultiMatch::add(const Path& path)
+{
+    Expects(!path.has_negix);
+    size_t ix = 0;
+    for (size_t ii = 1; ii < path.size(); ii++) {
+        const Path::Component& comp = path[ii];
+        const bool numeric = comp.ptype == JSONSL_PATH_NUMERIC;
+        size_t child = find_child(ix,
+            numeric ? JSONSL_T_LIST : JSONSL_T_OBJECT,
+            comp.pstr, comp.len, comp.idx);
+
+        if (child == NONE) {
+            child = m_nodes.size();
+            m_nodes.emplace_back();
+            Node& node = m_nodes.back();
+            node.ptype = comp.ptype;
+            node.parent = ix;
+            if (numeric) {
+                node.idx = comp.idx;
+            } else {
+                node.key.assign(comp.pstr, comp.len);
+            }
+
+            // Array elements are kept in index order (i.e. the order in
+            // which they appear), other children in the order they are added
+            size_t *link = &m_nodes[ix].first_child;
+            while (*link != NONE) {
+                const Node& sib = m_nodes[*link];
+                if (numeric && sib.ptype == JSONSL_PATH_NUMERIC &&
+                        sib.idx > comp.idx) {
+                    break;
+                }
+                link = &m_nodes[*link].next_sibling;
+            }
+            m_nodes[child].next_sibling = *link;
+            *link = child;
+        }
+        if (comp.maybe_key && !m_nodes[child].maybe_key) {
+            // Within an object, the element is the member named by the
+            // index (which an index of another path then also refers to)
+            m_nodes[child].maybe_key = true;
+            m_nodes[child].key.assign(comp.pstr, comp.len);
+        }
+        ix = child;
+    }
+
+    if (!m_nodes[ix].terminal) {
+        m_nodes[ix].terminal = true;
+        for (size_t cur = ix; cur != NONE; cur = m_nodes[cur].parent) {
+            m_nodes[cur].nterminal++;
+        }
+    }
+    return ix;
+}
+
+size_t
+MultiMatch::find_child(size_t parent, unsigned prtype,
+    const char *key, size_t nkey, unsigned long idx) const
+{
+    for (size_t ix = m_nodes[parent].first_child; ix != NONE;
+            ix = m_nodes[ix].next_sibling) {
+        const Node& node = m_nodes[ix];
+        if (prtype == JSONSL_T_LIST) {
+            if (node.ptype == JSONSL_PATH_NUMERIC && node.idx == idx) {
+                return ix;
+            }
+        } else if ((node.ptype == JSONSL_PATH_STRING || node.maybe_key) &&
+                node.key.size() == nkey &&
+                std::equal(key, key + nkey, node.key.begin())) {
+            return ix;
+        }
+    }
+    return NONE;
+}
+
+void
+MultiMatch::resolve(size_t ix)
+{
+    Node& node = m_nodes[ix];
+    const size_t nfound = node.terminal && !node.found ? 1 : 0;
+    const size_t nresolved = node.nterminal - node.nresolved;
+    if (nfound) {
+        node.found = 1;
+    }
+    for (size_t cur = ix; cur != NONE; cur = m_nodes[cur].parent) {
+        m_nodes[cur].nresolved += nresolved;
+        m_nodes[cur].nfound += nfound;
+    }
+}
+
+int
+MultiMatch::exec_match(const char *value, size_t nvalue, Segments *segs,
+    jsonsl_t jsn)
+{
+    for (auto& node : m_nodes) {
+        node.type = 0;
+        node.sflags = 0;
+        node.loc = {};
+        node.loc_key = {};
+        node.num_children = 0;
+        node.found = 0;
+        node.nresolved = 0;
+        node.nfound = 0;
+    }
+    status = JSONSL_ERROR_SUCCESS;
+    if (remaining() == 0) {
+        return 0;
+    }
+
+    MultiContext ctx(this);
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->action_callback_PUSH = multi_push_callback;
+    jsn->action_callback_POP = multi_pop_callback;
+    jsn->error_callback = multi_err_callback;
+    jsn->max_callback_level = Limits::PARSER_DEPTH + 1;
+    jsn->data = &ctx;
+
+    if (segs == nullptr || (segs->contiguous() && !segs->has_more())) {
+        jsonsl_feed(jsn, value, nvalue);
+    } else {
+        ctx.doc = segs;
+        feed_segments(jsn, &ctx, status);
+    }
+    jsonsl_reset(jsn);
+    return 0;
+}
+
+int
+MultiMatch::exec_match(const char *value, size_t nvalue, jsonsl_t jsn)
+{
+    return exec_match(value, nvalue, nullptr, jsn);
+}
+
+int
+MultiMatch::exec_match(Segments& doc, jsonsl_t jsn)
+{
+    return exec_match(doc.begin(), doc.size(), &doc, jsn);
+}
+
+namespace Subdoc {
+struct IterContext : public ScanContext {
+    IterContext(MatchIterator *it, const Path *path, jsonsl_t jsn,
+                size_t chunk_size)
+        : it(it), path(path), jsn(jsn), chunk_size(chunk_size),
+          terminal(path->size()) {
+    }
+
+    MatchIterator *it;
+    const Path *path;
+    jsonsl_t jsn;
+    size_t chunk_size;
+
+    // The level of the matches. For a ContainerCursor, these are the
+    // children of the element at the end of the path
+    size_t terminal;
+    ContainerCursor *cursor = nullptr;
+
+    // Matches found by the callbacks
+    std::vector<MatchIterator::Item> *items = nullptr;
+
+    // The document, if the iterator was given a contiguous buffer
+    Segments owndoc;
+
+    // Whether `comp` matches the element just pushed as a child of `parent`
+    bool matches(const Path::Component& comp, const jsonsl_state_st *parent) {
+        switch (comp.ptype) {
+        case JSONSL_PATH_STRING: {
+            if (parent->type != JSONSL_T_OBJECT) {
+                return false;
+            }
+            size_t nkey;
+            const char *key = get_hk(nkey);
+            return nkey == comp.len && std::equal(key, key + nkey, comp.pstr);
+        }
+        case JSONSL_PATH_NUMERIC:
+            if (parent->type == JSONSL_T_OBJECT && comp.maybe_key) {
+                size_t nkey;
+                const char *key = get_hk(nkey);
+                return nkey == comp.len && std::equal(key, key + nkey, comp.pstr);
+            }
+            return parent->type == JSONSL_T_LIST &&
+                    parent->nelem - 1 == comp.idx;
+        case JSONSL_PATH_WILDCARD:
+            if (!comp.is_arridx) {
+                return parent->type == JSONSL_T_OBJECT;
+            }
+            return parent->type == JSONSL_T_LIST &&
+                    parent->nelem - 1 >= comp.idx &&
+                    parent->nelem - 1 < comp.idx_end;
+        default:
+            return false;
+        }
+    }
+};
+} // namespace Subdoc
+
+static IterContext* get_iter_ctx(const jsonsl_t jsn) {
+    return static_cast<IterContext*>(jsn->data);
+}
+
+static int
+iter_err_callback(jsonsl_t jsn, jsonsl_error_t err, jsonsl_state_st *,
+    jsonsl_char_t *)
+{
+    get_iter_ctx(jsn)->it->status = err;
+    return 0;
+}
+
+static void
+iter_push_callback(jsonsl_t jsn, jsonsl_action_t, jsonsl_state_st *st,
+    const jsonsl_char_t *at)
+{
+    IterContext *ctx = get_iter_ctx(jsn);
+
+    if (st->type == JSONSL_T_HKEY) {
+        ctx->set_hk_begin(st, at);
+        return;
+    }
+
+    // The top-level element matches the root component; any other element
+    // on the path is only reached if its parent matched. The children of a
+    // cursor's container all match.
+    const jsonsl_state_st *parent = jsonsl_last_state(jsn, st);
+    if (parent != nullptr && st->level <= ctx->path->size() &&
+            !ctx->matches((*ctx->path)[st->level - 1], parent)) {
+        st->ignore_callback = 1;
+        return;
+    }
+    if (ctx->cursor != nullptr && st->level == ctx->path->size()) {
+        ctx->cursor->found = 1;
+        ctx->cursor->type = st->type;
+        ctx->cursor->loc.at = at;
+        if (!JSONSL_STATE_IS_CONTAINER(st)) {
+            jsonsl_stop(jsn);
+        }
+        return;
+    }
+    if (st->level != ctx->terminal) {
+        return;
+    }
+
+    ctx->items->emplace_back();
+    MatchIterator::Item& item = ctx->items->back();
+    item.type = st->type;
+    item.loc.at = at;
+    if (parent == nullptr) {
+        return;
+    }
+    if (parent->type == JSONSL_T_OBJECT) {
+        ctx->hk_rawloc(item.loc_key);
+        item.position = parent->nelem / 2 - 1;
+    } else {
+        item.position = parent->nelem - 1;
+    }
+}
+
+static void
+iter_pop_callback(jsonsl_t jsn, jsonsl_action_t, jsonsl_state_st *st,
+    const jsonsl_char_t *)
+{
+    IterContext *ctx = get_iter_ctx(jsn);
+
+    if (st->type == JSONSL_T_HKEY) {
+        ctx->set_hk_done(st);
+        return;
+    }
+    if (ctx->cursor != nullptr && st->level == ctx->path->size()) {
+        // The end of the container; there are no more children
+        ctx->cursor->num_children = st->type == JSONSL_T_OBJECT ?
+                st->nelem / 2 : st->nelem;
+        ctx->cursor->loc.length = jsn->pos - st->pos_begin + 1;
+        jsonsl_stop(jsn);
+        return;
+    }
+    if (st->level != ctx->terminal) {
+        return;
+    }
+
+    // Matches cannot be nested, so this is the last one pushed
+    MatchIterator::Item& item = ctx->items->back();
+    item.loc.length = jsn->pos - st->pos_begin;
+    if (st->type != JSONSL_T_SPECIAL) {
+        item.loc.length++; // Include the terminating token
+    }
+    if (!ctx->path->has_wildcard && ctx->cursor == nullptr) {
+        // This was the only possible match
+        jsonsl_stop(jsn);
+    }
+}
+
+MatchIterator::MatchIterator() = default;
+
+MatchIterator::~MatchIterator()
+{
+    end();
+}
+
+void
+MatchIterator::begin(const char *value, size_t nvalue, const Path *path,
+    jsonsl_t jsn, size_t chunk_size)
+{
+    begin_scan(nullptr, value, nvalue, path, jsn, chunk_size, nullptr);
+}
+
+void
+MatchIterator::begin(Segments& doc, const Path *path, jsonsl_t jsn,
+    size_t chunk_size)
+{
+    begin_scan(&doc, nullptr, 0, path, jsn, chunk_size, nullptr);
+}
+
+void
+MatchIterator::begin_scan(Segments *doc, const char *value, size_t nvalue,
+    const Path *path, jsonsl_t jsn, size_t chunk_size,
+    ContainerCursor *cursor)
+{
+    Expects(!path->has_negix);
+    Expects(chunk_size > 0);
+    end();
+    m_ctx = std::make_unique<IterContext>(this, path, jsn, chunk_size);
+    if (doc == nullptr) {
+        m_ctx->owndoc.assign(value, nvalue);
+        doc = &m_ctx->owndoc;
+    }
+    m_ctx->doc = doc;
+    m_ctx->items = &m_items;
+    if (cursor != nullptr) {
+        m_ctx->cursor = cursor;
+        m_ctx->terminal++;
+    }
+    m_items.clear();
+    m_next = 0;
+    status = JSONSL_ERROR_SUCCESS;
+
+    jsonsl_enable_all_callbacks(jsn);
+    jsn->action_callback_PUSH = iter_push_callback;
+    jsn->action_callback_POP = iter_pop_callback;
+    jsn->error_callback = iter_err_callback;
+    jsn->max_callback_level = m_ctx->terminal + 1;
+    jsn->data = m_ctx.get();
+}
+
+/*
+ * Feed the parser the next chunk of the document. Returns false (ending the
+ * scan) if there is nothing left to parse.
+ */
+bool
+MatchIterator::feed()
+{
+    jsonsl_t jsn = m_ctx->jsn;
+    Segments *segs = m_ctx->doc;
+    if (jsn->stopfl || status != JSONSL_ERROR_SUCCESS) {
+        return false;
+    }
+    if (jsn->pos == segs->size() && !segs->pull()) {
+        return false;
+    }
+
+    // A match which is still open when the chunk ends remains at the back of
+    // m_items, and is completed by a later chunk
+    const Loc seg = segs->segment_from(jsn->pos);
+    m_ctx->seg_begin = jsn->pos;
+    jsonsl_feed(jsn, seg.at, std::min(seg.length, m_ctx->chunk_size));
+    return true;
+}
+
+bool
+MatchIterator::next()
+{
+    if (m_ctx == nullptr) {
+        return false;
+    }
+
+    // Only matches which have been popped (i.e. whose length is known) may
+    // be returned. All but the last item found are complete.
+    auto complete = [this]() {
+        return m_next < m_items.size() &&
+                (m_next + 1 < m_items.size() ||
+                 !m_items.back().loc.empty());
+    };
+    while (!complete()) {
+        if (m_next == m_items.size()) {
+            m_items.clear();
+            m_next = 0;
+        }
+        if (!feed()) {
+            // Discard an incomplete match in a truncated document
+            if (!m_items.empty() && m_items.back().loc.empty()) {
+                m_items.pop_back();
+            }
+            if (m_next == m_items.size()) {
+                end();
+                return false;
+            }
+            break;
+        }
+    }
+    m_next++;
+    return true;
+}
+
+void
+MatchIterator::end()
+{
+    if (m_ctx == nullptr) {
+        return;
+    }
+    jsonsl_reset(m_ctx->jsn);
+    m_ctx.reset();
+}
+
+void
+ContainerCursor::open(const char *value, size_t nvalue, const Path *path,
+    jsonsl_t jsn, size_t chunk_size)
+{
+    Expects(!path->has_wildcard);
+    type = 0;
+    found = 0;
+    num_children = 0;
+    loc.length = 0;
+    m_iter.begin_scan(nullptr, value, nvalue, path, jsn, chunk_size, this);
+}
+
+void
+ContainerCursor::open(Segments& doc, const Path *path, jsonsl_t jsn,
+    size_t chunk_size)
+{
+    Expects(!path->has_wildcard);
+    type = 0;
+    found = 0;
+    num_children = 0;
+    loc.length = 0;
+    m_iter.begin_scan(&doc, nullptr, 0, path, jsn, chunk_size, this);
+}
+
 struct validate_ctx {
     int err = 0;
     int rootcount = 0;
@@ -12,9 +12,21 @@
 
 #include "loc.h"
 #include "path.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
 
 namespace Subdoc {
 
+class DocIndex;
+class Predicate;
+class Segments;
+struct ParseContext;
+struct IterContext;
+class ContainerCursor;
+
 /** Structure describing a match for an item */
 class Match {
 public:
@@ -110,6 +122,13 @@ public:
      */
     unsigned char get_last = 0;
 
+    /**Request field; used with #get_last. The child to return, counting
+     * back from the end of the array (1 being the last child). Only the
+     * locations of the last #get_last_nth children are kept while the array
+     * is scanned. If the array has fewer children, #matchres is
+     * JSONSL_MATCH_UNKNOWN */
+    size_t get_last_nth = 1;
+
     enum SearchOptions {
         GET_MATCH_ONLY = 0,
         GET_FOLLOWING_SIBLINGS
@@ -135,6 +154,72 @@ public:
      * types are mismatched. */
     Loc ensure_unique;
 
+    /**Request flag; used with #ensure_unique. Rather than ending at the
+     * first element equal to #ensure_unique, the scan continues to the end
+     * of the array, adding the location of each such element to
+     * #unique_items. Elements which are containers are skipped rather than
+     * being a mismatch. */
+    unsigned char find_all_unique = 0;
+
+    /**Request field; used with #ensure_unique (which is then the whole
+     * series of values). The elements are looked up in this set of values
+     * (as they would appear in the document) rather than compared against
+     * #ensure_unique, and the scan continues to the end of the array. Each
+     * value equal to an element is added to #unique_items. */
+    const std::unordered_set<std::string_view>* unique_set = nullptr;
+
+    /**Response field; see #find_all_unique and #unique_set */
+    std::vector<Loc> unique_items;
+
+    /**Request flag; used with #ensure_unique. The value is known not to
+     * occur anywhere in the document, so that the elements of the array are
+     * only checked for their type, and not compared against it. */
+    unsigned char unique_absent = 0;
+
+    /**Request field; an index of the document being matched. If the index
+     * was built from the same buffer and covers the parent of the path, a key
+     * which definitely does not exist is resolved without scanning: the
+     * result is the same as if the (existing) parent had been scanned and
+     * the key was not found. Likewise, with #ensure_unique (but not
+     * #find_all_unique), an indexed array of primitives is resolved from
+     * its set of values; only its location, #type and #num_children are
+     * then set. */
+    const DocIndex* index = nullptr;
+
+    /**Response flag; set if the match was resolved using #index rather than
+     * by scanning the document */
+    unsigned char index_resolved = 0;
+
+    /**Request flag; the keys of every object in the document are known to
+     * be in (byte-wise) ascending order. When looking for a key, the search
+     * of its parent object ends as soon as a key sorting after it is found,
+     * rather than at the end of the object. */
+    unsigned char keys_sorted = 0;
+
+    /**Response field; if #keys_sorted is set and the search ended at a key
+     * sorting after the missing one, the location of that key (including its
+     * quotes). A new key may be inserted directly before it. In this case
+     * #loc_deepest only covers the parent up to (not including) this key */
+    Loc loc_next_key;
+
+    /**Request field; if set (to a Predicate::CONTAINS predicate) and the
+     * match is an array, its elements are tested as they are parsed. The
+     * scan ends at the first one satisfying the predicate, setting
+     * #contains_found; #loc_deepest is then incomplete. */
+    const Predicate* contains = nullptr;
+
+    /**Response flag; set if an element satisfying #contains was found */
+    unsigned char contains_found = 0;
+
+    /**Request flag; if the match is a container, the scan ends as soon as
+     * it begins, setting #container_skipped. Only the beginning of
+     * #loc_deepest is then valid, and #num_children is not set. */
+    unsigned char skip_container = 0;
+
+    /**Response flag; set if the matched container was not parsed (see
+     * #skip_container) */
+    unsigned char container_skipped = 0;
+
     int exec_match(const char *value, size_t nvalue, const Path *path, jsonsl_t jsn);
     int exec_match(const Loc& loc, const Path* path, jsonsl_t jsn) {
         return exec_match(loc.at, loc.length, path, jsn);
@@ -142,15 +227,293 @@ public:
     int exec_match(const std::string& s, const Path& path, jsonsl_t jsn) {
         return exec_match(s.c_str(), s.size(), &path, jsn);
     }
+    int exec_match(Segments& doc, const Path* path, jsonsl_t jsn);
+
+    /**
+     * Begin matching a document which is still being received (see
+     * Segments::assign_partial()). If the end of the data received so far
+     * is reached before the match is resolved, parsing is suspended:
+     * #suspended() then returns true, and exec_match_resume() should be
+     * called once more of the document (or its end) has been received.
+     *
+     * The path may not contain negative indexes.
+     */
+    int exec_match_begin(Segments& doc, const Path* path, jsonsl_t jsn);
+    int exec_match_resume(jsonsl_t jsn);
+
+    /** Abandon a suspended match, resetting the parser */
+    void exec_match_abort(jsonsl_t jsn);
+
+    /** Whether the match is waiting for more of the document */
+    bool suspended() const { return m_suspended != nullptr; }
 
     Match();
     ~Match();
+    Match(Match&&) noexcept;
+    Match& operator=(Match&&) noexcept;
     void clear();
 
     static jsonsl_t jsn_alloc();
     static void jsn_free(jsonsl_t jsn);
 private:
-    inline int exec_match_simple(const char *value, size_t nvalue, const Path::CompInfo *jpr, jsonsl_t jsn);
-    inline int exec_match_negix(const char *value, size_t nvalue, const Path *pth, jsonsl_t jsn);
+    inline int exec_match_simple(const char *value, size_t nvalue, Segments *segs, const Path::CompInfo *jpr, jsonsl_t jsn);
+    inline int exec_match_negix(const char *value, size_t nvalue, Segments *segs, const Path *pth, jsonsl_t jsn);
+    inline bool exec_match_index(const char *value, size_t nvalue, const Path *pth);
+
+    /** Parser state of a suspended match */
+    std::unique_ptr<ParseContext> m_suspended;
+};
+
+/**
+ * Matches several paths in a single pass over a document. The paths are
+ * merged into a tree (so that common prefixes are only compared once), and
+ * the scan ends as soon as every path has been either found, or found to be
+ * missing.
+ *
+ * Paths with negative array indexes are not supported.
+ */
+class MultiMatch {
+public:
+    static const size_t NONE = static_cast<size_t>(-1);
+
+    /** An element of the document on (or at the end of) one of the paths */
+    struct Node {
+        /** The path component identifying the element within its parent */
+        jsonsl_jpr_type_t ptype = JSONSL_PATH_ROOT;
+        std::string key;
+        unsigned long idx = 0;
+        /** Whether an index also names a member (#key) within an object
+         * (see Path::parse_pointer()) */
+        bool maybe_key = false;
+
+        size_t parent = NONE;
+        size_t first_child = NONE;
+        size_t next_sibling = NONE;
+
+        /** Whether a path ends at this element */
+        bool terminal = false;
+        /** Request flag; if this element is an array, report its primitive
+         * elements to the listener (see Listener::element()) */
+        bool elements = false;
+        /** Number of paths ending at or below this element */
+        size_t nterminal = 0;
+
+        /**Response fields; set once the element has been seen. For
+         * intermediate elements, only #type and #loc_key are valid. */
+        uint32_t type = 0;
+        /** Flags, if #type is JSONSL_TYPE_SPECIAL (see Match::sflags) */
+        int sflags = 0;
+        Loc loc;
+        /** The element's key (including quotes), if its parent is an object */
+        Loc loc_key;
+        /** For containers, the number of children (see Match::num_children) */
+        size_t num_children = 0;
+        /** Whether the element was found (only valid if #terminal) */
+        unsigned char found = 0;
+
+        /** Number of paths ending at or below this element which have been
+         * resolved, and how many of those were found */
+        size_t nresolved = 0;
+        size_t nfound = 0;
+    };
+
+    /**
+     * Receives the results of a scan as they become known. Either method
+     * may end the scan by returning true.
+     */
+    class Listener {
+    public:
+        virtual ~Listener() = default;
+
+        /** The element at node `ix` has been parsed; the node and the nodes
+         * below it are resolved */
+        virtual bool resolved(const MultiMatch& mm, size_t ix) = 0;
+
+        /** A primitive child of node `ix` (which has Node::elements set)
+         * has been parsed. The value is only valid during the call */
+        virtual bool element(const MultiMatch& /* mm */, size_t /* ix */,
+                             const char * /* value */,
+                             size_t /* nvalue */) {
+            return false;
+        }
+    };
+
+    MultiMatch();
+
+    /** Set (or, with NULL, remove) the listener for subsequent scans */
+    void set_listener(Listener *listener) { m_listener = listener; }
+    Listener *listener() const { return m_listener; }
+
+    /**
+     * Add a path. The path need not remain valid afterwards.
+     * @return the index of the node at which the path ends. If the same
+     *         path is added twice, the same node is returned.
+     */
+    size_t add(const Path& path);
+
+    /** Remove all paths */
+    void clear();
+
+    /** Error status (jsonsl_error_t) of the last scan */
+    int status = 0;
+
+    int exec_match(const char *value, size_t nvalue, jsonsl_t jsn);
+    int exec_match(const std::string& s, jsonsl_t jsn) {
+        return exec_match(s.c_str(), s.size(), jsn);
+    }
+    int exec_match(Segments& doc, jsonsl_t jsn);
+
+    size_t size() const { return m_nodes.size(); }
+    const Node& operator[](size_t ix) const { return m_nodes[ix]; }
+    Node& operator[](size_t ix) { return m_nodes[ix]; }
+    const Node& root() const { return m_nodes.front(); }
+
+    /** The child of `parent` matching an element of a `prtype` container;
+     * `key` is used for objects, and `idx` for lists */
+    size_t find_child(size_t parent, unsigned prtype,
+                      const char *key, size_t nkey, unsigned long idx) const;
+
+    /** Mark the paths ending at or below `ix` as resolved. If `ix` is a
+     * terminal which has not been resolved yet, it is marked as found */
+    void resolve(size_t ix);
+
+    /** Number of paths which have not been resolved */
+    size_t remaining() const { return root().nterminal - root().nresolved; }
+
+private:
+    int exec_match(const char *value, size_t nvalue, Segments *segs,
+                   jsonsl_t jsn);
+
+    std::vector<Node> m_nodes;
+    Listener *m_listener = nullptr;
+};
+
+/**
+ * Yields each element matching a path, in document order, during a single
+ * scan of the document. Unlike Match, the path may contain wildcards (see
+ * Path::parse_wildcard()), e.g. `items[*].sku`.
+ *
+ * The document is parsed a chunk at a time, only as far as is needed to
+ * find the next match; matching containers are never copied or
+ * materialized. The parser is owned by the iterator from begin() until the
+ * scan ends (or end() is called), and both the document and the path must
+ * remain valid until then.
+ *
+ * Paths with negative array indexes are not supported.
+ */
+class MatchIterator {
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 4096;
+
+    /** A matching element */
+    struct Item {
+        /** The element's type (jsonsl_type_t) */
+        uint32_t type = 0;
+        /** The element itself. For a segmented document, this is a location
+         * as described in Segments */
+        Loc loc;
+        /** The element's key (including quotes), if its parent is an object */
+        Loc loc_key;
+        /** The element's position within its parent */
+        size_t position = 0;
+    };
+
+    MatchIterator();
+    ~MatchIterator();
+    MatchIterator(const MatchIterator&) = delete;
+    MatchIterator& operator=(const MatchIterator&) = delete;
+
+    /**
+     * Begin a scan. The first match is available after calling next().
+     * @param chunk_size the most the parser is fed at a time
+     */
+    void begin(const char *value, size_t nvalue, const Path *path,
+               jsonsl_t jsn, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    void begin(Segments& doc, const Path *path, jsonsl_t jsn,
+               size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    /**
+     * Advance to the next match, parsing more of the document as needed.
+     * @return false once there are no more matches; #status then indicates
+     *         whether the document was invalid
+     */
+    bool next();
+
+    /** The current match; valid after next() has returned true */
+    const Item& item() const { return m_items[m_next - 1]; }
+
+    /** Abandon the scan, resetting the parser */
+    void end();
+
+    /** Error status (jsonsl_error_t) of the scan */
+    int status = 0;
+
+private:
+    friend class ContainerCursor;
+    void begin_scan(Segments *doc, const char *value, size_t nvalue,
+                    const Path *path, jsonsl_t jsn, size_t chunk_size,
+                    ContainerCursor *cursor);
+    bool feed();
+
+    std::unique_ptr<IterContext> m_ctx;
+    // Matches found in the chunks parsed so far, which have not been
+    // returned yet; m_next is the index of the next one
+    std::vector<Item> m_items;
+    size_t m_next = 0;
+};
+
+/**
+ * Iterates over the children of the container at a path. The container is
+ * located once, and each call to next() then resumes the same parser where
+ * the previous one stopped, so iterating over the whole container parses
+ * the document up to its end only once (rather than once per child, as
+ * with a lookup of each index in turn).
+ *
+ * The path may not contain wildcards or negative indexes. The document and
+ * the path must remain valid until the iteration ends (or close() is
+ * called); the parser is used by the cursor until then.
+ */
+class ContainerCursor {
+public:
+    using Child = MatchIterator::Item;
+
+    /** Position the cursor on the container at `path` */
+    void open(const char *value, size_t nvalue, const Path *path,
+              jsonsl_t jsn,
+              size_t chunk_size = MatchIterator::DEFAULT_CHUNK_SIZE);
+    void open(Segments& doc, const Path *path, jsonsl_t jsn,
+              size_t chunk_size = MatchIterator::DEFAULT_CHUNK_SIZE);
+
+    /**
+     * Advance to the next child
+     * @return false once there are no more children (or if the path was not
+     *         found, or is not a container)
+     */
+    bool next() { return m_iter.next(); }
+
+    /** The current child; valid after next() has returned true */
+    const Child& child() const { return m_iter.item(); }
+
+    /** Stop iterating, resetting the parser */
+    void close() { m_iter.end(); }
+
+    /** Error status (jsonsl_error_t) of the scan */
+    int status() const { return m_iter.status; }
+
+    /** Response flag; set once the element at the path has been found */
+    unsigned char found = 0;
+
+    /** The type of the element at the path (valid if #found) */
+    uint32_t type = 0;
+
+    /** The number of children, once next() has returned false */
+    size_t num_children = 0;
+
+    /** The location of the container, once next() has returned false. For
+     * a segmented document, this is a location as described in Segments */
+    Loc loc;
+
+private:
+    MatchIterator m_iter;
 };
 } // namespace Subdoc
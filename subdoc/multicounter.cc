@@ -0,0 +1,153 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "multicounter.h"
+#include <algorithm>
+#include <charconv>
+#include <limits>
+
+using namespace Subdoc;
+
+/* Add b to a, unless the result would overflow */
+static bool
+add_int64(int64_t& a, int64_t b)
+{
+    if (b >= 0 && a >= 0) {
+        if (std::numeric_limits<int64_t>::max() - b < a) {
+            return false;
+        }
+    } else if (b < 0 && a < 0) {
+        if (b < std::numeric_limits<int64_t>::min() - a) {
+            return false;
+        }
+    }
+    a += b;
+    return true;
+}
+
+Error
+MultiCounter::add(const char *pth, size_t npth, const char *delta,
+                  size_t ndelta)
+{
+    int64_t num;
+    Error status = Operation::parse_delta(Loc(delta, ndelta), num);
+    if (!status.success()) {
+        return status;
+    }
+
+    status = m_batch.parse(pth, npth);
+    if (!status.success()) {
+        return status;
+    }
+
+    const size_t node = m_batch.add();
+    auto it = std::find(m_nodes.begin(), m_nodes.end(), node);
+    if (it == m_nodes.end()) {
+        m_counters.push_back(m_nodes.size());
+        m_nodes.push_back(node);
+        m_deltas.push_back(num);
+        return Error::SUCCESS;
+    }
+
+    // The same path again
+    const size_t ix = it - m_nodes.begin();
+    if (!add_int64(m_deltas[ix], num)) {
+        return Error::DELTA_OVERFLOW;
+    }
+    m_counters.push_back(ix);
+    return Error::SUCCESS;
+}
+
+void
+MultiCounter::clear()
+{
+    m_batch.clear();
+    m_counters.clear();
+    m_nodes.clear();
+    m_deltas.clear();
+    m_values.clear();
+    m_failed = NONE;
+}
+
+Error
+MultiCounter::exec(const char *doc, size_t n, Result& res)
+{
+    Segments segs;
+    segs.assign(doc, n);
+    return exec(segs, res);
+}
+
+Error
+MultiCounter::exec(Segments& doc, Result& res)
+{
+    m_failed = NONE;
+    doc.pull_all();
+    Error status = m_batch.exec(doc);
+    if (!status.success()) {
+        return status;
+    }
+
+    // Compute every new value before changing anything
+    m_values.assign(m_nodes.size(), std::string());
+    std::string numcopy;
+    for (size_t ii = 0; ii < m_nodes.size(); ii++) {
+        const auto& node = m_batch.match()[m_nodes[ii]];
+        Error rv;
+        if (!node.found) {
+            rv = Error::PATH_ENOENT;
+        } else if (node.type != JSONSL_T_SPECIAL ||
+                (node.sflags & ~(JSONSL_SPECIALf_NUMERIC))) {
+            rv = Error::PATH_MISMATCH;
+        } else {
+            const char *numstr = doc.flatten(node.loc, numcopy).at;
+            int64_t num;
+            auto [ptr, ec] =
+                    std::from_chars(numstr, numstr + node.loc.length, num);
+            if (ec != std::errc() || ptr != numstr + node.loc.length) {
+                rv = Error::NUM_E2BIG;
+            } else if (!add_int64(num, m_deltas[ii])) {
+                rv = Error::DELTA_OVERFLOW;
+            } else {
+                m_values[ii] = std::to_string(num);
+            }
+        }
+        if (!rv.success()) {
+            m_failed = std::find(m_counters.begin(), m_counters.end(), ii) -
+                       m_counters.begin();
+            return rv;
+        }
+    }
+
+    // Replace the numbers in document order
+    std::vector<size_t> order(m_nodes.size());
+    for (size_t ii = 0; ii < order.size(); ii++) {
+        order[ii] = ii;
+    }
+    std::vector<size_t> offsets(m_nodes.size());
+    for (size_t ii = 0; ii < m_nodes.size(); ii++) {
+        offsets[ii] = doc.offset_of(m_batch.match()[m_nodes[ii]].loc.at);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return offsets[a] < offsets[b];
+    });
+
+    res.clear();
+    auto& segs = res.m_newsegs;
+    size_t pos = 0;
+    for (auto ix : order) {
+        if (offsets[ix] > pos) {
+            doc.slice(Loc(doc.pointer_at(pos), offsets[ix] - pos), segs);
+        }
+        segs.emplace_back(m_values[ix].data(), m_values[ix].size());
+        pos = offsets[ix] + m_batch.match()[m_nodes[ix]].loc.length;
+    }
+    doc.slice(Loc(doc.pointer_at(pos), doc.size() - pos), segs);
+    return Error::SUCCESS;
+}
@@ -0,0 +1,84 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+#include "pathbatch.h"
+
+#include <string>
+
+namespace Subdoc {
+
+/**
+ * Increments several counters (as Command::COUNTER would, one path at a
+ * time) in a single scan of the document, producing a single new document.
+ * The batch is applied as a whole: if any of the counters cannot be
+ * incremented, the document is not changed at all.
+ *
+ * Unlike Command::COUNTER, the counters must already exist. A path given
+ * more than once is incremented by the sum of its deltas.
+ */
+class MultiCounter {
+public:
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    /**
+     * Add a counter. Neither the path nor the delta need remain valid
+     * afterwards.
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, Error::GLOBAL_ENOSUPPORT if it contains negative array
+     *         indexes, or the error of Operation::parse_delta()
+     */
+    Error add(const char *pth, size_t npth, const char *delta, size_t ndelta);
+    Error add(const std::string& pth, const std::string& delta) {
+        return add(pth.c_str(), pth.size(), delta.c_str(), delta.size());
+    }
+
+    /// Remove all counters
+    void clear();
+
+    /// Number of counters added
+    size_t size() const { return m_counters.size(); }
+
+    /**
+     * Increment the counters of a document. The new document refers to
+     * `doc`, `res` and this object, which must remain valid (and no other
+     * document be incremented) while it is in use.
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document
+     *         could not be parsed, or the error of the first counter which
+     *         failed (see failed()), as for Command::COUNTER
+     */
+    Error exec(const char *doc, size_t n, Result& res);
+    Error exec(const std::string& s, Result& res) {
+        return exec(s.c_str(), s.size(), res);
+    }
+    Error exec(Segments& doc, Result& res);
+
+    /// Index of the counter which failed in the last exec(), or NONE
+    size_t failed() const { return m_failed; }
+
+    /// The new value of the `ix`th counter, after a successful exec()
+    const std::string& value(size_t ix) const {
+        return m_values[m_counters[ix]];
+    }
+
+private:
+    PathBatch m_batch;
+    // For each counter, the index of its path within the following
+    std::vector<size_t> m_counters;
+    // The node, total delta and new value of each distinct path
+    std::vector<size_t> m_nodes;
+    std::vector<int64_t> m_deltas;
+    std::vector<std::string> m_values;
+    size_t m_failed = NONE;
+};
+
+} // namespace Subdoc
@@ -0,0 +1,157 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "multiremove.h"
+#include "util.h"
+#include <algorithm>
+#include <map>
+
+using namespace Subdoc;
+
+static size_t
+skip_ws_forward(const Segments& doc, size_t off)
+{
+    while (off < doc.size() && Util::is_json_ws(doc.at(off))) {
+        off++;
+    }
+    return off;
+}
+
+/* Returns one past the last non-whitespace character before `off` */
+static size_t
+skip_ws_back(const Segments& doc, size_t off)
+{
+    while (off && Util::is_json_ws(doc.at(off - 1))) {
+        off--;
+    }
+    return off;
+}
+
+Error
+MultiRemove::add(const char *pth, size_t npth)
+{
+    Error status = m_batch.parse(pth, npth);
+    if (!status.success()) {
+        return status;
+    }
+    if (m_batch.path().size() == 1) {
+        // Can't remove root element!
+        return Error::VALUE_CANTINSERT;
+    }
+    m_nodes.push_back(m_batch.add());
+    return Error::SUCCESS;
+}
+
+void
+MultiRemove::clear()
+{
+    m_batch.clear();
+    m_nodes.clear();
+}
+
+Error
+MultiRemove::exec(const char *doc, size_t n, Result& res)
+{
+    Segments segs;
+    segs.assign(doc, n);
+    return exec(segs, res);
+}
+
+Error
+MultiRemove::exec(Segments& doc, Result& res)
+{
+    doc.pull_all();
+    Error status = m_batch.exec(doc);
+    if (!status.success()) {
+        return status;
+    }
+
+    std::vector<Range> elems;
+    for (auto ix : m_nodes) {
+        const auto& node = m_batch.match()[ix];
+        if (!node.found) {
+            continue;
+        }
+        const Loc& first = node.loc_key.empty() ? node.loc : node.loc_key;
+        const size_t begin = doc.offset_of(first.at);
+        elems.push_back({begin, doc.offset_of(node.loc.at) + node.loc.length});
+    }
+    std::sort(elems.begin(), elems.end(),
+              [](const Range& a, const Range& b) {
+                  return a.begin < b.begin;
+              });
+
+    // Elements within (or the same as) another removed element go with it
+    size_t nkept = 0;
+    for (const auto& elem : elems) {
+        if (nkept && elem.begin < elems[nkept - 1].end) {
+            continue;
+        }
+        elems[nkept++] = elem;
+    }
+    elems.resize(nkept);
+
+    res.clear();
+    elide(doc, elems, res.m_newsegs);
+    return Error::SUCCESS;
+}
+
+void
+MultiRemove::elide(const Segments& doc, const std::vector<Range>& elems,
+                   std::vector<Loc>& out)
+{
+    // Find the elements after the last one kept within their container;
+    // those take the comma preceding them rather than the one following
+    std::map<size_t, bool> trailing; // By beginning
+    std::vector<size_t> next(elems.size()); // Beginning of the next sibling
+    for (size_t ii = elems.size(); ii--;) {
+        const auto& elem = elems[ii];
+        size_t off = skip_ws_forward(doc, elem.end);
+        if (off < doc.size() && doc.at(off) == ',') {
+            off = skip_ws_forward(doc, off + 1);
+            next[ii] = off;
+            // Only trailing if the next sibling is removed, and trailing
+            auto found = trailing.find(off);
+            trailing[elem.begin] = found != trailing.end() && found->second;
+        } else {
+            // The last child of its container
+            next[ii] = elem.end;
+            trailing[elem.begin] = true;
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t ii = 0; ii < elems.size(); ii++) {
+        const auto& elem = elems[ii];
+        if (!trailing[elem.begin]) {
+            // NEWDOC = [ ... (---> ELEM , <---) NEXT ... ]
+            ranges.emplace_back(elem.begin, next[ii]);
+            continue;
+        }
+        // NEWDOC = [ ... PREV (---> , ELEM <---) ]
+        size_t begin = skip_ws_back(doc, elem.begin);
+        if (begin && doc.at(begin - 1) == ',') {
+            begin = skip_ws_back(doc, begin - 1);
+        } else {
+            // The first child; all of them are removed
+            begin = elem.begin;
+        }
+        ranges.emplace_back(begin, elem.end);
+    }
+
+    size_t pos = 0;
+    for (const auto& range : ranges) {
+        if (range.first > pos) {
+            doc.slice(Loc(doc.pointer_at(pos), range.first - pos), out);
+        }
+        pos = std::max(pos, range.second);
+    }
+    doc.slice(Loc(doc.pointer_at(pos), doc.size() - pos), out);
+}
@@ -0,0 +1,86 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+#include "pathbatch.h"
+
+namespace Subdoc {
+
+/**
+ * Removes the elements at several paths (as Command::REMOVE would, one path
+ * at a time) in a single scan of the document. The paths may be siblings or
+ * unrelated; a path below another one which is removed is simply removed
+ * along with it. Paths which do not exist in the document are skipped.
+ *
+ * The new document (Result::newdoc()) consists of the parts of the original
+ * document between the removed elements. Where elements are removed from
+ * the same container, the commas between them are removed as a whole: each
+ * removed element takes the comma following it, except for those after the
+ * last element which is kept, which take the comma preceding them.
+ */
+class MultiRemove {
+public:
+    /**
+     * Add a path to remove. The path need not remain valid afterwards.
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, Error::VALUE_CANTINSERT for the root element, or
+     *         Error::GLOBAL_ENOSUPPORT if it contains negative array indexes
+     */
+    Error add(const char *pth, size_t npth);
+    Error add(const std::string& s) { return add(s.c_str(), s.size()); }
+
+    /// Remove all paths
+    void clear();
+
+    /// Number of paths added
+    size_t size() const { return m_nodes.size(); }
+
+    /**
+     * Remove the paths from a document. The new document refers to `doc`,
+     * which must remain valid while it is in use.
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document
+     *         could not be parsed
+     */
+    Error exec(const char *doc, size_t n, Result& res);
+    Error exec(const std::string& s, Result& res) {
+        return exec(s.c_str(), s.size(), res);
+    }
+    Error exec(Segments& doc, Result& res);
+
+    /// Whether the element at the `ix`th path was found (and removed) by
+    /// the last exec()
+    bool removed(size_t ix) const {
+        return m_batch.match()[m_nodes[ix]].found != 0;
+    }
+
+    /// An element to remove, as offsets within the document. It begins at
+    /// its key, if it has one
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+
+    /**
+     * Append the segments of `doc` without the given elements, which must
+     * be sorted and may not contain one another, eliding the commas as
+     * described above.
+     */
+    static void elide(const Segments& doc, const std::vector<Range>& elems,
+                      std::vector<Loc>& out);
+
+private:
+    PathBatch m_batch;
+    // The node of each path
+    std::vector<size_t> m_nodes;
+};
+
+} // namespace Subdoc
@@ -9,14 +9,23 @@
  */
 
 #include "operations.h"
+#include "childcount.h"
+#include "multiremove.h"
+#include "predicate.h"
 #include "util.h"
 #include "validate.h"
 #include <gsl/gsl-lite.hpp>
 #include <cerrno>
 #include <charconv>
 #include <cinttypes>
+#include <cmath>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
 using Subdoc::Loc;
 using Subdoc::Error;
@@ -24,6 +33,10 @@ using Subdoc::Operation;
 using Subdoc::Path;
 using Subdoc::Match;
 using Subdoc::Command;
+using Subdoc::Segments;
+using Subdoc::ContainerCursor;
+using Subdoc::Scalar;
+using Subdoc::Util;
 
 static Loc loc_COMMA(",", 1);
 static Loc loc_QUOTE("\"", 1);
@@ -41,19 +54,17 @@ static Loc loc_QUOTE_COLON("\":", 2);
 Error
 Operation::do_match_common(Match::SearchOptions options)
 {
-    m_match.extra_options = options;
-    m_match.exec_match(m_doc, m_path, m_jsn);
+    if (!m_prematched) {
+        m_match.extra_options = options;
+        m_match.index = m_index;
+        m_match.keys_sorted = m_keys_sorted;
+        m_match.exec_match(m_doc, m_path, m_jsn);
+    }
 
     if (m_match.matchres == JSONSL_MATCH_TYPE_MISMATCH) {
         return Error::PATH_MISMATCH;
     }
-    if (m_match.status != JSONSL_ERROR_SUCCESS) {
-        if (m_match.status == JSONSL_ERROR_LEVELS_EXCEEDED) {
-            return Error::DOC_ETOODEEP;
-        }
-        return Error::DOC_NOTJSON;
-    }
-    return Error::SUCCESS;
+    return Util::doc_status(m_match.status);
 }
 
 Error Operation::do_get() const {
@@ -71,18 +82,22 @@ Error Operation::do_get() const {
 /* Start at the end of the buffer, stripping last comma */
 #define STRIP_LAST_COMMA 2
 
-static void strip_comma(Loc* loc, int mode) {
+static void strip_comma(const Segments& doc, Loc* loc, int mode) {
+    if (loc->empty()) {
+        return;
+    }
+    const size_t begin = doc.offset_of(loc->at);
     if (mode == STRIP_FIRST_COMMA) {
         for (size_t ii = 0; ii < loc->length; ii++) {
-            if (loc->at[ii] == ',') {
-                loc->at += (ii + 1);
+            if (doc.at(begin + ii) == ',') {
+                loc->at = doc.pointer_at(begin + ii + 1);
                 loc->length -= (ii + 1);
                 return;
             }
         }
     } else {
         for (auto ii = loc->length; ii; ii--) {
-            if (loc->at[ii-1] == ',') {
+            if (doc.at(begin + ii - 1) == ',') {
                 loc->length = ii-1;
                 return;
             }
@@ -140,14 +155,14 @@ Operation::do_remove()
              * MATCH     = d
              * NEWDOC[1] = ]
              */
-            strip_comma(&newdoc_at(0), STRIP_LAST_COMMA);
+            strip_comma(m_doc, &newdoc_at(0), STRIP_LAST_COMMA);
         } else {
             /*
              * NEWDOC[0] = [a,b,
              * MATCH     = c
              * NEWDOC[1] = Strip here -->, d]
              */
-            strip_comma(&newdoc_at(1), STRIP_FIRST_COMMA);
+            strip_comma(m_doc, &newdoc_at(1), STRIP_FIRST_COMMA);
         }
     }
 
@@ -155,16 +170,88 @@ Operation::do_remove()
     return Error::SUCCESS;
 }
 
+Error
+Operation::do_pop()
+{
+    // The element to remove is the first or last child of the path
+    const long ix = m_optype == Command::ARRAY_POP_FIRST ? 0 : -1;
+    if (m_path->add_array_index(ix) != JSONSL_ERROR_SUCCESS) {
+        return Error::PATH_E2BIG;
+    }
+
+    Error rv = do_remove();
+    if (!rv.success()) {
+        return rv;
+    }
+    m_result->m_match = m_match.loc_deepest;
+    return Error::SUCCESS;
+}
+
+Error
+Operation::do_remove_value()
+{
+    // Find every element equal to the value while matching the array
+    m_match.ensure_unique = m_userval;
+    m_match.find_all_unique = 1;
+    Error rv = do_match_common(Match::GET_MATCH_ONLY);
+    if (!rv.success()) {
+        return rv;
+    }
+    if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
+        return Error::PATH_ENOENT;
+    }
+    if (m_match.type != JSONSL_T_LIST) {
+        return Error::PATH_MISMATCH;
+    }
+
+    std::vector<MultiRemove::Range> elems;
+    for (const auto& item : m_match.unique_items) {
+        const size_t begin = m_doc.offset_of(item.at);
+        elems.push_back({begin, begin + item.length});
+    }
+    MultiRemove::elide(m_doc, elems, m_result->m_newsegs);
+    m_result->m_newlen = 0;
+
+    m_result->m_numbuf = std::to_string(elems.size());
+    m_result->m_match.assign(
+        m_result->m_numbuf.c_str(), m_result->m_numbuf.size());
+    return Error::SUCCESS;
+}
+
+/* Whether the value found for Command::REPLACE_IF is the expected one */
+bool
+Operation::replace_expected()
+{
+    std::string copy;
+    const Loc cur = m_doc.flatten(m_match.loc_deepest, copy);
+    if (m_expected_canonical) {
+        return json_equal(cur, m_expected, m_jsn);
+    }
+    return cur.length == m_expected.length &&
+           memcmp(cur.at, m_expected.at, cur.length) == 0;
+}
+
 Error
 Operation::do_store_dict()
 {
+    const bool is_replace = m_optype == Command::REPLACE ||
+                            m_optype == Command::REPLACE_IF;
     // Check that the last element is not an array first.
-    if (m_optype != Command::REPLACE &&
-            path()[path().size()-1].ptype == JSONSL_PATH_NUMERIC) {
-        return Error::PATH_EINVAL;
+    const auto& lastcomp = path().back();
+    if (!is_replace && lastcomp.ptype == JSONSL_PATH_NUMERIC) {
+        if (!lastcomp.maybe_key) {
+            return Error::PATH_EINVAL;
+        }
+        // An index which may also be a key; only the latter is stored
+        if (m_match.matchres == JSONSL_MATCH_COMPLETE
+                ? m_match.loc_key.empty()
+                : m_match.immediate_parent_found &&
+                  m_match.type != JSONSL_T_OBJECT) {
+            return Error::PATH_MISMATCH;
+        }
     }
     if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
-        if (m_optype == Command::REPLACE) {
+        if (is_replace) {
             // Nothing to replace
             return Error::PATH_ENOENT;
         }
@@ -180,6 +267,9 @@ Operation::do_store_dict()
         if (m_optype.base() == Command::DICT_ADD) {
             return Error::DOC_EEXISTS;
         }
+        if (m_optype == Command::REPLACE_IF && !replace_expected()) {
+            return Error::VALUE_MISMATCH;
+        }
     }
 
     if (m_match.matchres == JSONSL_MATCH_COMPLETE) {
@@ -194,6 +284,20 @@ Operation::do_store_dict()
         newdoc_at(2).begin_at_end(m_doc, match_loc, Loc::NO_OVERLAP);
         m_result->m_newlen = 3;
 
+    } else if (!m_match.loc_next_key.empty()) {
+        // Keys are sorted; insert directly before the following key
+        const Loc& next_loc = m_match.loc_next_key;
+        auto& comp = m_path->back();
+
+        newdoc_at(0).end_at_begin(m_doc, next_loc, Loc::NO_OVERLAP);
+        newdoc_at(1) = loc_QUOTE;
+        newdoc_at(2).assign(comp.pstr, comp.len);
+        newdoc_at(3) = loc_QUOTE_COLON;
+        newdoc_at(4) = m_userval;
+        newdoc_at(5) = loc_COMMA;
+        newdoc_at(6).begin_at_begin(m_doc, next_loc);
+        m_result->m_newlen = 7;
+
     } else if (m_match.immediate_parent_found) {
         // Deepest is parent
         const Loc& parent_loc = m_match.loc_deepest;
@@ -239,7 +343,13 @@ Operation::do_store_dict()
  */
 Error Operation::do_mkdir_p(MkdirPMode mode) {
     const Loc& parent_loc = m_match.loc_deepest;
-    newdoc_at(0).end_at_end(m_doc, parent_loc, Loc::NO_OVERLAP);
+    const Loc& next_loc = m_match.loc_next_key;
+    if (next_loc.empty()) {
+        newdoc_at(0).end_at_end(m_doc, parent_loc, Loc::NO_OVERLAP);
+    } else {
+        // Keys are sorted; insert directly before the following key
+        newdoc_at(0).end_at_begin(m_doc, next_loc, Loc::NO_OVERLAP);
+    }
 
     /* doc_new LAYOUT:
      *
@@ -252,7 +362,7 @@ Error Operation::do_mkdir_p(MkdirPMode mode) {
 
     /* figure out the components missing */
     /* THIS IS RESERVED FOR doc_new[1]! */
-    if (m_match.num_siblings) {
+    if (m_match.num_siblings && next_loc.empty()) {
         m_result->m_bkbuf += ',';
     }
 
@@ -291,6 +401,9 @@ Error Operation::do_mkdir_p(MkdirPMode mode) {
     for (auto ii = m_match.match_level + 1; ii < m_path->size(); ii++) {
         m_result->m_bkbuf += '}';
     }
+    if (!next_loc.empty()) {
+        m_result->m_bkbuf += ',';
+    }
     newdoc_at(3).length = m_result->m_bkbuf.size() - newdoc_at(1).length;
 
     /* Set the buffers */
@@ -298,7 +411,11 @@ Error Operation::do_mkdir_p(MkdirPMode mode) {
     newdoc_at(3).at = m_result->m_bkbuf.data() + newdoc_at(1).length;
     newdoc_at(2) = m_userval;
 
-    newdoc_at(4).begin_at_end(m_doc, parent_loc, Loc::OVERLAP);
+    if (next_loc.empty()) {
+        newdoc_at(4).begin_at_end(m_doc, parent_loc, Loc::OVERLAP);
+    } else {
+        newdoc_at(4).begin_at_begin(m_doc, next_loc);
+    }
     m_result->m_newlen = 5;
 
     return Error::SUCCESS;
@@ -367,7 +484,12 @@ Operation::do_list_prepend()
 Error
 Operation::do_container_size()
 {
+    // The children of a container within a contiguous document known to be
+    // valid are counted without parsing them
+    m_match.skip_container =
+            m_doc_validated && m_doc.contiguous() && !m_doc.has_more();
     Error rv = do_match_common(Match::GET_MATCH_ONLY);
+    m_match.skip_container = 0;
     if (rv != Error::SUCCESS) {
         return rv;
     }
@@ -376,7 +498,16 @@ Operation::do_container_size()
     }
 
     size_t size = m_match.num_children;
-    if (m_match.type == JSONSL_T_OBJECT) {
+    if (m_match.container_skipped) {
+        Loc& container = m_match.loc_deepest;
+        const size_t avail = m_doc.size() - m_doc.offset_of(container.at);
+        if (!ChildCounter::count(container.at, avail, size, container.length)) {
+            return Error::DOC_NOTJSON;
+        }
+        // As if it had been parsed
+        m_match.num_children =
+                m_match.type == JSONSL_T_OBJECT ? size * 2 : size;
+    } else if (m_match.type == JSONSL_T_OBJECT) {
         size /= 2;
     } else if (m_match.type != JSONSL_T_LIST) {
         return Error::PATH_MISMATCH;
@@ -390,41 +521,22 @@ Operation::do_container_size()
     return Error::SUCCESS;
 }
 
-static bool
-is_json_ws(char c) {
-    // (i.e. non-whitespace) character. RFC 7159 says:
-    // Insignificant whitespace is allowed before or after any of the six
-    // structural characters.
-    //
-    //   ws = *(
-    //           %x20 /              ; Space
-    //           %x09 /              ; Horizontal tab
-    //           %x0A /              ; Line feed or New line
-    //           %x0D )              ; Carriage return
-
-    switch (c) {
-    case 0x20:
-    case 0x09:
-    case 0x0A:
-    case 0x0D:
-        return true;
-    default:
-        return false;
-    }
-}
-
 Error
 Operation::do_empty_append()
 {
-    // Empty path. Do a custom parse/insertion
-    const char *a_end = (m_doc.at + m_doc.length) - 1;
+    // Empty path. Do a custom parse/insertion. Positions here are offsets
+    // within the document
+    if (m_doc.size() == 0) {
+        return Error::DOC_NOTJSON;
+    }
+    size_t a_end = m_doc.size() - 1;
 
     // Find terminating bracket
-    for (; a_end != m_doc.at && isspace(*a_end); --a_end) {
+    for (; a_end != 0 && isspace(m_doc.at(a_end)); --a_end) {
     }
 
-    if (a_end == m_doc.at || *a_end != ']') {
-        switch (*a_end) {
+    if (a_end == 0 || m_doc.at(a_end) != ']') {
+        switch (m_doc.at(a_end)) {
         case ']':
         case '}':
             return Error::PATH_MISMATCH;
@@ -436,20 +548,20 @@ Operation::do_empty_append()
     // Find last comma, element, or beginning of the array.
     // Rather than fully parse json, simply seek to the last significant
     // JSON character
-    const char *e_comma = a_end - 1;
-    for (; e_comma != m_doc.at && is_json_ws(*e_comma); --e_comma) {
+    size_t e_comma = a_end - 1;
+    for (; e_comma != 0 && Util::is_json_ws(m_doc.at(e_comma)); --e_comma) {
     }
 
-    newdoc_at(0).assign(m_doc.at, (e_comma - m_doc.at) + 1);
+    newdoc_at(0).assign(m_doc.begin(), e_comma + 1);
 
-    if (*e_comma == '[' || *e_comma == ',') {
+    if (m_doc.at(e_comma) == '[' || m_doc.at(e_comma) == ',') {
         newdoc_at(1) = m_userval;
-        newdoc_at(2).assign(a_end, 1);
+        newdoc_at(2).assign(m_doc.pointer_at(a_end), 1);
         m_result->m_newlen = 3;
-    } else if (!isspace(*e_comma)) {
+    } else if (!isspace(m_doc.at(e_comma))) {
         newdoc_at(1) = loc_COMMA;
         newdoc_at(2) = m_userval;
-        newdoc_at(3).assign(a_end, 1);
+        newdoc_at(3).assign(m_doc.pointer_at(a_end), 1);
         m_result->m_newlen = 4;
     } else {
         // Couldn't find a non-space, ',' or '[' character
@@ -458,6 +570,44 @@ Operation::do_empty_append()
     return Error::SUCCESS;
 }
 
+/* Split a series of primitives at the commas between them */
+static void
+split_primitives(const Loc& series, std::vector<Loc>& out)
+{
+    bool in_string = false;
+    bool escaped = false;
+    size_t begin = 0;
+    for (size_t ii = 0; ii <= series.length; ii++) {
+        if (ii < series.length) {
+            const char c = series.at[ii];
+            if (in_string) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    in_string = false;
+                }
+                continue;
+            } else if (c == '"') {
+                in_string = true;
+                continue;
+            } else if (c != ',') {
+                continue;
+            }
+        }
+        size_t end = ii;
+        while (begin < end && Util::is_json_ws(series.at[begin])) {
+            begin++;
+        }
+        while (end > begin && Util::is_json_ws(series.at[end - 1])) {
+            end--;
+        }
+        out.emplace_back(series.at + begin, end - begin);
+        begin = ii + 1;
+    }
+}
+
 Error
 Operation::do_list_append()
 {
@@ -471,8 +621,28 @@ Operation::do_list_append()
 
     // Find the match itself, no magic needed!
     bool is_unique = m_optype.base() == Command::ARRAY_ADD_UNIQUE;
+    std::vector<Loc> values;
+    std::unordered_set<std::string_view> candidates;
     if (is_unique) {
         m_match.ensure_unique = m_userval;
+        if (std::memchr(m_userval.at, ',', m_userval.length) != nullptr) {
+            split_primitives(m_userval, values);
+        }
+        if (values.size() > 1) {
+            // Look up the elements among all of the values
+            for (const auto& value : values) {
+                if (!candidates.emplace(value.at, value.length).second) {
+                    return Error::VALUE_CANTINSERT;
+                }
+            }
+            m_match.unique_set = &candidates;
+        } else if (m_index == nullptr && m_doc.contiguous()) {
+            // If the value's bytes do not occur anywhere, no element can be
+            // equal to it. The search is much cheaper than the comparisons
+            std::string_view doc(m_doc.begin(), m_doc.size());
+            m_match.unique_absent = doc.find(std::string_view(
+                    m_userval.at, m_userval.length)) == std::string_view::npos;
+        }
     }
 
     rv = do_match_common(Match::GET_MATCH_ONLY);
@@ -484,7 +654,20 @@ Operation::do_list_append()
     if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
         // Not complete. Determine if mkdir_p should be used
         if (m_optype.is_mkdir_p()) {
-            return do_mkdir_p(MKDIR_P_ARRAY);
+            rv = do_mkdir_p(MKDIR_P_ARRAY);
+            if (rv.success() && m_match.unique_set != nullptr) {
+                // The new array consists of all the values
+                m_match.unique_items.clear();
+                m_match.unique_set = nullptr;
+                m_result->m_numbuf = "[";
+                for (size_t ii = 0; ii < values.size(); ii++) {
+                    m_result->m_numbuf += ii ? ",true" : "true";
+                }
+                m_result->m_numbuf += ']';
+                m_result->m_match.assign(m_result->m_numbuf.c_str(),
+                                         m_result->m_numbuf.size());
+            }
+            return rv;
         }
         return Error::PATH_ENOENT;
     }
@@ -497,6 +680,11 @@ Operation::do_list_append()
         return Error::PATH_MISMATCH;
     }
 
+    if (m_match.unique_set != nullptr) {
+        m_match.unique_set = nullptr;
+        return do_unique_append(values);
+    }
+
     if (is_unique && m_match.unique_item_found) {
         // Unique item already exists
         return Error::DOC_EEXISTS;
@@ -521,6 +709,167 @@ Operation::do_list_append()
     return Error::SUCCESS;
 }
 
+/* Append the values (of ARRAY_ADD_UNIQUE) which were not found in the
+ * array */
+Error
+Operation::do_unique_append(const std::vector<Loc>& values)
+{
+    std::unordered_set<std::string_view> present;
+    for (const auto& item : m_match.unique_items) {
+        present.emplace(item.at, item.length);
+    }
+
+    const Loc& array_loc = m_match.loc_deepest;
+    auto& segs = m_result->m_newsegs;
+    auto& report = m_result->m_numbuf;
+    bool empty = m_match.num_children == 0;
+    Loc loc;
+    if (empty) {
+        /* ... [ */
+        loc.end_at_begin(m_doc, array_loc, Loc::OVERLAP);
+    } else {
+        /* Last element */
+        loc.end_at_end(m_doc, array_loc, Loc::NO_OVERLAP);
+    }
+    m_doc.slice(loc, segs);
+
+    report = "[";
+    bool added_any = false;
+    for (const auto& value : values) {
+        const bool added =
+                present.count(std::string_view(value.at, value.length)) == 0;
+        if (report.size() > 1) {
+            report += ',';
+        }
+        report += added ? "true" : "false";
+        if (!added) {
+            continue;
+        }
+        if (!empty) {
+            segs.push_back(loc_COMMA);
+        }
+        segs.push_back(value);
+        empty = false;
+        added_any = true;
+    }
+    report += ']';
+    if (!added_any) {
+        segs.clear();
+        return Error::DOC_EEXISTS;
+    }
+
+    /* Parent end */
+    loc.begin_at_end(m_doc, array_loc, Loc::OVERLAP);
+    m_doc.slice(loc, segs);
+    m_result->m_newlen = 0;
+    m_result->m_match.assign(report.c_str(), report.size());
+    return Error::SUCCESS;
+}
+
+static Loc loc_LBRACKET("[", 1);
+static Loc loc_RBRACKET("]", 1);
+
+/* Collect the locations of the children of the container the cursor was
+ * opened on */
+static int
+collect_children(ContainerCursor& cur, std::vector<Loc>& out)
+{
+    while (cur.next()) {
+        out.push_back(cur.child().loc);
+    }
+    int rv = cur.status();
+    cur.close();
+    return rv;
+}
+
+Error
+Operation::do_capped_append()
+{
+    if (m_limit == 0) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    // Locate the values within the user's value, which may be a series
+    std::unique_ptr<Path> root(new Path());
+    root->parse("", 0);
+    const Loc wrapped[] = {loc_LBRACKET, m_userval, loc_RBRACKET};
+    Segments valsegs;
+    valsegs.assign(Buffer<Loc>(wrapped, 3));
+    std::vector<Loc> values;
+    ContainerCursor cur;
+    cur.open(valsegs, root.get(), m_jsn);
+    if (collect_children(cur, values) != JSONSL_ERROR_SUCCESS) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    // Locate the array, and its children in the same pass. The cursor does
+    // not handle negative indexes, which are resolved by a match first
+    std::vector<Loc> children;
+    int rv;
+    if (!m_path->has_negix) {
+        cur.open(m_doc, m_path, m_jsn);
+        rv = collect_children(cur, children);
+    } else {
+        Error status = do_match_common(Match::GET_MATCH_ONLY);
+        if (!status.success()) {
+            return status;
+        }
+        if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
+            return Error::PATH_ENOENT;
+        }
+        const Loc& found = m_match.loc_deepest;
+        Segments sub;
+        sub.assign(m_doc, m_doc.offset_of(found.at), found.length);
+        cur.open(sub, root.get(), m_jsn);
+        rv = collect_children(cur, children);
+        cur.loc = found;
+    }
+    if (rv != JSONSL_ERROR_SUCCESS) {
+        return Util::doc_status(rv);
+    }
+    if (!cur.found) {
+        // A match tells whether the path is missing or mismatched
+        Error status = do_match_common(Match::GET_MATCH_ONLY);
+        return status.success() ? Error::PATH_ENOENT : status;
+    }
+    if (cur.type != JSONSL_T_LIST) {
+        return Error::PATH_MISMATCH;
+    }
+
+    const size_t total = children.size() + values.size();
+    const size_t ndrop = total > m_limit ? total - m_limit : 0;
+    const Loc& array_loc = cur.loc;
+    auto& segs = m_result->m_newsegs;
+
+    /*
+     * NEWDOC = ... [ (---> DROPPED, <---) KEPT , VALUES ] ...
+     */
+    Loc loc;
+    loc.end_at_begin(m_doc, array_loc, Loc::OVERLAP);
+    m_doc.slice(loc, segs);
+    if (ndrop < children.size()) {
+        const Loc& first = children[ndrop];
+        const Loc& last = children.back();
+        const size_t begin = m_doc.offset_of(first.at);
+        loc.assign(first.at,
+                   m_doc.offset_of(last.at) + last.length - begin);
+        m_doc.slice(loc, segs);
+        if (!values.empty()) {
+            segs.push_back(loc_COMMA);
+            segs.push_back(m_userval);
+        }
+    } else {
+        // Only (the newest of) the values remain
+        const Loc& first = values[ndrop - children.size()];
+        segs.emplace_back(first.at, m_userval.length -
+                                    (first.at - m_userval.at));
+    }
+    loc.begin_at_end(m_doc, array_loc, Loc::OVERLAP);
+    m_doc.slice(loc, segs);
+    m_result->m_newlen = 0;
+    return Error::SUCCESS;
+}
+
 Error
 Operation::do_insert()
 {
@@ -528,16 +877,21 @@ Operation::do_insert()
     if (lastcomp.ptype != JSONSL_PATH_NUMERIC) {
         return Error::PATH_EINVAL;
     }
-    if (lastcomp.is_neg) {
-        // Negative paths are invalid for insert operations
-        return Error::PATH_EINVAL;
-    }
 
     Error status = do_match_common(Match::GET_MATCH_ONLY);
     if (!status.success()) {
         return status;
     }
 
+    if (lastcomp.maybe_key &&
+            (m_match.matchres == JSONSL_MATCH_COMPLETE
+                ? !m_match.loc_key.empty()
+                : m_match.immediate_parent_found &&
+                  m_match.type != JSONSL_T_LIST)) {
+        // A key within an object, rather than an index
+        return Error::PATH_MISMATCH;
+    }
+
     if (m_match.matchres == JSONSL_MATCH_COMPLETE) {
         const Loc& match_loc = m_match.loc_deepest;
 
@@ -554,7 +908,9 @@ Operation::do_insert()
         newdoc_at(3).begin_at_begin(m_doc, match_loc);
         return Error::SUCCESS;
     }
-    if (m_match.immediate_parent_found) {
+    // A negative index always refers to an existing element, before which
+    // the value is inserted
+    if (m_match.immediate_parent_found && !lastcomp.is_neg) {
         const Loc& array_loc = m_match.loc_deepest;
         if (m_match.num_siblings == 0 && lastcomp.idx == 0) {
             // Equivalent to prepend/push_first
@@ -590,8 +946,8 @@ Operation::do_insert()
     return Error::PATH_ENOENT;
 }
 
-static Error
-parse_int64(const Loc& orig, int64_t& outval)
+Error
+Operation::parse_delta(const Loc& orig, int64_t& outval)
 {
     if (!orig.length) {
         // Empty value isn't allowed
@@ -617,6 +973,21 @@ parse_int64(const Loc& orig, int64_t& outval)
     return Error::DELTA_EINVAL;
 }
 
+/* Clamp a new counter value to the bounds (if any), noting whether it was */
+int64_t
+Operation::clamp_counter(int64_t value)
+{
+    if (!m_counter_bounds) {
+        return value;
+    }
+    const auto [min, max] = *m_counter_bounds;
+    if (value < min || value > max) {
+        m_result->m_clamped = true;
+        return value < min ? min : max;
+    }
+    return value;
+}
+
 Error
 Operation::do_arith_op()
 {
@@ -625,10 +996,14 @@ Operation::do_arith_op()
     int64_t numres = 0;
     // Verify the digit first
 
-    status = parse_int64(m_userval, delta);
+    status = parse_delta(m_userval, delta);
     if (!status.success()) {
         return status;
     }
+    if (m_counter_bounds &&
+            m_counter_bounds->first > m_counter_bounds->second) {
+        return Error::DELTA_EINVAL;
+    }
 
     /* Find the number first */
     status = do_match_common(m_optype.is_mkdir_p() ?
@@ -646,8 +1021,11 @@ Operation::do_arith_op()
         if (m_match.sflags & ~(JSONSL_SPECIALf_NUMERIC)) {
             return Error::PATH_MISMATCH;
         }
+        std::string numcopy;
+        const char *numstr = m_doc.flatten(num_loc, numcopy).at;
+
         errno = 0;
-        numres = strtoll(num_loc.at, nullptr, 10);
+        numres = strtoll(numstr, nullptr, 10);
 
         if (errno == ERANGE) {
             return Error::NUM_E2BIG;
@@ -657,18 +1035,24 @@ Operation::do_arith_op()
          * here and not force 64 bit C arithmetic to confuse users, so use
          * proper integer overflow/underflow with a 64 (or rather, 63) bit
          * limit. */
+        bool overflow = false;
         if (delta >= 0 && numres >= 0) {
-            if (std::numeric_limits<int64_t>::max() - delta < numres) {
-                return Error::DELTA_OVERFLOW;
-            }
+            overflow = std::numeric_limits<int64_t>::max() - delta < numres;
         } else if (delta < 0 && numres < 0) {
-            if (delta < std::numeric_limits<int64_t>::min() - numres) {
-                return Error::DELTA_OVERFLOW;
-            }
+            overflow = delta < std::numeric_limits<int64_t>::min() - numres;
         }
 
-        numres += delta;
-        m_result->m_numbuf = std::to_string(numres);
+        if (!overflow) {
+            numres += delta;
+        } else if (m_counter_bounds) {
+            // Saturate; the result is clamped to the bounds below
+            numres = delta > 0 ? std::numeric_limits<int64_t>::max()
+                               : std::numeric_limits<int64_t>::min();
+            m_result->m_clamped = true;
+        } else {
+            return Error::DELTA_OVERFLOW;
+        }
+        m_result->m_numbuf = std::to_string(clamp_counter(numres));
     } else {
         if (!m_optype.is_mkdir_p() && !m_match.immediate_parent_found) {
             return Error::PATH_ENOENT;
@@ -678,7 +1062,8 @@ Operation::do_arith_op()
             return Error::PATH_ENOENT;
         }
 
-        m_result->m_numbuf = std::to_string(delta);
+        m_result->m_numbuf = std::to_string(
+                clamp_counter(m_counter_initial.value_or(delta)));
         m_userval.at = m_result->m_numbuf.data();
         m_userval.length = m_result->m_numbuf.size();
         m_optype = Command::DICT_ADD_P;
@@ -709,6 +1094,360 @@ Operation::do_arith_op()
     return Error::SUCCESS;
 }
 
+static Error
+parse_double(const Loc& orig, double& outval)
+{
+    if (!orig.length) {
+        // Empty value isn't allowed
+        return Error::VALUE_EMPTY;
+    }
+
+    // The same grammar as numbers within documents
+    if (!Subdoc::Scalar::is_number(orig.at, orig.length)) {
+        return Error::DELTA_EINVAL;
+    }
+    // Unlike strtod(), this does not depend on the locale
+    auto [ptr, ec] = std::from_chars(orig.at, orig.at + orig.length, outval);
+    if (ec == std::errc() && ptr == (orig.at + orig.length) &&
+            std::isfinite(outval) && outval != 0) {
+        return Error::SUCCESS;
+    }
+    return Error::DELTA_EINVAL;
+}
+
+Error
+Operation::do_float_arith_op()
+{
+    double delta;
+    Error status = parse_double(m_userval, delta);
+    if (!status.success()) {
+        return status;
+    }
+
+    status = do_match_common(m_optype.is_mkdir_p() ?
+            Match::GET_FOLLOWING_SIBLINGS : Match::GET_MATCH_ONLY);
+    if (status != Error::SUCCESS) {
+        return status;
+    }
+
+    double numres = delta;
+    if (m_match.matchres == JSONSL_MATCH_COMPLETE) {
+        const Loc& num_loc = m_match.loc_deepest;
+        if (m_match.type != JSONSL_T_SPECIAL ||
+                !(m_match.sflags & JSONSL_SPECIALf_NUMERIC)) {
+            return Error::PATH_MISMATCH;
+        }
+        std::string numcopy;
+        const char *numstr = m_doc.flatten(num_loc, numcopy).at;
+        double current;
+        auto [ptr, ec] =
+                std::from_chars(numstr, numstr + num_loc.length, current);
+        if (ec != std::errc() || ptr != numstr + num_loc.length) {
+            return Error::NUM_E2BIG;
+        }
+        numres += current;
+        if (!std::isfinite(numres)) {
+            return Error::DELTA_OVERFLOW;
+        }
+    } else if ((!m_optype.is_mkdir_p() && !m_match.immediate_parent_found) ||
+            m_match.type != JSONSL_T_OBJECT) {
+        return Error::PATH_ENOENT;
+    }
+
+    // The shortest representation which reads back as the same value
+    char buf[32];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof buf, numres);
+    Expects(ec == std::errc());
+    m_result->m_numbuf.assign(buf, end);
+
+    if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
+        m_userval.assign(m_result->m_numbuf.data(), m_result->m_numbuf.size());
+        m_optype = Command::DICT_ADD_P;
+        if ((status = do_store_dict()) != Error::SUCCESS) {
+            return status;
+        }
+        m_result->m_match = m_match.loc_deepest = m_userval;
+        return Error::SUCCESS;
+    }
+
+    newdoc_at(0).end_at_begin(m_doc, m_match.loc_deepest, Loc::NO_OVERLAP);
+    newdoc_at(1).assign(m_result->m_numbuf.data(), m_result->m_numbuf.size());
+    newdoc_at(2).begin_at_end(m_doc, m_match.loc_deepest, Loc::NO_OVERLAP);
+    m_result->m_newlen = 3;
+    m_result->m_match = newdoc_at(1);
+    return Error::SUCCESS;
+}
+
+namespace {
+/// A member of an object
+struct Member {
+    Loc key; // Including the quotes
+    Loc value;
+    uint32_t type = 0;
+};
+using Members = std::vector<Member>;
+
+/**
+ * Builds the result of a merge patch (Command::DICT_MERGE) as a list of
+ * segments. Members which are kept, and the key of each replaced one, refer
+ * to the original document; values and new members refer to the patch.
+ */
+class Merger {
+public:
+    Merger(const Segments& doc, jsonsl_t jsn, std::vector<Loc>& out)
+        : m_doc(doc), m_jsn(jsn), m_out(out), m_root(new Path()) {
+        m_root->parse("", 0);
+    }
+
+    /// Collect the children of the container the cursor was opened on
+    static int collect(ContainerCursor& cur, Members& out) {
+        while (cur.next()) {
+            const auto& child = cur.child();
+            out.push_back({child.loc_key, child.loc, child.type});
+        }
+        return cur.status();
+    }
+
+    /// Collect the members of an object within the document (if `in_doc`)
+    /// or the patch. The type of the value is stored in `type`, if given
+    int members_of(const Loc& obj, bool in_doc, Members& out,
+                   uint32_t *type = nullptr);
+
+    /// Append the result of merging `patch` into a target, whose members
+    /// are `target` (or null if it is missing or not an object)
+    int merge(const Member& patch, const Members& pmembers,
+              const Members* target);
+
+    void emit(const Loc& loc) { m_doc.slice(loc, m_out); }
+
+private:
+    void emit_member(const Member& m);
+    /// Store the unescaped key of a member of the document (if `in_doc`)
+    /// or the patch in `out`, so that keys are compared as JSON strings
+    void key_name(const Loc& key, bool in_doc, std::string& out);
+    bool is_null(const Member& m) const {
+        return m.type == JSONSL_T_SPECIAL && m.value.length == 4 &&
+               std::memcmp(m.value.at, "null", 4) == 0;
+    }
+
+    const Segments& m_doc;
+    jsonsl_t m_jsn;
+    std::vector<Loc>& m_out;
+    std::unique_ptr<Path> m_root;
+    std::string m_keybuf;
+};
+} // namespace
+
+static Loc loc_COLON(":", 1);
+static Loc loc_LBRACE("{", 1);
+static Loc loc_RBRACE("}", 1);
+
+int
+Merger::members_of(const Loc& obj, bool in_doc, Members& out, uint32_t *type)
+{
+    ContainerCursor cur;
+    Segments sub;
+    if (in_doc) {
+        sub.assign(m_doc, m_doc.offset_of(obj.at), obj.length);
+        cur.open(sub, m_root.get(), m_jsn);
+    } else {
+        cur.open(obj.at, obj.length, m_root.get(), m_jsn);
+    }
+    int rv = collect(cur, out);
+    cur.close();
+    if (type != nullptr) {
+        *type = cur.type;
+    }
+    return rv;
+}
+
+/* Append a member of the document: its key, value, and what separates them */
+void
+Merger::emit_member(const Member& m)
+{
+    const size_t begin = m_doc.offset_of(m.key.at);
+    const size_t end = m_doc.offset_of(m.value.at) + m.value.length;
+    emit(Loc(m.key.at, end - begin));
+}
+
+void
+Merger::key_name(const Loc& key, bool in_doc, std::string& out)
+{
+    const Loc flat = in_doc ? m_doc.flatten(key, m_keybuf) : key;
+    Scalar name;
+    if (name.assign(flat.at, flat.length) && name.kind() == Scalar::STRING) {
+        out.assign(name.str());
+    } else {
+        out.assign(flat.at, flat.length);
+    }
+}
+
+int
+Merger::merge(const Member& patch, const Members& pmembers,
+              const Members* target)
+{
+    if (patch.type != JSONSL_T_OBJECT) {
+        emit(patch.value);
+        return JSONSL_ERROR_SUCCESS;
+    }
+
+    // Later occurrences of a key in the patch take precedence
+    std::vector<std::string> pkeys(pmembers.size());
+    std::unordered_map<std::string_view, size_t> bykey;
+    for (size_t ii = 0; ii < pmembers.size(); ii++) {
+        key_name(pmembers[ii].key, false, pkeys[ii]);
+        bykey[pkeys[ii]] = ii;
+    }
+    std::vector<bool> used(pmembers.size());
+    bool first = true;
+    auto separate = [&]() {
+        if (!first) {
+            emit(loc_COMMA);
+        }
+        first = false;
+    };
+
+    emit(loc_LBRACE);
+    if (target != nullptr) {
+        std::string key;
+        for (const auto& member : *target) {
+            key_name(member.key, true, key);
+            auto found = bykey.find(key);
+            if (found == bykey.end()) {
+                separate();
+                emit_member(member);
+                continue;
+            }
+
+            const Member& pm = pmembers[found->second];
+            used[found->second] = true;
+            if (is_null(pm)) {
+                continue;
+            }
+            // Keep the key (and colon) of the original member
+            separate();
+            const size_t begin = m_doc.offset_of(member.key.at);
+            emit(Loc(member.key.at, m_doc.offset_of(member.value.at) - begin));
+
+            // An object present in both is merged recursively; each of the
+            // two is scanned again for its members
+            Members pchildren, tchildren;
+            if (pm.type == JSONSL_T_OBJECT) {
+                int rv = members_of(pm.value, false, pchildren);
+                if (rv == JSONSL_ERROR_SUCCESS &&
+                        member.type == JSONSL_T_OBJECT) {
+                    rv = members_of(member.value, true, tchildren);
+                }
+                if (rv != JSONSL_ERROR_SUCCESS) {
+                    return rv;
+                }
+            }
+            int rv = merge(pm, pchildren,
+                    member.type == JSONSL_T_OBJECT ? &tchildren : nullptr);
+            if (rv != JSONSL_ERROR_SUCCESS) {
+                return rv;
+            }
+        }
+    }
+
+    // Members of the patch which were not in the target are appended
+    for (size_t ii = 0; ii < pmembers.size(); ii++) {
+        const Member& pm = pmembers[ii];
+        if (used[ii] || is_null(pm) || bykey[pkeys[ii]] != ii) {
+            continue;
+        }
+        separate();
+        emit(pm.key);
+        emit(loc_COLON);
+
+        Members pchildren;
+        if (pm.type == JSONSL_T_OBJECT) {
+            int rv = members_of(pm.value, false, pchildren);
+            if (rv != JSONSL_ERROR_SUCCESS) {
+                return rv;
+            }
+        }
+        int rv = merge(pm, pchildren, nullptr);
+        if (rv != JSONSL_ERROR_SUCCESS) {
+            return rv;
+        }
+    }
+    emit(loc_RBRACE);
+    return JSONSL_ERROR_SUCCESS;
+}
+
+Error
+Operation::do_merge_patch()
+{
+    Error status = validate(Validator::PARENT_ARRAY | Validator::VALUE_SINGLE,
+                            get_maxdepth(PATH_HAS_NEWKEY));
+    if (!status.success()) {
+        return status;
+    }
+
+    auto& segs = m_result->m_newsegs;
+    segs.clear();
+    Merger merger(m_doc, m_jsn, segs);
+
+    Member patch;
+    Members pmembers;
+    patch.value = m_userval;
+    if (merger.members_of(m_userval, false, pmembers, &patch.type) !=
+            JSONSL_ERROR_SUCCESS) {
+        return Error::VALUE_CANTINSERT;
+    }
+
+    // Locate the target, and collect its members in the same pass
+    Member target;
+    Members tmembers;
+    bool collected = false;
+    if (!m_path->has_negix) {
+        ContainerCursor cur;
+        cur.open(m_doc, m_path, m_jsn);
+        int rv = Merger::collect(cur, tmembers);
+        cur.close();
+        if (rv != JSONSL_ERROR_SUCCESS) {
+            return Util::doc_status(rv);
+        }
+        if (cur.found && cur.type == JSONSL_T_OBJECT) {
+            target.value = cur.loc;
+            target.type = cur.type;
+            collected = true;
+        }
+    }
+    if (!collected) {
+        // Not an object (or the path was not found); the match tells which
+        status = do_match_common(Match::GET_MATCH_ONLY);
+        if (!status.success()) {
+            return status;
+        }
+        if (m_match.matchres != JSONSL_MATCH_COMPLETE) {
+            return Error::PATH_ENOENT;
+        }
+        target.value = m_match.loc_deepest;
+        target.type = m_match.type;
+        tmembers.clear();
+        if (target.type == JSONSL_T_OBJECT &&
+                merger.members_of(target.value, true, tmembers) !=
+                        JSONSL_ERROR_SUCCESS) {
+            return Error::DOC_NOTJSON;
+        }
+    }
+
+    Loc prefix, suffix;
+    prefix.end_at_begin(m_doc, target.value, Loc::NO_OVERLAP);
+    suffix.begin_at_end(m_doc, target.value, Loc::NO_OVERLAP);
+    merger.emit(prefix);
+    if (merger.merge(patch, pmembers,
+            target.type == JSONSL_T_OBJECT ? &tmembers : nullptr) !=
+                    JSONSL_ERROR_SUCCESS) {
+        return Error::DOC_NOTJSON;
+    }
+    merger.emit(suffix);
+    m_result->m_newlen = 0;
+    return Error::SUCCESS;
+}
+
 Error Operation::validate(int mode, size_t depth) const {
     if (!m_userval.empty()) {
         int rv = Validator::validate(m_userval, m_jsn, depth, mode);
@@ -733,18 +1472,130 @@ size_t Operation::get_maxdepth(DepthMode mode) const {
     return Limits::MAX_COMPONENTS - m_path->size();
 }
 
+Error
+Operation::parse_path(const char *pth, size_t npth)
+{
+    return Util::path_status(m_path->parse(pth, npth));
+}
+
 Error
 Operation::op_exec(const char *pth, size_t npth)
 {
-    int rv = m_path->parse(pth, npth);
-    Error status;
+    Error status = parse_path(pth, npth);
+    if (!status.success()) {
+        return status;
+    }
+
+    if (!m_optype.is_lookup()) {
+        // Mutations need the remainder of the document for the new one
+        m_doc.pull_all();
+    }
+    return execute();
+}
+
+Error
+Operation::op_exec(const Path& path)
+{
+    m_path->assign(path);
+    if (m_path->has_wildcard) {
+        return Error::GLOBAL_ENOSUPPORT;
+    }
+    if (!m_optype.is_lookup()) {
+        m_doc.pull_all();
+    }
+    return execute();
+}
 
-    if (rv != 0) {
-        if (rv == JSONSL_ERROR_LEVELS_EXCEEDED) {
-            return Error::PATH_E2BIG;
+Error
+Operation::op_begin(const char *pth, size_t npth)
+{
+    if (m_match.suspended()) {
+        m_match.exec_match_abort(m_jsn);
+    }
+    m_match.clear();
+    m_doc.assign_partial();
+
+    m_feed_status = parse_path(pth, npth);
+    if (!m_feed_status.success()) {
+        return m_feed_status;
+    }
+    m_feed_status = Error::NEED_MORE;
+
+    if (m_optype.is_lookup() && !m_path->has_negix) {
+        // An index never covers a partial document
+        m_match.extra_options = Match::GET_MATCH_ONLY;
+        m_match.keys_sorted = m_keys_sorted;
+        m_match.exec_match_begin(m_doc, m_path, m_jsn);
+        m_prematched = true;
+    }
+    return m_feed_status;
+}
+
+Error
+Operation::op_feed(const char *s, size_t n)
+{
+    if (m_feed_status != Error::NEED_MORE) {
+        return m_feed_status;
+    }
+    m_doc.append(s, n);
+    if (m_match.suspended()) {
+        m_match.exec_match_resume(m_jsn);
+        if (!m_match.suspended()) {
+            m_feed_status = execute();
         }
-        return Error::PATH_EINVAL;
     }
+    return m_feed_status;
+}
+
+Error
+Operation::op_end()
+{
+    if (m_feed_status != Error::NEED_MORE) {
+        return m_feed_status;
+    }
+    m_doc.finish();
+    if (m_match.suspended()) {
+        m_match.exec_match_resume(m_jsn);
+    }
+    m_feed_status = execute();
+    return m_feed_status;
+}
+
+Error
+Operation::execute()
+{
+    m_result->m_newsegs.clear();
+    Error status = dispatch();
+    m_prematched = false;
+    if (status.success() && !m_doc.contiguous()) {
+        split_result();
+    }
+    return status;
+}
+
+/**
+ * Convert the result of an operation on a segmented document, so that it
+ * only contains locations which may be dereferenced directly.
+ */
+void
+Operation::split_result()
+{
+    // Unless it was already built from the segments of the document
+    auto& segs = m_result->m_newsegs;
+    if (segs.empty()) {
+        for (size_t ii = 0; ii < m_result->m_newlen; ii++) {
+            m_doc.slice(newdoc_at(ii), segs);
+        }
+    }
+
+    m_result->m_match =
+            m_doc.flatten(m_result->m_match, m_result->m_matchbuf);
+}
+
+Error
+Operation::dispatch()
+{
+    Error status;
 
     switch (m_optype) {
     case Command::GET:
@@ -760,6 +1611,7 @@ Operation::op_exec(const char *pth, size_t npth)
     case Command::DICT_UPSERT:
     case Command::DICT_UPSERT_P:
     case Command::REPLACE:
+    case Command::REPLACE_IF:
         if (m_path->size() == 1) {
             /* Can't perform these operations on the root element since they
              * will invalidate the JSON or are otherwise meaningless. */
@@ -783,6 +1635,10 @@ Operation::op_exec(const char *pth, size_t npth)
         }
         return do_remove();
 
+    case Command::ARRAY_POP_FIRST:
+    case Command::ARRAY_POP_LAST:
+        return do_pop();
+
     case Command::ARRAY_PREPEND:
     case Command::ARRAY_PREPEND_P:
         status = validate(Validator::PARENT_ARRAY, get_maxdepth(PATH_IS_PARENT));
@@ -797,8 +1653,8 @@ Operation::op_exec(const char *pth, size_t npth)
     case Command::ARRAY_ADD_UNIQUE_P: {
         int validmode = Validator::PARENT_ARRAY;
         if (m_optype.base() == Command::ARRAY_ADD_UNIQUE) {
-            // Uniqueness must contain a single, primitive value.
-            validmode |= Validator::VALUE_PRIMITIVE | Validator::VALUE_SINGLE;
+            // Uniqueness must contain primitive values.
+            validmode |= Validator::VALUE_PRIMITIVE;
         }
 
         status = validate(validmode, get_maxdepth(PATH_IS_PARENT));
@@ -808,6 +1664,23 @@ Operation::op_exec(const char *pth, size_t npth)
         return do_list_append();
     }
 
+    case Command::ARRAY_REMOVE_VALUE:
+        status = validate(
+                Validator::PARENT_ARRAY | Validator::VALUE_PRIMITIVE |
+                        Validator::VALUE_SINGLE,
+                get_maxdepth(PATH_IS_PARENT));
+        if (!status.success()) {
+            return status;
+        }
+        return do_remove_value();
+
+    case Command::ARRAY_APPEND_CAPPED:
+        status = validate(Validator::PARENT_ARRAY, get_maxdepth(PATH_IS_PARENT));
+        if (!status.success()) {
+            return status;
+        }
+        return do_capped_append();
+
     case Command::ARRAY_INSERT:
         status = validate(Validator::PARENT_ARRAY, get_maxdepth(PATH_HAS_NEWKEY));
         if (!status.success()) {
@@ -821,9 +1694,16 @@ Operation::op_exec(const char *pth, size_t npth)
         // big, it will fail during path parse-time
         return do_arith_op();
 
+    case Command::COUNTER_FLOAT:
+    case Command::COUNTER_FLOAT_P:
+        return do_float_arith_op();
+
     case Command::GET_COUNT:
         return do_container_size();
 
+    case Command::DICT_MERGE:
+        return do_merge_patch();
+
     default:
         return Error::GLOBAL_ENOSUPPORT;
 
@@ -834,6 +1714,12 @@ Operation::Operation()
     : m_path(new Path()),
       m_jsn(Match::jsn_alloc()),
       m_optype(Command::GET),
+      m_limit(0),
+      m_expected_canonical(false),
+      m_index(nullptr),
+      m_keys_sorted(false),
+      m_doc_validated(false),
+      m_prematched(false),
       m_result(nullptr) {
 }
 
@@ -848,11 +1734,21 @@ void
 Operation::clear()
 {
     m_path->clear();
+    if (m_match.suspended()) {
+        m_match.exec_match_abort(m_jsn);
+    }
     m_match.clear();
+    m_prematched = false;
+    m_feed_status = Error::SUCCESS;
     m_userval.length = 0;
     m_userval.at = nullptr;
     m_result = nullptr;
     m_optype = Command::GET;
+    m_limit = 0;
+    m_counter_bounds.reset();
+    m_counter_initial.reset();
+    m_expected = Loc();
+    m_expected_canonical = false;
 }
 
 /* Misc */
@@ -890,6 +1786,10 @@ Error::description() const
         return "Operation not implemented";
     case Error::DOC_ETOODEEP:
         return "Document is too deep to parse";
+    case Error::NEED_MORE:
+        return "More of the document is needed to complete the operation";
+    case Error::VALUE_MISMATCH:
+        return "The value at the path is not equal to the expected value";
     }
 
     return "Unknown error code";
@@ -14,8 +14,13 @@
 #include "loc.h"
 #include "path.h"
 #include "match.h"
+#include "segments.h"
 
 #include <array>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace Subdoc {
 
@@ -39,6 +44,9 @@ public:
      * @return a Buffer object representing the layout of the new document.
      */
     const Buffer<Loc> newdoc() const {
+        if (!m_newsegs.empty()) {
+            return Buffer<Loc>(m_newsegs.data(), m_newsegs.size());
+        }
         return Buffer<Loc>(m_newdoc.data(), m_newlen);
     }
 
@@ -50,10 +58,19 @@ public:
      * (Operation::set_doc()), and thus should be considered invalid when the
      * buffer passed to Operation::set_doc() has been modified.
      *
+     * If the input document is segmented and the match spans more than one
+     * segment, the match is copied into this object.
+     *
      * @return The location of the match.
      */
     const Loc& matchloc() const { return m_match; }
 
+    /**
+     * For Command::COUNTER with bounds (Operation::set_counter_bounds()),
+     * whether the new value was clamped to one of them.
+     */
+    bool clamped() const { return m_clamped; }
+
     /**
      * For operations that are non-subjson, this method provides a way to
      * pass around results within the existing infrastructure.
@@ -77,16 +94,27 @@ public:
     void clear() {
         m_bkbuf.clear();
         m_numbuf.clear();
+        m_matchbuf.clear();
         m_match.length = 0;
         m_newlen = 0;
+        m_newsegs.clear();
+        m_clamped = false;
     }
 private:
     friend class Operation;
+    friend class Projection;
+    friend class JsonPatch;
+    friend class MultiRemove;
+    friend class MultiCounter;
     std::string m_bkbuf;
     std::string m_numbuf;
+    std::string m_matchbuf;
     std::array<Loc, 8> m_newdoc;
     size_t m_newlen = 0; // The number of Locs used in m_newdoc
+    // For segmented input, m_newdoc split into real segments
+    std::vector<Loc> m_newsegs;
     Loc m_match;
+    bool m_clamped = false;
 };
 
 class Operation {
@@ -97,17 +125,132 @@ public:
     Error op_exec(const char *pth, size_t npth);
     Error op_exec(const std::string& s) { return op_exec(s.c_str(), s.size()); }
 
+    /**
+     * Execute the operation with an already parsed path (for example, one
+     * converted from a JSON Pointer by Path::parse_pointer()). The path is
+     * copied, but its keys must remain valid as for op_exec().
+     */
+    Error op_exec(const Path& path);
+
+    /**
+     * Begin an operation on a document which is received incrementally
+     * (e.g. from the network). This replaces both set_doc() and op_exec():
+     * the command, value and result buffer are set beforehand as usual, and
+     * the document is then passed to op_feed() in chunks, followed by a call
+     * to op_end().
+     *
+     * Each of these returns Error::NEED_MORE until the result of the
+     * operation is known, and its result after that. Lookups
+     * (Command::GET, Command::EXISTS, Command::GET_COUNT) are resolved as
+     * soon as the match (or its parent) has been received, so the remainder
+     * of the document need not be fed at all; other operations, and paths
+     * with negative indexes, are only executed by op_end().
+     *
+     * Chunks are not copied, and must remain valid for as long as the
+     * document or the result is in use. The path must likewise remain valid
+     * until the operation is complete.
+     */
+    Error op_begin(const char *pth, size_t npth);
+    Error op_begin(const std::string& s) { return op_begin(s.c_str(), s.size()); }
+    Error op_feed(const char *s, size_t n);
+    Error op_feed(const std::string& s) { return op_feed(s.c_str(), s.size()); }
+    Error op_end();
+
     void set_value(const char *s, size_t n) { m_userval.assign(s, n); }
     void set_value(const std::string& s) { set_value(s.c_str(), s.size()); }
     void set_result_buf(Result *res) { m_result = res; }
+
+    /// Maximum number of elements kept by Command::ARRAY_APPEND_CAPPED
+    void set_limit(size_t limit) { m_limit = limit; }
+
+    /**
+     * Clamp the result of Command::COUNTER to [min, max] (saturating), rather
+     * than failing with Error::DELTA_OVERFLOW. This also applies to a counter
+     * which is created.
+     */
+    void set_counter_bounds(int64_t min, int64_t max) {
+        m_counter_bounds.emplace(min, max);
+    }
+
+    /// Create a missing counter with this value, rather than with the delta
+    void set_counter_initial(int64_t initial) { m_counter_initial = initial; }
+
+    /**
+     * The value which Command::REPLACE_IF expects at the path. If
+     * `canonical` is set, it is compared structurally by json_equal(), so
+     * that whitespace, the order of object members and the spelling of
+     * numbers and strings (e.g. `1.0` and `1`, or `"\u0041"` and `"A"`) do
+     * not matter; otherwise the bytes must be identical. The value is not
+     * copied.
+     */
+    void set_expected(const char *s, size_t n, bool canonical = false) {
+        m_expected.assign(s, n);
+        m_expected_canonical = canonical;
+    }
+    void set_expected(const std::string& s, bool canonical = false) {
+        set_expected(s.c_str(), s.size(), canonical);
+    }
+
     void set_doc(const char *s, size_t n) { m_doc.assign(s, n); }
     void set_doc(const std::string& s) { set_doc(s.c_str(), s.size()); }
+
+    /**
+     * Use a document made up of several segments (for example, the
+     * Result::newdoc() of a previous operation). Neither the segments nor
+     * the list itself are copied, and both must remain valid while the
+     * document is in use. The new document will refer to the same segments.
+     */
+    void set_doc(Buffer<Loc> segs) { m_doc.assign(segs); }
+
+    /**
+     * Read the document lazily from a source. Lookups (Command::GET,
+     * Command::EXISTS, Command::GET_COUNT) only read it as far as needed to
+     * resolve the path; other commands read the whole document. What was
+     * read is retained for subsequent operations on the same document.
+     */
+    void set_doc(DocSource& src) { m_doc.assign(src); }
+
+    /// Number of bytes of the document read so far (for a document set from
+    /// a DocSource), or the size of the document
+    size_t consumed() const { return m_doc.size(); }
     void set_code(uint8_t code) { m_optype = code; }
 
+    /**
+     * Use an index of the current document to avoid scans where possible.
+     * The index is only consulted if it was built from the buffer passed to
+     * set_doc(), and remains in effect across clear().
+     */
+    void set_index(const DocIndex* index) { m_index = index; }
+
+    /**
+     * Indicate that the keys of every object in the current document are in
+     * (byte-wise) ascending order. Lookups of missing keys then stop at the
+     * first key sorting after them, and new keys are inserted in order.
+     * Like set_index(), this remains in effect across clear().
+     */
+    void set_keys_sorted(bool sorted) { m_keys_sorted = sorted; }
+
+    /**
+     * Indicate that the current document is known to be valid JSON (for
+     * example, because it was validated when stored). Command::GET_COUNT
+     * then counts the children of a container within a contiguous document
+     * without parsing them (see ChildCounter), so that a malformed container
+     * is not reported. Like set_index(), this remains in effect across
+     * clear().
+     */
+    void set_doc_validated(bool validated) { m_doc_validated = validated; }
+
     const Match& match() const { return m_match; }
     const Path& path() const { return *m_path; }
     jsonsl_t parser() const { return m_jsn; }
 
+    /**
+     * Parse the delta of Command::COUNTER: a non-zero integer which fits in
+     * an int64_t, without leading zeros.
+     * @return Error::VALUE_EMPTY or Error::DELTA_EINVAL if it is invalid
+     */
+    static Error parse_delta(const Loc& delta, int64_t& out);
+
 private:
     /* malloc'd because this block is pretty big (several k) */
     Path *m_path;
@@ -119,19 +262,52 @@ private:
     /* opcode */
     Command m_optype;
 
-    /* Location of original document */
-    Loc m_doc;
+    /* Original document */
+    Segments m_doc;
 
     /* Location of the user's "Value" (if applicable) */
     Loc m_userval;
 
+    /* Element limit for Command::ARRAY_APPEND_CAPPED */
+    size_t m_limit;
+
+    /* Options of Command::COUNTER */
+    std::optional<std::pair<int64_t, int64_t>> m_counter_bounds;
+    std::optional<int64_t> m_counter_initial;
+
+    /* Expected value of Command::REPLACE_IF */
+    Loc m_expected;
+    bool m_expected_canonical;
+
+    /* Optional index of the document */
+    const DocIndex* m_index;
+
+    /* Whether the document's keys are sorted */
+    bool m_keys_sorted;
+
+    /* Whether the document is known to be valid JSON */
+    bool m_doc_validated;
+
+    /* Status of an operation begun with op_begin() */
+    Error m_feed_status;
+
+    /* Whether the match was already resolved while feeding the document */
+    bool m_prematched;
+
     //! Pointer to result given by user
     Result *m_result;
 
+    Error parse_path(const char *pth, size_t npth);
+    Error execute();
+    Error dispatch();
+    void split_result();
     Error do_match_common(Match::SearchOptions options);
     Error do_get() const;
     Error do_store_dict();
+    bool replace_expected();
     Error do_remove();
+    Error do_pop();
+    Error do_remove_value();
 
     enum MkdirPMode {
         MKDIR_P_ARRAY, //!< Insert ... "key": [ value ]
@@ -140,11 +316,16 @@ private:
     Error do_mkdir_p(MkdirPMode mode);
     Error insert_singleton_element();
     Error do_list_append();
+    Error do_unique_append(const std::vector<Loc>& values);
     Error do_empty_append();
     Error do_list_prepend();
+    Error do_capped_append();
     Error do_arith_op();
+    int64_t clamp_counter(int64_t value);
+    Error do_float_arith_op();
     Error do_insert();
     Error do_container_size();
+    Error do_merge_patch();
 
     // Wrapper around Validator::validate(), this omits the
     // passing of arguments we already have (for example, the new object)
@@ -10,11 +10,13 @@
 
 #define INCLUDE_JSONSL_SRC
 #include "path.h"
+#include <climits>
 
 using namespace Subdoc;
 
-const char *
-Path::convert_escaped(const char *src, size_t& len)
+/* Returns an empty string, which remains valid until the path is cleared */
+std::string&
+Path::new_buffer()
 {
     if (m_cached.empty()) {
         m_used.push_back(new std::string());
@@ -22,7 +24,13 @@ Path::convert_escaped(const char *src, size_t& len)
         m_used.push_back(m_cached.back());
         m_cached.pop_back();
     }
-    std::string& s = *m_used.back();
+    return *m_used.back();
+}
+
+const char *
+Path::convert_escaped(const char *src, size_t& len)
+{
+    std::string& s = new_buffer();
 
     for (size_t ii = 0; ii < len; ii++) {
         if (src[ii] != '`') {
@@ -35,24 +43,15 @@ Path::convert_escaped(const char *src, size_t& len)
     return s.c_str();
 }
 
-/* Adds a numeric component */
-int
-Path::add_num_component(const char *component, size_t len)
+/* Parses an unsigned array index */
+static bool
+parse_index(const char *component, size_t len, size_t& numval)
 {
-    unsigned ii;
-    size_t numval = 0;
-
-    if (component[0] == '-') {
-        if (len != 2 || component[1] != '1') {
-            return JSONSL_ERROR_INVALID_NUMBER;
-        }
-        return add_array_index(-1);
-    }
-
-    for (ii = 0; ii < len; ii++) {
+    numval = 0;
+    for (size_t ii = 0; ii < len; ii++) {
         const char *c = &component[ii];
         if (*c < 0x30 || *c > 0x39) {
-            return JSONSL_ERROR_INVALID_NUMBER;
+            return false;
         }
         size_t tmpval = numval;
         tmpval *= 10;
@@ -60,16 +59,85 @@ Path::add_num_component(const char *component, size_t len)
 
         /* check for overflow */
         if (tmpval < numval) {
-            return JSONSL_ERROR_INVALID_NUMBER;
+            return false;
         }
         numval = tmpval;
     }
+    return true;
+}
+
+/* Adds a numeric component */
+int
+Path::add_num_component(const char *component, size_t len)
+{
+    size_t numval = 0;
+
+    if (m_wildcards && len == 1 && component[0] == '*') {
+        return add_wildcard(true, 0, WILDCARD_END);
+    }
+    if (m_wildcards && memchr(component, ':', len) != nullptr) {
+        return add_slice_component(component, len);
+    }
+
+    if (component[0] == '-') {
+        // Counting back from the end of the array; -1 is the last element
+        if (!parse_index(component + 1, len - 1, numval) || numval == 0 ||
+                numval > static_cast<size_t>(LONG_MAX)) {
+            return JSONSL_ERROR_INVALID_NUMBER;
+        }
+        return add_array_index(-static_cast<long>(numval));
+    }
+
+    if (!parse_index(component, len, numval)) {
+        return JSONSL_ERROR_INVALID_NUMBER;
+    }
     return add_array_index(numval);
 }
 
+/* Adds a [start:end] component. Negative bounds are not supported */
+int
+Path::add_slice_component(const char *component, size_t len)
+{
+    const char *colon = static_cast<const char*>(memchr(component, ':', len));
+    const size_t nbegin = colon - component;
+    const size_t nend = len - nbegin - 1;
+    size_t begin = 0;
+    size_t end = WILDCARD_END;
+
+    if (nbegin && !parse_index(component, nbegin, begin)) {
+        return JSONSL_ERROR_INVALID_NUMBER;
+    }
+    if (nend && !parse_index(colon + 1, nend, end)) {
+        return JSONSL_ERROR_INVALID_NUMBER;
+    }
+    return add_wildcard(true, begin, end);
+}
+
+int
+Path::add_wildcard(bool arridx, unsigned long begin, unsigned long end)
+{
+    if (size() == Limits::MAX_COMPONENTS) {
+        return JSONSL_ERROR_LEVELS_EXCEEDED;
+    }
+
+    Component& comp = add(JSONSL_PATH_WILDCARD);
+    comp.pstr = nullptr;
+    comp.len = 0;
+    comp.idx = begin;
+    comp.idx_end = end;
+    comp.is_arridx = arridx;
+    comp.is_neg = false;
+    has_wildcard = true;
+    return 0;
+}
+
 int
 Path::add_str_component(const char *component, size_t len, int n_backtick)
 {
+    if (m_wildcards && len == 1 && component[0] == '*') {
+        return add_wildcard(false, 0, WILDCARD_END);
+    }
+
     /* Allocate first component: */
     if (len > 1 && component[0] == '`' && component[len-1] == '`') {
         component++;
@@ -92,6 +160,7 @@ Path::add_str_component(const char *component, size_t len, int n_backtick)
     Component& jpr_comp = add(JSONSL_PATH_STRING);
     jpr_comp.pstr = const_cast<char*>(component);
     jpr_comp.len = len;
+    jpr_comp.is_arridx = 0;
     jpr_comp.is_neg = false;
     return 0;
 }
@@ -107,7 +176,8 @@ Path::add_array_index(long ixnum)
     comp.len = 0;
     comp.idx = ixnum;
     comp.pstr = nullptr;
-    if (ixnum == -1) {
+    comp.is_arridx = 0;
+    if (ixnum < 0) {
         has_negix = true;
         comp.is_neg = true;
     } else {
@@ -220,6 +290,15 @@ Path::parse_string(const char *path, size_t len, size_t *n_consumed)
     return add_str_component(path, len, n_backticks);
 }
 
+int
+Path::parse_wildcard(const char *path, size_t len)
+{
+    m_wildcards = true;
+    int rv = parse(path, len);
+    m_wildcards = false;
+    return rv;
+}
+
 /* So this should somehow give us a 'JPR' object.. */
 int
 Path::parse(const char *path, size_t len)
@@ -227,6 +306,7 @@ Path::parse(const char *path, size_t len)
     /* Path's buffers cannot change */
     ncomponents = 0;
     has_negix = false;
+    has_wildcard = false;
     add(JSONSL_PATH_ROOT);
 
     size_t ii = 0;
@@ -264,8 +344,128 @@ Path::parse(const char *path, size_t len)
     return JSONSL_ERROR_SUCCESS;
 }
 
+/* Adds a reference token of a JSON Pointer */
+int
+Path::add_pointer_token(const char *token, size_t len, bool tilde)
+{
+    size_t numval = 0;
+    if (len && (len == 1 || token[0] != '0') &&
+            parse_index(token, len, numval)) {
+        if (numval > static_cast<size_t>(LONG_MAX)) {
+            return JSONSL_ERROR_INVALID_NUMBER;
+        }
+        int rv = add_array_index(static_cast<long>(numval));
+        if (rv == 0) {
+            // Within an object, the token is a key
+            Component& comp = back();
+            comp.pstr = const_cast<char*>(token);
+            comp.len = len;
+            comp.maybe_key = true;
+        }
+        return rv;
+    }
+
+    if (size() == Limits::MAX_COMPONENTS) {
+        return JSONSL_ERROR_LEVELS_EXCEEDED;
+    }
+    if (tilde) {
+        // ~1 and ~0 stand for '/' and '~'
+        std::string& s = new_buffer();
+        for (size_t ii = 0; ii < len; ii++) {
+            if (token[ii] != '~') {
+                s += token[ii];
+            } else if (ii + 1 < len && token[ii+1] == '0') {
+                s += '~', ii++;
+            } else if (ii + 1 < len && token[ii+1] == '1') {
+                s += '/', ii++;
+            } else {
+                return JSONSL_ERROR_JPR_BADPATH;
+            }
+        }
+        token = s.c_str();
+        len = s.size();
+    }
+
+    Component& comp = add(JSONSL_PATH_STRING);
+    comp.pstr = const_cast<char*>(token);
+    comp.len = len;
+    comp.is_arridx = 0;
+    comp.is_neg = false;
+    return 0;
+}
+
+int
+Path::parse_pointer(const char *ptr, size_t len)
+{
+    ncomponents = 0;
+    has_negix = false;
+    has_wildcard = false;
+    add(JSONSL_PATH_ROOT);
+
+    if (len == 0) {
+        return JSONSL_ERROR_SUCCESS;
+    }
+    if (ptr[0] != '/') {
+        return JSONSL_ERROR_JPR_BADPATH;
+    }
+
+    size_t begin = 1;
+    for (;;) {
+        // Find the end of the token; a separator may also be written as the
+        // JSON escape `\/`
+        size_t end = begin;
+        size_t next = len;
+        bool tilde = false;
+        for (; end < len; end++) {
+            const auto c = static_cast<uint8_t>(ptr[end]);
+            if (c == '/') {
+                next = end + 1;
+                break;
+            } else if (c == '\\') {
+                const auto esc = static_cast<uint8_t>(
+                        end + 1 < len ? ptr[end+1] : 0);
+                if (esc == 'u' || !isAllowedJsonEscapes(esc)) {
+                    // We can't handle \u-escapes in paths now!
+                    return JSONSL_ERROR_JPR_BADPATH;
+                }
+                if (esc == '/') {
+                    next = end + 2;
+                    break;
+                }
+                end++;
+            } else if (c == '"' || c < 0x1F) {
+                return JSONSL_ERROR_JPR_BADPATH;
+            } else if (c == '~') {
+                tilde = true;
+            }
+        }
+
+        int rv = add_pointer_token(ptr + begin, end - begin, tilde);
+        if (rv != 0) {
+            return rv;
+        }
+        if (next == len && end == len) {
+            return JSONSL_ERROR_SUCCESS;
+        }
+        begin = next;
+    }
+}
+
+void
+Path::assign(const Path& other)
+{
+    clear();
+    ncomponents = 0;
+    for (const auto& comp : other) {
+        add(comp.ptype) = comp;
+    }
+    has_negix = other.has_negix;
+    has_wildcard = other.has_wildcard;
+}
+
 Path::Path() : PathComponentInfo(components_s, 0) {
     has_negix = false;
+    has_wildcard = false;
     memset(components_s, 0, sizeof components_s);
 }
 
@@ -283,6 +483,7 @@ Path::clear() {
         Component& comp = get_component(ii);
         comp.pstr = nullptr;
         comp.ptype = JSONSL_PATH_NONE;
+        comp.is_arridx = 0;
         comp.is_neg = false;
     }
 
@@ -42,6 +42,7 @@ public:
     PathComponent& add(jsonsl_jpr_type_t ptype) {
         PathComponent& ret = get_component(size());
         ret.ptype = ptype;
+        ret.maybe_key = false;
         ncomponents++;
         return ret;
     }
@@ -96,8 +97,27 @@ public:
     static const size_t PATH_COMPONENTS_ALLOC = MAX_COMPONENTS + 1;
 };
 
+/**
+ * A parsed path. Negative array indexes count back from the end of the
+ * array (`[-1]` being the last element). A path parsed with
+ * parse_wildcard() may also contain _wildcard_ components, which match
+ * several elements of their parent:
+ *
+ * - `[*]` matches every element of an array
+ * - `[start:end]` matches the array elements whose index is in
+ *   [start, end); either bound may be omitted
+ * - `.*` (or `*` as the first component) matches every value of an object.
+ *   A key which is a literal `*` may be escaped as `` `*` ``
+ *
+ * Wildcard components have the type JSONSL_PATH_WILDCARD. For array
+ * wildcards `is_arridx` is set, `idx` is the first index and `idx_end` is
+ * one past the last (WILDCARD_END if unbounded). Only a MatchIterator can
+ * evaluate such a path.
+ */
 class Path : public PathComponentInfo {
 public:
+    static constexpr unsigned long WILDCARD_END = static_cast<unsigned long>(-1);
+
     typedef PathComponent Component;
     typedef PathComponentInfo CompInfo;
 
@@ -108,11 +128,45 @@ public:
     int parse(const char *s) { return parse(s, strlen(s)); }
     int parse(const std::string& s) { return parse(s.c_str(), s.size()); }
 
+    /// Parse a path which may contain wildcard components. parse() reads
+    /// `*` as an ordinary key, and rejects `[*]` and slices
+    int parse_wildcard(const char *, size_t);
+    int parse_wildcard(const char *s) { return parse_wildcard(s, strlen(s)); }
+    int parse_wildcard(const std::string& s) {
+        return parse_wildcard(s.c_str(), s.size());
+    }
+
+    /**
+     * Parse a JSON Pointer (RFC 6901), e.g. `/a/0/b~1c`. The pointer is given
+     * as it appears within a JSON string (without the quotes), so that its
+     * keys compare equal to those of the document; `\u` escapes are not
+     * supported. Since a pointer does not tell arrays and objects apart, a
+     * reference token consisting only of digits (without leading zeros) is
+     * an array index within an array, and a key within an object: it is
+     * added as a numeric component with `maybe_key` set, whose string is
+     * the token. The empty pointer refers to the whole document.
+     */
+    int parse_pointer(const char *, size_t);
+    int parse_pointer(const std::string& s) {
+        return parse_pointer(s.c_str(), s.size());
+    }
+
+    /**
+     * Make this path a copy of `other`. Keys are not copied, and refer to
+     * the same strings as those of `other`, which must remain valid.
+     */
+    void assign(const Path& other);
+
     Component components_s[Limits::PATH_COMPONENTS_ALLOC];
     jsonsl_error_t add_array_index(long ixnum);
     bool has_negix; /* True if there is a negative array index in the path */
+    bool has_wildcard; /* True if there is a wildcard component in the path */
 private:
+    inline int add_wildcard(bool arridx, unsigned long begin, unsigned long end);
+    inline int add_slice_component(const char *component, size_t len);
+    inline std::string& new_buffer();
     inline const char * convert_escaped(const char *src, size_t &len);
+    inline int add_pointer_token(const char *token, size_t len, bool tilde);
     inline int add_num_component(const char *component, size_t len);
     inline int add_str_component(const char *component, size_t len, int n_backtick);
     inline int parse_bracket(const char *path, size_t len, size_t *n_comsumed);
@@ -120,5 +174,7 @@ private:
 
     std::list<std::string*> m_cached;
     std::list<std::string*> m_used;
+    // Whether wildcard components are recognized (see parse_wildcard())
+    bool m_wildcards = false;
 };
 } // namespace Subdoc
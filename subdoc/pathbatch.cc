@@ -0,0 +1,52 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "pathbatch.h"
+#include "util.h"
+
+using namespace Subdoc;
+
+PathBatch::PathBatch()
+    : m_path(new Path()), m_jsn(Match::jsn_alloc()) {
+}
+
+PathBatch::~PathBatch()
+{
+    delete m_path;
+    Match::jsn_free(m_jsn);
+}
+
+Error
+PathBatch::parse(const char *pth, size_t npth)
+{
+    m_path->clear();
+    Error status = Util::path_status(m_path->parse(pth, npth));
+    if (!status.success()) {
+        return status;
+    }
+    if (m_path->has_negix) {
+        return Error::GLOBAL_ENOSUPPORT;
+    }
+    return Error::SUCCESS;
+}
+
+Error
+PathBatch::exec(const char *doc, size_t n)
+{
+    m_match.exec_match(doc, n, m_jsn);
+    return Util::doc_status(m_match.status);
+}
+
+Error
+PathBatch::exec(Segments& doc)
+{
+    m_match.exec_match(doc, m_jsn);
+    return Util::doc_status(m_match.status);
+}
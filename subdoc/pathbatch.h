@@ -0,0 +1,67 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+
+namespace Subdoc {
+
+/**
+ * A set of paths which are all resolved in a single scan of the document.
+ * This holds what the batch operations (such as Projection) have in common:
+ * parsing each path and adding it to a MultiMatch, and running that over a
+ * document.
+ */
+class PathBatch {
+public:
+    PathBatch();
+    ~PathBatch();
+    PathBatch(const PathBatch&) = delete;
+    PathBatch& operator=(const PathBatch&) = delete;
+
+    /**
+     * Parse a path, which may then be inspected with path() before it is
+     * added with add(). The path need not remain valid afterwards.
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, or Error::GLOBAL_ENOSUPPORT if it contains negative
+     *         array indexes
+     */
+    Error parse(const char *pth, size_t npth);
+
+    /// The path last parsed
+    const Path& path() const { return *m_path; }
+
+    /// Add the path last parsed. Returns its node within match(), which is
+    /// the same for a path added more than once
+    size_t add() { return m_match.add(*m_path); }
+
+    /// Remove all paths
+    void clear() { m_match.clear(); }
+
+    /**
+     * Resolve the paths in a document (see MultiMatch::exec_match())
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document
+     *         could not be parsed
+     */
+    Error exec(const char *doc, size_t n);
+    Error exec(Segments& doc);
+
+    /// The nodes of the paths, as of the last exec()
+    const MultiMatch& match() const { return m_match; }
+
+private:
+    /* malloc'd because this block is pretty big (several k) */
+    Path *m_path;
+    jsonsl_t m_jsn;
+    MultiMatch m_match;
+};
+
+} // namespace Subdoc
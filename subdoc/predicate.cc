@@ -0,0 +1,704 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "predicate.h"
+#include "match.h"
+#include "segments.h"
+#include "util.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <deque>
+
+using namespace Subdoc;
+
+static int
+hexval(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parse the four hex digits of a u-escape
+static bool
+parse_hex4(const char *s, char32_t& out)
+{
+    out = 0;
+    for (size_t ii = 0; ii < 4; ii++) {
+        int v = hexval(s[ii]);
+        if (v < 0) {
+            return false;
+        }
+        out = (out << 4) | static_cast<char32_t>(v);
+    }
+    return true;
+}
+
+static void
+append_utf8(std::string& out, char32_t pt)
+{
+    if (pt < 0x80) {
+        out += static_cast<char>(pt);
+    } else if (pt < 0x800) {
+        out += static_cast<char>((pt >> 6) | 0xC0);
+        out += static_cast<char>((pt & 0x3F) | 0x80);
+    } else if (pt < 0x10000) {
+        out += static_cast<char>((pt >> 12) | 0xE0);
+        out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+        out += static_cast<char>((pt & 0x3F) | 0x80);
+    } else {
+        out += static_cast<char>((pt >> 18) | 0xF0);
+        out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+        out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+        out += static_cast<char>((pt & 0x3F) | 0x80);
+    }
+}
+
+bool
+Scalar::assign(const char *s, size_t n)
+{
+    while (n && Util::is_json_ws(*s)) {
+        s++, n--;
+    }
+    while (n && Util::is_json_ws(s[n-1])) {
+        n--;
+    }
+
+    m_kind = INVALID;
+    if (n == 0) {
+        return false;
+    }
+
+    switch (*s) {
+    case '"':
+        return assign_string(s, n);
+    case 't':
+    case 'f':
+        if ((n == 4 && memcmp(s, "true", 4) == 0) ||
+                (n == 5 && memcmp(s, "false", 5) == 0)) {
+            m_kind = BOOLEAN;
+            m_bool = *s == 't';
+        }
+        break;
+    case 'n':
+        if (n == 4 && memcmp(s, "null", 4) == 0) {
+            m_kind = NULLVAL;
+        }
+        break;
+    default:
+        return assign_number(s, n);
+    }
+    return m_kind != INVALID;
+}
+
+bool
+Scalar::assign_string(const char *s, size_t n)
+{
+    if (n < 2 || s[n-1] != '"') {
+        return false;
+    }
+    const char *body = s + 1;
+    const size_t nbody = n - 2;
+
+    if (memchr(body, '\\', nbody) == nullptr) {
+        if (memchr(body, '"', nbody) != nullptr) {
+            return false;
+        }
+        m_str = body;
+        m_len = nbody;
+        m_kind = STRING;
+        return true;
+    }
+
+    m_copy.clear();
+    for (size_t ii = 0; ii < nbody; ii++) {
+        const char c = body[ii];
+        if (c == '"') {
+            return false;
+        }
+        if (c != '\\') {
+            m_copy += c;
+            continue;
+        }
+        if (++ii == nbody) {
+            // The closing quote was escaped
+            return false;
+        }
+        switch (body[ii]) {
+        case '"':
+        case '\\':
+        case '/':
+            m_copy += body[ii];
+            break;
+        case 'b':
+            m_copy += '\b';
+            break;
+        case 'f':
+            m_copy += '\f';
+            break;
+        case 'n':
+            m_copy += '\n';
+            break;
+        case 'r':
+            m_copy += '\r';
+            break;
+        case 't':
+            m_copy += '\t';
+            break;
+        case 'u': {
+            char32_t pt;
+            if (nbody - ii < 5 || !parse_hex4(body + ii + 1, pt)) {
+                return false;
+            }
+            ii += 4;
+            if (pt >= 0xDC00 && pt <= 0xDFFF) {
+                return false; // Lone low surrogate
+            }
+            if (pt >= 0xD800 && pt <= 0xDBFF) {
+                char32_t low;
+                if (nbody - ii < 7 || body[ii+1] != '\\' || body[ii+2] != 'u' ||
+                        !parse_hex4(body + ii + 3, low) ||
+                        low < 0xDC00 || low > 0xDFFF) {
+                    return false;
+                }
+                ii += 6;
+                pt = 0x10000 + ((pt - 0xD800) << 10) + (low - 0xDC00);
+            }
+            append_utf8(m_copy, pt);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    m_str = m_copy.data();
+    m_len = m_copy.size();
+    m_kind = STRING;
+    return true;
+}
+
+bool
+Scalar::is_number(const char *s, size_t n)
+{
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    size_t ii = 0;
+    auto digits = [&]() {
+        size_t begin = ii;
+        while (ii < n && s[ii] >= '0' && s[ii] <= '9') {
+            ii++;
+        }
+        return ii - begin;
+    };
+
+    if (ii < n && s[ii] == '-') {
+        ii++;
+    }
+    if (ii < n && s[ii] == '0') {
+        ii++;
+    } else if (digits() == 0) {
+        return false;
+    }
+    if (ii < n && s[ii] == '.') {
+        ii++;
+        if (digits() == 0) {
+            return false;
+        }
+    }
+    if (ii < n && (s[ii] == 'e' || s[ii] == 'E')) {
+        ii++;
+        if (ii < n && (s[ii] == '+' || s[ii] == '-')) {
+            ii++;
+        }
+        if (digits() == 0) {
+            return false;
+        }
+    }
+    return ii == n;
+}
+
+bool
+Scalar::assign_number(const char *s, size_t n)
+{
+    if (!is_number(s, n)) {
+        return false;
+    }
+
+    // An integer unless it has a fraction or an exponent
+    auto rv = std::from_chars(s, s + n, m_int);
+    m_isint = rv.ec == std::errc() && rv.ptr == s + n;
+    std::from_chars(s, s + n, m_double);
+    m_str = s;
+    m_len = n;
+    m_kind = NUMBER;
+    return true;
+}
+
+bool
+Scalar::equals(const Scalar& other) const
+{
+    if (m_kind != other.m_kind) {
+        return false;
+    }
+    switch (m_kind) {
+    case STRING:
+    case NUMBER:
+        return compare(other) == 0;
+    case BOOLEAN:
+        return m_bool == other.m_bool;
+    case NULLVAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int
+Scalar::compare(const Scalar& other) const
+{
+    Expects(comparable(other));
+    if (m_kind == STRING) {
+        int rv = memcmp(m_str, other.m_str, std::min(m_len, other.m_len));
+        if (rv != 0) {
+            return rv;
+        }
+        return m_len < other.m_len ? -1 : m_len > other.m_len ? 1 : 0;
+    }
+    if (m_isint && other.m_isint) {
+        return m_int < other.m_int ? -1 : m_int > other.m_int ? 1 : 0;
+    }
+    return m_double < other.m_double ? -1 : m_double > other.m_double ? 1 : 0;
+}
+
+/*
+ * Collects the children of the container `value` (without surrounding
+ * whitespace), and for an object their keys. Returns false if it is not
+ * valid JSON.
+ */
+static bool
+collect_children(const Loc& value, const Path& root, jsonsl_t jsn,
+    std::vector<Loc>& elems, std::vector<Loc>& keys)
+{
+    ContainerCursor cur;
+    cur.open(value.at, value.length, &root, jsn);
+    bool separated = true;
+    while (separated && cur.next()) {
+        const Loc& elem = cur.child().loc;
+        if (cur.type == JSONSL_T_OBJECT) {
+            keys.push_back(cur.child().loc_key);
+        } else if (!elems.empty()) {
+            // The parser does not insist on a comma between array elements
+            const char *prev_end = elems.back().at + elems.back().length;
+            separated = memchr(prev_end, ',', elem.at - prev_end) != nullptr;
+        }
+        elems.push_back(elem);
+    }
+    cur.close();
+    // Nothing may follow the container
+    return separated && cur.status() == JSONSL_ERROR_SUCCESS && cur.found &&
+           cur.loc.at == value.at && cur.loc.length == value.length;
+}
+
+static bool
+values_equal(const Loc& a, const Loc& b, const Path& root, jsonsl_t jsn)
+{
+    Loc ta = a, tb = b;
+    for (Loc* loc : {&ta, &tb}) {
+        while (loc->length && Util::is_json_ws(loc->at[0])) {
+            loc->at++, loc->length--;
+        }
+        while (loc->length && Util::is_json_ws(loc->at[loc->length - 1])) {
+            loc->length--;
+        }
+        if (loc->empty()) {
+            return false;
+        }
+    }
+
+    const char type = ta.at[0];
+    if (type != '[' && type != '{') {
+        Scalar sa, sb;
+        return sa.assign(ta.at, ta.length) && sb.assign(tb.at, tb.length) &&
+               sa.equals(sb);
+    }
+    if (tb.at[0] != type) {
+        return false;
+    }
+
+    std::vector<Loc> elems_a, elems_b, keys_a, keys_b;
+    if (!collect_children(ta, root, jsn, elems_a, keys_a) ||
+            !collect_children(tb, root, jsn, elems_b, keys_b) ||
+            elems_a.size() != elems_b.size()) {
+        return false;
+    }
+    const size_t n = elems_a.size();
+    if (type == '[') {
+        for (size_t ii = 0; ii < n; ii++) {
+            if (!values_equal(elems_a[ii], elems_b[ii], root, jsn)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Members are compared in the order of their (unescaped) keys. A deque,
+    // as a Scalar may refer to its own copy of the string
+    std::deque<Scalar> names_a(n), names_b(n);
+    std::vector<size_t> order_a(n), order_b(n);
+    for (size_t ii = 0; ii < n; ii++) {
+        if (!names_a[ii].assign(keys_a[ii].at, keys_a[ii].length) ||
+                !names_b[ii].assign(keys_b[ii].at, keys_b[ii].length)) {
+            return false;
+        }
+        order_a[ii] = order_b[ii] = ii;
+    }
+    auto sort_keys = [](std::vector<size_t>& order,
+                        const std::deque<Scalar>& names) {
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t x, size_t y) {
+                             return names[x].compare(names[y]) < 0;
+                         });
+    };
+    sort_keys(order_a, names_a);
+    sort_keys(order_b, names_b);
+    for (size_t ii = 0; ii < n; ii++) {
+        const size_t ia = order_a[ii], ib = order_b[ii];
+        if (!names_a[ia].equals(names_b[ib]) ||
+                !values_equal(elems_a[ia], elems_b[ib], root, jsn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+Subdoc::json_equal(const Loc& a, const Loc& b, jsonsl_t jsn)
+{
+    Path root;
+    root.parse("", 0);
+    return values_equal(a, b, root, jsn);
+}
+
+Predicate::Predicate() : m_path(new Path()) {
+}
+
+Predicate::~Predicate()
+{
+    delete m_path;
+}
+
+Error
+Predicate::compile(const char *pth, size_t npth, Op op,
+    const char *literal, size_t nliteral)
+{
+    // The path refers to the string it was parsed from
+    m_path->clear();
+    m_path_buf.assign(pth, npth);
+    Error status = Util::path_status(m_path->parse(m_path_buf));
+    if (!status.success()) {
+        return status;
+    }
+
+    m_literal_buf.assign(literal, nliteral);
+    if (!m_literal.assign(m_literal_buf.data(), m_literal_buf.size())) {
+        return Error::VALUE_CANTINSERT;
+    }
+    m_op = op;
+    return Error::SUCCESS;
+}
+
+bool
+Predicate::test(const Scalar& value) const
+{
+    switch (m_op) {
+    case EQ:
+    case CONTAINS:
+        return value.equals(m_literal);
+    case NE:
+        return !value.equals(m_literal);
+    case LT:
+        return value.comparable(m_literal) && value.compare(m_literal) < 0;
+    case LE:
+        return value.comparable(m_literal) && value.compare(m_literal) <= 0;
+    case GT:
+        return value.comparable(m_literal) && value.compare(m_literal) > 0;
+    case GE:
+        return value.comparable(m_literal) && value.compare(m_literal) >= 0;
+    }
+    return false;
+}
+
+bool
+Predicate::test(const char *value, size_t n) const
+{
+    Scalar scalar;
+    if (!scalar.assign(value, n)) {
+        // A container
+        return m_op == NE;
+    }
+    return test(scalar);
+}
+
+Error
+Predicate::eval(const char *doc, size_t n, Segments *segs, jsonsl_t jsn,
+    bool& result) const
+{
+    result = false;
+
+    Match m;
+    if (m_op == CONTAINS && !m_path->has_negix) {
+        // Test the elements as they are parsed
+        m.contains = this;
+    }
+    if (segs != nullptr) {
+        m.exec_match(*segs, m_path, jsn);
+    } else {
+        m.exec_match(doc, n, m_path, jsn);
+    }
+
+    if (m.status != JSONSL_ERROR_SUCCESS) {
+        return Util::doc_status(m.status);
+    }
+    if (m.matchres != JSONSL_MATCH_COMPLETE) {
+        return Error::SUCCESS;
+    }
+    if (m.contains != nullptr) {
+        result = m.contains_found;
+        return Error::SUCCESS;
+    }
+
+    Loc value = m.loc_deepest;
+    std::string copy;
+    if (segs != nullptr) {
+        value = segs->flatten(value, copy);
+    }
+
+    if (m_op != CONTAINS) {
+        result = test(value.at, value.length);
+        return Error::SUCCESS;
+    }
+    if (m.type != JSONSL_T_LIST) {
+        return Error::SUCCESS;
+    }
+
+    // The array was found through a negative index, i.e. only once it had
+    // been parsed; scan it again for its elements
+    Path root;
+    root.parse("", 0);
+    Match elems;
+    elems.contains = this;
+    elems.exec_match(value, &root, jsn);
+    result = elems.contains_found;
+    return Error::SUCCESS;
+}
+
+Error
+Predicate::eval(const char *doc, size_t n, jsonsl_t jsn, bool& result) const
+{
+    return eval(doc, n, nullptr, jsn, result);
+}
+
+Error
+Predicate::eval(Segments& doc, jsonsl_t jsn, bool& result) const
+{
+    return eval(doc.begin(), doc.size(), &doc, jsn, result);
+}
+
+PredicateProgram::PredicateProgram()
+{
+    m_match.set_listener(this);
+}
+
+PredicateProgram::~PredicateProgram() = default;
+
+void
+PredicateProgram::clear()
+{
+    m_program.clear();
+    m_leaves.clear();
+    m_values.clear();
+    m_depth = 0;
+    m_match.clear();
+}
+
+Error
+PredicateProgram::add(const char *pth, size_t npth, Predicate::Op op,
+    const char *literal, size_t nliteral)
+{
+    if (m_program.size() == MAX_INSTRUCTIONS) {
+        return Error::PATH_E2BIG;
+    }
+    auto pred = std::make_unique<Predicate>();
+    Error rv = pred->compile(pth, npth, op, literal, nliteral);
+    if (!rv.success()) {
+        return rv;
+    }
+    if (pred->path().has_negix) {
+        return Error::GLOBAL_ENOSUPPORT;
+    }
+
+    const size_t node = m_match.add(pred->path());
+    if (op == Predicate::CONTAINS) {
+        m_match[node].elements = true;
+    }
+    m_program.push_back({LEAF, m_leaves.size()});
+    m_leaves.push_back({std::move(pred), node});
+    m_values.push_back(IS_UNKNOWN);
+    m_depth++;
+    return Error::SUCCESS;
+}
+
+bool
+PredicateProgram::push_op(Code code, size_t nargs)
+{
+    if (m_depth < nargs || m_program.size() == MAX_INSTRUCTIONS) {
+        return false;
+    }
+    m_program.push_back({code, 0});
+    m_depth -= nargs - 1;
+    return true;
+}
+
+/**
+ * Run the program with the values of the predicates known so far. Unknown
+ * values propagate unless the outcome is decided regardless of them (e.g.
+ * `false AND unknown` is false).
+ */
+PredicateProgram::Value
+PredicateProgram::run() const
+{
+    std::array<Value, MAX_INSTRUCTIONS> stack;
+    size_t sp = 0;
+
+    for (const auto& ins : m_program) {
+        switch (ins.code) {
+        case LEAF:
+            stack[sp++] = m_values[ins.leaf];
+            break;
+        case NOT: {
+            Value& v = stack[sp-1];
+            if (v != IS_UNKNOWN) {
+                v = v == IS_TRUE ? IS_FALSE : IS_TRUE;
+            }
+            break;
+        }
+        case AND:
+        case OR: {
+            const Value b = stack[--sp];
+            Value& a = stack[sp-1];
+            // The value which decides the outcome on its own
+            const Value dominant = ins.code == AND ? IS_FALSE : IS_TRUE;
+            if (a == dominant || b == dominant) {
+                a = dominant;
+            } else if (a == IS_UNKNOWN || b == IS_UNKNOWN) {
+                a = IS_UNKNOWN;
+            }
+            break;
+        }
+        }
+    }
+    return stack[0];
+}
+
+bool
+PredicateProgram::resolved(const MultiMatch& mm, size_t ix)
+{
+    bool changed = false;
+    for (size_t ii = 0; ii < m_leaves.size(); ii++) {
+        if (m_values[ii] != IS_UNKNOWN) {
+            continue;
+        }
+        const Leaf& leaf = m_leaves[ii];
+
+        // Is the leaf at, or below, the element which was parsed?
+        size_t cur = leaf.node;
+        while (cur != ix && cur != MultiMatch::NONE) {
+            cur = mm[cur].parent;
+        }
+        if (cur == MultiMatch::NONE) {
+            continue;
+        }
+
+        const auto& node = mm[leaf.node];
+        bool result = false;
+        if (node.found && leaf.pred->op() != Predicate::CONTAINS) {
+            Loc value = node.loc;
+            if (m_segs != nullptr) {
+                value = m_segs->flatten(value, m_copy);
+            }
+            result = leaf.pred->test(value.at, value.length);
+        }
+        // Otherwise the value is missing, or (for CONTAINS) none of the
+        // elements matched
+        m_values[ii] = result ? IS_TRUE : IS_FALSE;
+        changed = true;
+    }
+    return changed && run() != IS_UNKNOWN;
+}
+
+bool
+PredicateProgram::element(const MultiMatch&, size_t ix,
+    const char *value, size_t nvalue)
+{
+    bool changed = false;
+    for (size_t ii = 0; ii < m_leaves.size(); ii++) {
+        const Leaf& leaf = m_leaves[ii];
+        if (m_values[ii] == IS_UNKNOWN && leaf.node == ix &&
+                leaf.pred->op() == Predicate::CONTAINS &&
+                leaf.pred->test(value, nvalue)) {
+            m_values[ii] = IS_TRUE;
+            changed = true;
+        }
+    }
+    return changed && run() != IS_UNKNOWN;
+}
+
+Error
+PredicateProgram::eval(const char *doc, size_t n, Segments *segs,
+    jsonsl_t jsn, bool& result)
+{
+    Expects(valid());
+    std::fill(m_values.begin(), m_values.end(), IS_UNKNOWN);
+    m_segs = segs;
+    if (segs != nullptr) {
+        m_match.exec_match(*segs, jsn);
+    } else {
+        m_match.exec_match(doc, n, jsn);
+    }
+    m_segs = nullptr;
+
+    if (m_match.status != JSONSL_ERROR_SUCCESS) {
+        result = false;
+        return Util::doc_status(m_match.status);
+    }
+
+    // Anything still unknown was not found
+    std::replace(m_values.begin(), m_values.end(), IS_UNKNOWN, IS_FALSE);
+    result = run() == IS_TRUE;
+    return Error::SUCCESS;
+}
+
+Error
+PredicateProgram::eval(const char *doc, size_t n, jsonsl_t jsn, bool& result)
+{
+    return eval(doc, n, nullptr, jsn, result);
+}
+
+Error
+PredicateProgram::eval(Segments& doc, jsonsl_t jsn, bool& result)
+{
+    return eval(doc.begin(), doc.size(), &doc, jsn, result);
+}
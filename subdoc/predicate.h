@@ -0,0 +1,277 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "subdoc-api.h"
+#include "match.h"
+#include "path.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Subdoc {
+
+class Segments;
+
+/**
+ * A JSON primitive (string, number, `true`, `false` or `null`) in a form
+ * suitable for comparison. Strings compare by their unescaped contents
+ * (e.g. `"A"` is equal to `"A"`), and numbers by their numeric value
+ * (e.g. `1` is equal to `1.0` and to `1e0`). Integers which fit in an int64_t
+ * are compared exactly.
+ *
+ * A string without escapes refers to the token it was assigned from, which
+ * must then remain valid; other strings are copied.
+ */
+class Scalar {
+public:
+    enum Kind { INVALID, STRING, NUMBER, BOOLEAN, NULLVAL };
+
+    /**
+     * Assign a token as it appears in a JSON document, including the quotes
+     * for strings. Leading and trailing whitespace is ignored.
+     * @return false if the token is not a valid JSON primitive
+     */
+    bool assign(const char *s, size_t n);
+
+    Kind kind() const { return m_kind; }
+
+    /// The contents of a STRING value, unescaped
+    std::string_view str() const { return {m_str, m_len}; }
+
+    /// Whether the token follows the JSON number grammar (which is stricter
+    /// than that of e.g. std::from_chars(), rejecting `.5` or `01`)
+    static bool is_number(const char *s, size_t n);
+
+    /// Whether the two values are equal. Values of different kinds never are
+    bool equals(const Scalar& other) const;
+
+    /// Whether the two values may be ordered, i.e. are both strings or both
+    /// numbers
+    bool comparable(const Scalar& other) const {
+        return m_kind == other.m_kind && (m_kind == STRING || m_kind == NUMBER);
+    }
+
+    /// Compare two comparable() values: negative, zero or positive if this
+    /// value is less than, equal to, or greater than `other`. Strings are
+    /// ordered by their (UTF-8) bytes, i.e. by code point
+    int compare(const Scalar& other) const;
+
+private:
+    bool assign_string(const char *s, size_t n);
+    bool assign_number(const char *s, size_t n);
+
+    Kind m_kind = INVALID;
+    // Contents of a string, or the token of a number
+    const char *m_str = nullptr;
+    size_t m_len = 0;
+    std::string m_copy;
+    bool m_isint = false;
+    int64_t m_int = 0;
+    double m_double = 0;
+    bool m_bool = false;
+};
+
+/**
+ * Whether two JSON values are equal, as a JSON Patch `test` defines it
+ * (RFC 6902): primitives are compared as Scalar does (e.g. `1` is equal to
+ * `1.0`, and `"\u0041"` to `"A"`), arrays element by element, and objects
+ * member by member regardless of their order. Values which are not valid
+ * JSON are not equal to anything. Containers are scanned with `jsn`.
+ */
+bool json_equal(const Loc& a, const Loc& b, jsonsl_t jsn);
+
+/**
+ * A predicate on the value at a path in a document, e.g. `status == "active"`
+ * or `tags contains "x"`. The predicate is compiled once and may then be
+ * evaluated against any number of documents. Evaluation scans a document only
+ * as far as needed to decide it: up to the end of the value (or, for
+ * Op::CONTAINS, the first matching element), or up to the end of the parent
+ * if the value is missing.
+ *
+ * A missing value does not satisfy any predicate. Values of different kinds
+ * (see Scalar) are never equal, and only strings and numbers are ordered, so
+ * that `age >= 21` is false if `age` is a string.
+ */
+class Predicate {
+public:
+    enum Op {
+        EQ, //!< Equal to the literal
+        NE, //!< Present, but not equal to the literal
+        LT,
+        LE,
+        GT,
+        GE,
+        CONTAINS //!< An array containing a value equal to the literal
+    };
+
+    Predicate();
+    ~Predicate();
+    Predicate(const Predicate&) = delete;
+    Predicate& operator=(const Predicate&) = delete;
+
+    /**
+     * Compile a predicate. Neither the path nor the literal need remain valid
+     * afterwards.
+     * @param literal a JSON primitive, as it would appear in a document
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, or Error::VALUE_CANTINSERT if the literal is not a JSON primitive
+     */
+    Error compile(const char *pth, size_t npth, Op op,
+                  const char *literal, size_t nliteral);
+    Error compile(const std::string& pth, Op op, const std::string& literal) {
+        return compile(pth.c_str(), pth.size(), op,
+                       literal.c_str(), literal.size());
+    }
+
+    const Path& path() const { return *m_path; }
+    Op op() const { return m_op; }
+    const Scalar& literal() const { return m_literal; }
+
+    /// Whether `value` satisfies the predicate. For Op::CONTAINS, `value` is
+    /// an element of the array at the path
+    bool test(const Scalar& value) const;
+
+    /// Like test(), for a token from a document. Containers never satisfy a
+    /// predicate, except Op::NE
+    bool test(const char *value, size_t n) const;
+
+    /**
+     * Evaluate the predicate against a document.
+     * @param[out] result whether the document satisfies the predicate
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document could
+     *         not be parsed (as far as it was scanned)
+     */
+    Error eval(const char *doc, size_t n, jsonsl_t jsn, bool& result) const;
+    Error eval(const std::string& s, jsonsl_t jsn, bool& result) const {
+        return eval(s.c_str(), s.size(), jsn, result);
+    }
+    Error eval(Segments& doc, jsonsl_t jsn, bool& result) const;
+
+private:
+    Error eval(const char *doc, size_t n, Segments *segs, jsonsl_t jsn,
+               bool& result) const;
+
+    /* malloc'd because this block is pretty big (several k) */
+    Path *m_path;
+    Op m_op = EQ;
+    std::string m_path_buf;
+    Scalar m_literal;
+    std::string m_literal_buf;
+};
+
+/**
+ * A boolean expression combining several predicates, e.g.
+ * `type == "order" AND total > 100 AND NOT refunded == true`. All the
+ * predicates are evaluated in a single pass over a document, which ends as
+ * soon as the outcome of the whole expression is known: in the example, at
+ * `type` if it is not "order".
+ *
+ * The expression is built in postfix order; the example above is
+ *
+ * @code
+ * prog.add("type", Predicate::EQ, "\"order\"");
+ * prog.add("total", Predicate::GT, "100");
+ * prog.op_and();
+ * prog.add("refunded", Predicate::EQ, "true");
+ * prog.op_not();
+ * prog.op_and();
+ * @endcode
+ *
+ * Once built, a program may be evaluated against any number of documents
+ * without allocating memory (except to copy values which are split across
+ * the segments of a segmented document).
+ */
+class PredicateProgram : private MultiMatch::Listener {
+public:
+    /// Maximum number of instructions (predicates and operators)
+    static const size_t MAX_INSTRUCTIONS = 256;
+
+    PredicateProgram();
+    ~PredicateProgram() override;
+    PredicateProgram(const PredicateProgram&) = delete;
+    PredicateProgram& operator=(const PredicateProgram&) = delete;
+
+    /**
+     * Push a predicate (see Predicate::compile())
+     * @return Error::GLOBAL_ENOSUPPORT if the path contains negative array
+     *         indexes, or Error::PATH_E2BIG if the program is too long
+     */
+    Error add(const char *pth, size_t npth, Predicate::Op op,
+              const char *literal, size_t nliteral);
+    Error add(const std::string& pth, Predicate::Op op,
+              const std::string& literal) {
+        return add(pth.c_str(), pth.size(), op,
+                   literal.c_str(), literal.size());
+    }
+
+    /// Replace the two topmost operands with their conjunction, disjunction
+    /// or (for op_not(), the topmost operand with its) negation.
+    /// @return false if there are not enough operands, or the program is
+    ///         too long
+    bool op_and() { return push_op(AND, 2); }
+    bool op_or() { return push_op(OR, 2); }
+    bool op_not() { return push_op(NOT, 1); }
+
+    /// Whether the program consists of a single expression
+    bool valid() const { return m_depth == 1; }
+
+    /// Remove all instructions
+    void clear();
+
+    /**
+     * Evaluate the program (which must be valid()) against a document.
+     * @param[out] result the outcome of the expression
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document could
+     *         not be parsed (as far as it was scanned)
+     */
+    Error eval(const char *doc, size_t n, jsonsl_t jsn, bool& result);
+    Error eval(const std::string& s, jsonsl_t jsn, bool& result) {
+        return eval(s.c_str(), s.size(), jsn, result);
+    }
+    Error eval(Segments& doc, jsonsl_t jsn, bool& result);
+
+private:
+    enum Code { LEAF, AND, OR, NOT };
+    // Outcome of a predicate or expression, once known
+    enum Value : uint8_t { IS_FALSE, IS_TRUE, IS_UNKNOWN };
+
+    struct Instruction {
+        Code code;
+        size_t leaf;
+    };
+
+    struct Leaf {
+        std::unique_ptr<Predicate> pred;
+        size_t node; // In m_match
+    };
+
+    bool push_op(Code code, size_t nargs);
+    Value run() const;
+    Error eval(const char *doc, size_t n, Segments *segs, jsonsl_t jsn,
+               bool& result);
+
+    bool resolved(const MultiMatch& mm, size_t ix) override;
+    bool element(const MultiMatch& mm, size_t ix,
+                 const char *value, size_t nvalue) override;
+
+    std::vector<Instruction> m_program;
+    std::vector<Leaf> m_leaves;
+    std::vector<Value> m_values; // Per leaf, for the current document
+    size_t m_depth = 0; // Of the operand stack, once the program is run
+    MultiMatch m_match;
+    Segments *m_segs = nullptr; // The current document, if segmented
+    std::string m_copy;
+};
+
+} // namespace Subdoc
@@ -0,0 +1,118 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "projection.h"
+
+using namespace Subdoc;
+
+static const Loc loc_COMMA(",", 1);
+static const Loc loc_COLON(":", 1);
+static const Loc loc_OBRACE("{", 1);
+static const Loc loc_CBRACE("}", 1);
+static const Loc loc_OBRACKET("[", 1);
+static const Loc loc_CBRACKET("]", 1);
+
+Error
+Projection::add(const char *pth, size_t npth)
+{
+    Error status = m_batch.parse(pth, npth);
+    if (!status.success()) {
+        return status;
+    }
+    m_batch.add();
+    return Error::SUCCESS;
+}
+
+void
+Projection::clear()
+{
+    m_batch.clear();
+}
+
+static void
+append_loc(const Segments *segs, const Loc& loc, std::vector<Loc>& out)
+{
+    if (segs != nullptr) {
+        segs->slice(loc, out);
+    } else {
+        out.push_back(loc);
+    }
+}
+
+/**
+ * Append the projection of the node `ix`, which must have been found (or
+ * have found descendants), to `out`
+ */
+void
+Projection::emit(size_t ix, const Segments *segs, std::vector<Loc>& out) const
+{
+    const auto& node = match()[ix];
+    if (node.found) {
+        // The whole element is projected
+        append_loc(segs, node.loc, out);
+        return;
+    }
+
+    const bool is_object = node.type == JSONSL_T_OBJECT;
+    out.push_back(is_object ? loc_OBRACE : loc_OBRACKET);
+    bool first = true;
+    for (size_t cix = node.first_child; cix != MultiMatch::NONE;
+            cix = match()[cix].next_sibling) {
+        const auto& child = match()[cix];
+        if (!child.nfound) {
+            continue;
+        }
+        if (!first) {
+            out.push_back(loc_COMMA);
+        }
+        first = false;
+        if (is_object) {
+            append_loc(segs, child.loc_key, out);
+            out.push_back(loc_COLON);
+        }
+        emit(cix, segs, out);
+    }
+    out.push_back(is_object ? loc_CBRACE : loc_CBRACKET);
+}
+
+Error
+Projection::exec(const char *doc, size_t n, Segments *segs, Result& res)
+{
+    res.clear();
+    Error status = segs != nullptr ? m_batch.exec(*segs)
+                                   : m_batch.exec(doc, n);
+    if (!status.success()) {
+        return status;
+    }
+
+    if (match().root().nfound == 0 && match().root().type != JSONSL_T_LIST) {
+        // Nothing was found (or the root was not even seen)
+        res.m_newsegs.push_back(loc_OBRACE);
+        res.m_newsegs.push_back(loc_CBRACE);
+        return Error::SUCCESS;
+    }
+    emit(0, segs, res.m_newsegs);
+    return Error::SUCCESS;
+}
+
+Error
+Projection::exec(const char *doc, size_t n, Result& res)
+{
+    return exec(doc, n, nullptr, res);
+}
+
+Error
+Projection::exec(Segments& doc, Result& res)
+{
+    if (doc.contiguous() && !doc.has_more()) {
+        return exec(doc.begin(), doc.size(), nullptr, res);
+    }
+    return exec(doc.begin(), doc.size(), &doc, res);
+}
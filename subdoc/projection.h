@@ -0,0 +1,70 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "operations.h"
+#include "pathbatch.h"
+
+namespace Subdoc {
+
+/**
+ * Extracts several paths from a document into a new, smaller document,
+ * preserving their nesting. For example, projecting `a.b` and `c` from
+ *
+ * @code
+ * {"a":{"b":1,"x":2},"c":[3,4],"d":5}
+ * @endcode
+ *
+ * gives `{"a":{"b":1},"c":[3,4]}`. Paths which do not exist in the document
+ * are omitted, as are containers none of whose projected children exist.
+ * Array elements keep their relative order, but not their index: projecting
+ * `l[2]` from `{"l":[0,1,2]}` gives `{"l":[2]}`.
+ *
+ * The document is scanned once, for all the paths. Like the result of an
+ * Operation, the new document (Result::newdoc()) consists of segments of
+ * the original document, and of constant delimiters.
+ */
+class Projection {
+public:
+    /**
+     * Add a path to project. The path need not remain valid afterwards.
+     * @return Error::PATH_EINVAL or Error::PATH_E2BIG if the path cannot be
+     *         parsed, or Error::GLOBAL_ENOSUPPORT if it contains negative
+     *         array indexes
+     */
+    Error add(const char *pth, size_t npth);
+    Error add(const std::string& s) { return add(s.c_str(), s.size()); }
+
+    /// Remove all paths
+    void clear();
+
+    /**
+     * Project a document. The new document refers to both `doc` and `res`,
+     * which must remain valid while it is in use.
+     * @return Error::DOC_NOTJSON or Error::DOC_ETOODEEP if the document
+     *         could not be parsed
+     */
+    Error exec(const char *doc, size_t n, Result& res);
+    Error exec(const std::string& s, Result& res) {
+        return exec(s.c_str(), s.size(), res);
+    }
+    Error exec(Segments& doc, Result& res);
+
+    const MultiMatch& match() const { return m_batch.match(); }
+
+private:
+    Error exec(const char *doc, size_t n, Segments *segs, Result& res);
+    void emit(size_t ix, const Segments *segs, std::vector<Loc>& out) const;
+
+    PathBatch m_batch;
+};
+
+} // namespace Subdoc
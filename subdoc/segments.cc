@@ -0,0 +1,294 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#include "segments.h"
+#include "docsource.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+using namespace Subdoc;
+
+void
+Segments::assign(const char *s, size_t n)
+{
+    m_segs.resize(1);
+    m_segs[0].assign(s, n);
+    m_size = n;
+    m_source = nullptr;
+    m_partial = false;
+}
+
+void
+Segments::assign(Buffer<Loc> segs)
+{
+    m_segs.clear();
+    m_size = 0;
+    m_source = nullptr;
+    m_partial = false;
+    for (const auto& seg : segs) {
+        if (!seg.empty()) {
+            m_segs.push_back(seg);
+            m_size += seg.length;
+        }
+    }
+    if (m_segs.empty()) {
+        m_segs.emplace_back();
+    }
+    if (contiguous()) {
+        return;
+    }
+
+    index_segments();
+
+    // Find segments whose memory overlaps that of another one; they need to
+    // be copied so that an address identifies a single position
+    std::vector<size_t> shared;
+    size_t nshared = 0;
+    const char *maxend = nullptr;
+    std::less<const char*> lt;
+    for (auto ix : m_byaddr) {
+        const Loc& seg = m_segs[ix];
+        if (maxend != nullptr && lt(seg.at, maxend)) {
+            shared.push_back(ix);
+            nshared += seg.length;
+        } else {
+            maxend = seg.at + seg.length;
+        }
+    }
+    if (shared.empty()) {
+        return;
+    }
+
+    m_copies.resize(nshared);
+    char *dst = m_copies.data();
+    for (auto ix : shared) {
+        Loc& seg = m_segs[ix];
+        std::memcpy(dst, seg.at, seg.length);
+        seg.at = dst;
+        dst += seg.length;
+    }
+    index_segments();
+}
+
+void
+Segments::assign(const Segments& other, size_t off, size_t n)
+{
+    Expects(off + n <= other.size());
+    if (other.contiguous()) {
+        assign(other.begin() + off, n);
+        return;
+    }
+
+    m_segs.clear();
+    m_size = n;
+    m_source = nullptr;
+    m_partial = false;
+    const char *p = other.pointer_at(off);
+    while (n) {
+        const Loc& seg = other.m_segs[other.find(p)];
+        size_t avail = seg.length - (p - seg.at);
+        avail = std::min(avail, n);
+        m_segs.emplace_back(p, avail);
+        n -= avail;
+        off += avail;
+        p = other.pointer_at(off);
+    }
+    if (m_segs.empty()) {
+        m_segs.emplace_back();
+    }
+    if (!contiguous()) {
+        index_segments();
+    }
+}
+
+void
+Segments::assign(DocSource& src)
+{
+    assign(nullptr, 0);
+    m_source = &src;
+}
+
+void
+Segments::assign_partial()
+{
+    assign(nullptr, 0);
+    m_partial = true;
+}
+
+bool
+Segments::pull()
+{
+    if (m_source == nullptr) {
+        return false;
+    }
+    const Loc chunk = m_source->next();
+    if (chunk.empty()) {
+        m_source = nullptr;
+        return false;
+    }
+    append(chunk);
+    return true;
+}
+
+void
+Segments::append(const Loc& chunk)
+{
+    if (chunk.empty()) {
+        return;
+    }
+
+    Loc& last = m_segs.back();
+    if (m_size == 0) {
+        last = chunk;
+    } else if (last.at + last.length == chunk.at) {
+        // Adjacent in memory (e.g. consecutive chunks of a mapped file); a
+        // single segment covers both
+        last.length += chunk.length;
+    } else if (contiguous()) {
+        m_segs.push_back(chunk);
+        index_segments();
+    } else {
+        std::less<const char*> lt;
+        m_segs.push_back(chunk);
+        m_offsets.push_back(m_size);
+        auto pos = std::upper_bound(m_byaddr.begin(), m_byaddr.end(),
+            chunk.at, [&](const char *ptr, size_t ix) {
+                return lt(ptr, m_segs[ix].at);
+            });
+        m_byaddr.insert(pos, m_segs.size() - 1);
+    }
+    m_size += chunk.length;
+}
+
+void
+Segments::index_segments()
+{
+    m_offsets.resize(m_segs.size());
+    m_byaddr.resize(m_segs.size());
+    size_t off = 0;
+    for (size_t ii = 0; ii < m_segs.size(); ++ii) {
+        m_offsets[ii] = off;
+        m_byaddr[ii] = ii;
+        off += m_segs[ii].length;
+    }
+    std::sort(m_byaddr.begin(), m_byaddr.end(), [this](size_t a, size_t b) {
+        return std::less<const char*>()(m_segs[a].at, m_segs[b].at);
+    });
+}
+
+size_t
+Segments::find(const char *p) const
+{
+    std::less<const char*> lt;
+    // First segment beginning after p; p is in the one before it
+    auto it = std::upper_bound(m_byaddr.begin(), m_byaddr.end(), p,
+        [&](const char *ptr, size_t ix) { return lt(ptr, m_segs[ix].at); });
+    if (it == m_byaddr.begin()) {
+        return m_segs.size();
+    }
+    const Loc& seg = m_segs[*--it];
+    if (!lt(p, seg.at + seg.length)) {
+        return m_segs.size();
+    }
+    return *it;
+}
+
+const char *
+Segments::pointer_at_slow(size_t off) const
+{
+    if (off >= m_size) {
+        const Loc& last = m_segs.back();
+        return last.at + last.length;
+    }
+    auto it = std::upper_bound(m_offsets.begin(), m_offsets.end(), off);
+    const size_t ix = (it - m_offsets.begin()) - 1;
+    return m_segs[ix].at + (off - m_offsets[ix]);
+}
+
+Loc
+Segments::segment_from(size_t off) const
+{
+    if (contiguous()) {
+        return Loc(begin() + off, m_size - off);
+    }
+    auto it = std::upper_bound(m_offsets.begin(), m_offsets.end(), off);
+    const size_t ix = (it - m_offsets.begin()) - 1;
+    const Loc& seg = m_segs[ix];
+    const size_t skip = off - m_offsets[ix];
+    return Loc(seg.at + skip, seg.length - skip);
+}
+
+bool
+Segments::spans(const Loc& loc) const
+{
+    if (contiguous() || loc.empty()) {
+        return false;
+    }
+    const size_t ix = find(loc.at);
+    if (ix == m_segs.size()) {
+        return false;
+    }
+    const Loc& seg = m_segs[ix];
+    return loc.length > seg.length - (loc.at - seg.at);
+}
+
+template <typename F>
+void
+Segments::for_each_part(const Loc& loc, F&& fn) const
+{
+    size_t ix = find(loc.at);
+    const char *p = loc.at;
+    size_t remaining = loc.length;
+    while (remaining) {
+        const Loc& seg = m_segs[ix++];
+        const size_t n = std::min(remaining, seg.length - (p - seg.at));
+        fn(p, n);
+        remaining -= n;
+        if (ix < m_segs.size()) {
+            p = m_segs[ix].at;
+        }
+    }
+}
+
+void
+Segments::slice(const Loc& loc, std::vector<Loc>& out) const
+{
+    if (!spans(loc)) {
+        out.push_back(loc);
+        return;
+    }
+    for_each_part(loc, [&](const char *p, size_t n) {
+        out.emplace_back(p, n);
+    });
+}
+
+void
+Segments::copy(const Loc& loc, std::string& out) const
+{
+    out.clear();
+    if (!spans(loc)) {
+        out.append(loc.at, loc.length);
+        return;
+    }
+    for_each_part(loc, [&](const char *p, size_t n) {
+        out.append(p, n);
+    });
+}
+
+Loc
+Segments::flatten(const Loc& loc, std::string& buf) const
+{
+    if (!spans(loc)) {
+        return loc;
+    }
+    copy(loc, buf);
+    return Loc(buf.data(), buf.size());
+}
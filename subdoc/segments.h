@@ -0,0 +1,195 @@
+/*
+ *     Copyright 2015-Present Couchbase, Inc.
+ *
+ *   Use of this software is governed by the Business Source License included
+ *   in the file licenses/BSL-Couchbase.txt.  As of the Change Date specified
+ *   in that file, in accordance with the Business Source License, use of this
+ *   software will be governed by the Apache License, Version 2.0, included in
+ *   the file licenses/APL2.txt.
+ */
+
+#pragma once
+
+#include "loc.h"
+#include <gsl/gsl-lite.hpp>
+#include <string>
+#include <vector>
+
+namespace Subdoc {
+
+class DocSource;
+
+/**
+ * A document which may consist of several discontiguous segments (for
+ * example, a chain of storage blocks, or the output of a previous
+ * operation, see Result::newdoc()). The segments are addressed as a single
+ * buffer: an _offset_ is a position within the logical document.
+ *
+ * Locations within a segmented document are described using a Loc whose
+ * `at` field points to the first byte (within whichever segment it happens
+ * to be in), and whose `length` is the logical length, which may extend
+ * past the end of that segment. Such a location must not be dereferenced
+ * directly, but may be converted with slice() or copy(); spans() tells
+ * whether this is needed at all.
+ *
+ * Neither the segment list nor the segments themselves are copied; both must
+ * remain valid for as long as this object refers to them. The only exception
+ * is when several segments share the same memory (e.g. a constant token
+ * which appears more than once): all but one of them are then copied so
+ * that every byte of the document has a distinct address.
+ *
+ * A document may also be read lazily from a DocSource, or be received
+ * incrementally; it then only contains the chunks read or received so far.
+ */
+class Segments {
+public:
+    Segments() : m_segs(1) {}
+    Segments(const Segments&) = delete;
+    Segments& operator=(const Segments&) = delete;
+
+    /// Use a single contiguous buffer
+    void assign(const char *s, size_t n);
+    /// Use a list of segments, in document order
+    void assign(Buffer<Loc> segs);
+    /// Use the region [off, off+n) of another document
+    void assign(const Segments& other, size_t off, size_t n);
+    /// Read the document from `src`. Initially the document is empty; its
+    /// contents are read by pull()
+    void assign(DocSource& src);
+
+    /// Begin a document which is received incrementally. Initially the
+    /// document is empty; its contents are added by append(), and finish()
+    /// is called once all of it has been received
+    void assign_partial();
+
+    /// Append a chunk to the document. The chunk is not copied
+    void append(const Loc& chunk);
+    void append(const char *s, size_t n) { append(Loc(s, n)); }
+
+    /// Indicate that the whole document has been appended
+    void finish() { m_partial = false; }
+
+    /// Whether more of the document is yet to be appended
+    bool partial() const { return m_partial; }
+
+    /// Whether more of the document may be pulled from its source
+    bool has_more() const { return m_source != nullptr; }
+
+    /// Append the next chunk from the source to the document.
+    /// @return false if the end of the document was reached
+    bool pull();
+
+    /// Pull the remainder of the document from its source
+    void pull_all() {
+        while (pull()) {
+        }
+    }
+
+    /// Whether the document is a single contiguous buffer
+    bool contiguous() const { return m_segs.size() == 1; }
+
+    /// Total length of the document
+    size_t size() const { return m_size; }
+
+    /// Number of segments in the document
+    size_t count() const { return m_segs.size(); }
+    const Loc& segment(size_t ix) const { return m_segs[ix]; }
+
+    /// Pointer to the first byte of the document
+    const char *begin() const { return m_segs.front().at; }
+
+    /// Offset of `p`, which must point to a byte within the document
+    size_t offset_of(const char *p) const {
+        if (contiguous()) {
+            return p - begin();
+        }
+        const size_t ix = find(p);
+        Expects(ix < m_segs.size());
+        return m_offsets[ix] + (p - m_segs[ix].at);
+    }
+
+    /// Pointer to the byte at `off`. If `off` is the size of the document,
+    /// the pointer is one past its last byte.
+    const char *pointer_at(size_t off) const {
+        if (contiguous()) {
+            return begin() + off;
+        }
+        return pointer_at_slow(off);
+    }
+
+    char at(size_t off) const { return *pointer_at(off); }
+
+    /// The part of the segment containing `off` which begins at `off`
+    Loc segment_from(size_t off) const;
+
+    /// Whether `loc` begins in the document, and extends past the segment
+    /// it begins in
+    bool spans(const Loc& loc) const;
+
+    /// Append the segments making up `loc` to `out`. If `loc` is not part
+    /// of the document, it is appended as-is
+    void slice(const Loc& loc, std::vector<Loc>& out) const;
+
+    /// Copy the contents of `loc` into `out`
+    void copy(const Loc& loc, std::string& out) const;
+
+    /// `loc` itself if it may be dereferenced (see spans()), otherwise a
+    /// copy of its contents made in `buf`
+    Loc flatten(const Loc& loc, std::string& buf) const;
+
+private:
+    /// Index of the segment containing `p`, or count() if none does
+    size_t find(const char *p) const;
+    template <typename F>
+    void for_each_part(const Loc& loc, F&& fn) const;
+    const char *pointer_at_slow(size_t off) const;
+    void index_segments();
+
+    std::vector<Loc> m_segs; // Non-empty segments in document order
+    std::vector<size_t> m_offsets; // Offset of each segment
+    std::vector<size_t> m_byaddr; // Segment indexes, ordered by address
+    std::string m_copies; // Storage for segments whose memory was shared
+    size_t m_size = 0;
+    DocSource *m_source = nullptr;
+    bool m_partial = false;
+};
+
+inline void
+Loc::end_at_begin(const Segments& base, const Loc& until, OverlapMode overlap)
+{
+    at = base.begin();
+    length = base.offset_of(until.at);
+    if (overlap == OVERLAP) {
+        length++;
+    }
+}
+
+inline void
+Loc::begin_at_end(const Segments& base, const Loc& from, OverlapMode overlap)
+{
+    size_t off = base.offset_of(from.at) + from.length;
+    if (overlap == OVERLAP) {
+        off--;
+    }
+    at = base.pointer_at(off);
+    length = base.size() - off;
+}
+
+inline void
+Loc::begin_at_begin(const Segments& base, const Loc& from)
+{
+    at = from.at;
+    length = base.size() - base.offset_of(from.at);
+}
+
+inline void
+Loc::end_at_end(const Segments& base, const Loc& until, OverlapMode overlap)
+{
+    at = base.begin();
+    length = base.offset_of(until.at) + until.length;
+    if (overlap == NO_OVERLAP) {
+        length--;
+    }
+}
+
+} // namespace Subdoc
@@ -53,7 +53,15 @@ public:
         VALUE_ETOODEEP,
 
         /* MEMCACHED ERROR CODES */
-        GLOBAL_ENOSUPPORT,
+        GLOBAL_ENOSUPPORT = 15,
+
+        /* Codes are appended here, so that existing ones keep their values */
+
+        /** More of the document must be received to complete the operation */
+        NEED_MORE,
+
+        /** The value at the path is not equal to the expected value */
+        VALUE_MISMATCH,
     };
 
     Code m_code;
@@ -151,7 +159,13 @@ public:
         /**Adds a value to a list, ensuring that the value does not already exist.
          * Values added can only be primitives, and the list itself must already
          * only contain primitives. If any of these is violated, the error
-         * SUBDOC_PATH_MISMATCH is returned. */
+         * SUBDOC_PATH_MISMATCH is returned.
+         *
+         * Several (distinct) values may be given, separated by commas; the
+         * list is then scanned once for all of them, and only those not
+         * already present are appended. The match is an array of booleans
+         * telling which of the values were added. SUBDOC_DOC_EEXISTS is
+         * returned if none were. */
         ARRAY_ADD_UNIQUE = 0x08,
         ARRAY_ADD_UNIQUE_P = 0x88,
 
@@ -167,6 +181,10 @@ public:
          * If the resulting item does exist, but is not a signed or unsigned integer,
          * then a SUBDOC_PATH_MISMATCH error is returned. This is the case for
          * 'floats' and 'exponents' as well. Only whole integers are supported.
+         *
+         * The result may instead be clamped to bounds, and a missing counter
+         * created with an initial value; see Operation::set_counter_bounds()
+         * and Operation::set_counter_initial().
          */
         COUNTER = 0x0A,
         COUNTER_P = 0x8A,
@@ -177,6 +195,62 @@ public:
          */
         GET_COUNT = 0x0B,
 
+        /**
+         * Merges the value into the element at the path, as described by
+         * RFC 7386 (JSON Merge Patch). If the value is an object, each of
+         * its members replaces (or, if an object itself, is merged into) the
+         * member of the same name, or is appended if there is none; members
+         * whose value is `null` are removed. Any other value replaces the
+         * element. The element must exist, and is scanned only once.
+         */
+        DICT_MERGE = 0x0C,
+
+        /**
+         * Appends the value(s) to the array at the path, then drops the
+         * oldest elements so that at most Operation::set_limit() remain
+         * (including appended values beyond the limit). The array is
+         * scanned only once, both to append and to find where it is cut.
+         */
+        ARRAY_APPEND_CAPPED = 0x0D,
+
+        /**
+         * Removes the first (or last) element of the array at the path. The
+         * removed element is returned as the match, and the document
+         * without it as the new document, from a single match of `[0]` (or
+         * `[-1]`) within the array.
+         */
+        ARRAY_POP_FIRST = 0x0E,
+        ARRAY_POP_LAST = 0x0F,
+
+        /**
+         * Removes every element of the array at the path which is equal to
+         * the value, compared as for ARRAY_ADD_UNIQUE. The value must be a
+         * single primitive; elements which are containers are kept. The
+         * number of elements removed is returned as the match.
+         */
+        ARRAY_REMOVE_VALUE = 0x10,
+
+        /**
+         * Like COUNTER, but the delta and the existing number may be any
+         * JSON numbers (including fractions and exponents), which are added
+         * as doubles. The new value is written in the shortest form which
+         * reads back as the same double. If the result is not finite,
+         * SUBDOC_DELTA_OVERFLOW is returned.
+         */
+        COUNTER_FLOAT = 0x11,
+        COUNTER_FLOAT_P = 0x91,
+
+        /**
+         * Like REPLACE, but only if the existing value is equal to the one
+         * given by Operation::set_expected(), either byte for byte or
+         * structurally (ignoring member order and number spelling, as a
+         * JSON Patch `test` does). The comparison is made on the value
+         * found by the match, so the document is still scanned only once.
+         * Otherwise, SUBDOC_VALUE_MISMATCH is returned and the document is
+         * unchanged.
+         */
+        REPLACE_IF = 0x12,
+
         INVALID = 0xff,
         FLAG_MKDIR_P = 0x80
     };
@@ -191,6 +265,11 @@ public:
     /// Return the base command (with any modifiers stripped)
     Code base() const { return static_cast<Code>(code & ~FLAG_MKDIR_P); }
 
+    /// Whether the command only reads the document
+    bool is_lookup() const {
+        return code == GET || code == EXISTS || code == GET_COUNT;
+    }
+
 };
 /**@}*/
 } // namespace Subdoc
@@ -44,6 +44,36 @@ public:
     static jsonsl_type_t get_root_type(Command command, const std::string& s) {
         return get_root_type(command, s.c_str(), s.size());
     }
+
+    /// Whether `c` is insignificant whitespace. RFC 7159 allows space,
+    /// horizontal tab, line feed and carriage return.
+    static bool is_json_ws(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    /// Maps the return value of Path::parse() (or Path::parse_pointer())
+    /// @return Error::PATH_E2BIG if the path has too many components,
+    ///     Error::PATH_EINVAL if it is otherwise invalid
+    static Error path_status(int rv) {
+        if (rv == 0) {
+            return Error::SUCCESS;
+        } else if (rv == JSONSL_ERROR_LEVELS_EXCEEDED) {
+            return Error::PATH_E2BIG;
+        }
+        return Error::PATH_EINVAL;
+    }
+
+    /// Maps the parser status of a scan of the document
+    /// @return Error::DOC_ETOODEEP if the document is nested too deeply,
+    ///     Error::DOC_NOTJSON if it is otherwise invalid
+    static Error doc_status(int status) {
+        if (status == JSONSL_ERROR_SUCCESS) {
+            return Error::SUCCESS;
+        } else if (status == JSONSL_ERROR_LEVELS_EXCEEDED) {
+            return Error::DOC_ETOODEEP;
+        }
+        return Error::DOC_NOTJSON;
+    }
 private:
     Util();
 };
@@ -8,6 +8,9 @@
  *   the file licenses/APL2.txt.
  */
 #include "subdoc-tests-common.h"
+#include "subdoc/docindex.h"
+#include "subdoc/predicate.h"
+#include "subdoc/segments.h"
 
 using namespace Subdoc;
 
@@ -256,3 +259,441 @@ TEST_F(MatchTests, testMatchUnique) {
     ASSERT_FALSE(m.unique_item_found);
     ASSERT_NE(0U, m.num_children);
 }
+
+TEST_F(MatchTests, testIndexedMiss) {
+    // Build a document with a wide object, and a narrow one which should not
+    // be indexed.
+    std::string doc = R"({"narrow":{"a":1},"wide":{)";
+    for (int ii = 0; ii < 32; ii++) {
+        if (ii) {
+            doc += ",";
+        }
+        doc += "\"key" + std::to_string(ii) + "\":" + std::to_string(ii);
+    }
+    doc += "}}";
+
+    DocIndex index;
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, index.build(doc, jsn, 16));
+    ASSERT_EQ(1U, index.size());
+
+    // A missing key is resolved without scanning, and yields the parent
+    pth.parse("wide.missing");
+    m.index = &index;
+    m.exec_match(doc, pth, jsn);
+    ASSERT_NE(JSONSL_MATCH_COMPLETE, m.matchres);
+    ASSERT_TRUE(m.index_resolved);
+    ASSERT_TRUE(m.immediate_parent_found);
+    ASSERT_EQ(JSONSL_T_OBJECT, m.type);
+    ASSERT_EQ(32U, m.num_siblings);
+    ASSERT_EQ(2U, m.match_level);
+    ASSERT_EQ('{', m.loc_deepest.at[0]);
+    ASSERT_EQ('}', m.loc_deepest.at[m.loc_deepest.length - 1]);
+
+    // Compare against what a scan would have found
+    Match scanned;
+    scanned.exec_match(doc, pth, jsn);
+    ASSERT_FALSE(scanned.index_resolved);
+    ASSERT_EQ(scanned.matchres, m.matchres);
+    ASSERT_EQ(scanned.num_siblings, m.num_siblings);
+    ASSERT_EQ(scanned.match_level, m.match_level);
+    ASSERT_EQ(Util::match_parent(scanned), Util::match_parent(m));
+
+    // Existing keys must still be found
+    m.clear();
+    m.index = &index;
+    pth.parse("wide.key31");
+    m.exec_match(doc, pth, jsn);
+    ASSERT_EQ(JSONSL_MATCH_COMPLETE, m.matchres);
+    ASSERT_EQ("31", Util::match_match(m));
+
+    // Objects below the threshold are not indexed, and are scanned
+    m.clear();
+    m.index = &index;
+    pth.parse("narrow.missing");
+    m.exec_match(doc, pth, jsn);
+    ASSERT_FALSE(m.index_resolved);
+    ASSERT_TRUE(m.immediate_parent_found);
+
+    // The index is ignored for a different buffer
+    std::string copy = doc;
+    m.clear();
+    m.index = &index;
+    pth.parse("wide.missing");
+    m.exec_match(copy, pth, jsn);
+    ASSERT_FALSE(m.index_resolved);
+    ASSERT_TRUE(m.immediate_parent_found);
+}
+
+TEST_F(MatchTests, testMultiMatch) {
+    MultiMatch mm;
+    std::vector<size_t> ixs;
+    for (auto path : {"sublist[1]", "subdict.subkey1", "key1", "missing",
+                      "subdict.missing", "key1", "U-Escape", "numbers"}) {
+        pth.clear();
+        ASSERT_EQ(0, pth.parse(path)) << path;
+        ixs.push_back(mm.add(pth));
+    }
+    ASSERT_EQ(ixs[2], ixs[5]);
+
+    mm.exec_match(json, jsn);
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, mm.status);
+    ASSERT_EQ(0, mm.remaining());
+    ASSERT_EQ(R"("elem2")", mm[ixs[0]].loc.to_string());
+    ASSERT_EQ(R"("subval1")", mm[ixs[1]].loc.to_string());
+    ASSERT_EQ(R"("subkey1")", mm[ixs[1]].loc_key.to_string());
+    ASSERT_EQ(R"("val1")", mm[ixs[2]].loc.to_string());
+    ASSERT_FALSE(mm[ixs[3]].found);
+    ASSERT_FALSE(mm[ixs[4]].found);
+    ASSERT_EQ("null", mm[ixs[6]].loc.to_string());
+    ASSERT_EQ(JSONSL_T_LIST, mm[ixs[7]].type);
+    ASSERT_EQ(10, mm[ixs[7]].num_children);
+    ASSERT_EQ(5, mm.root().nfound);
+
+    // The scan stops once every path is resolved
+    mm.clear();
+    pth.clear();
+    pth.parse("key1");
+    size_t ix = mm.add(pth);
+    std::string truncated = json.substr(0, json.find("subdict"));
+    mm.exec_match(truncated, jsn);
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, mm.status);
+    ASSERT_TRUE(mm[ix].found);
+    ASSERT_EQ(R"("val1")", mm[ix].loc.to_string());
+}
+
+TEST_F(MatchTests, testPredicate) {
+    const std::string doc = R"({"status":"active","age":21,"score":2.5e1,)"
+                            R"("tags":["x",{"y":1},"z\"",7.0],"ok":true,)"
+                            R"("big":9007199254740993,"none":null})";
+    struct {
+        const char *path;
+        Predicate::Op op;
+        const char *literal;
+        bool expected;
+    } cases[] = {
+            {"status", Predicate::EQ, R"("active")", true},
+            {"status", Predicate::NE, R"("active")", false},
+            {"status", Predicate::LT, R"("b")", true},
+            {"status", Predicate::GT, "1", false},
+            {"age", Predicate::GE, "21", true},
+            {"age", Predicate::GT, "21", false},
+            {"age", Predicate::EQ, "2.1e1", true},
+            {"age", Predicate::EQ, R"("21")", false},
+            {"age", Predicate::NE, R"("21")", true},
+            {"score", Predicate::LE, "25", true},
+            {"score", Predicate::LT, "25", false},
+            {"big", Predicate::GT, "9007199254740992", true},
+            {"ok", Predicate::EQ, "true", true},
+            {"ok", Predicate::GE, "true", false},
+            {"none", Predicate::EQ, "null", true},
+            {"tags", Predicate::CONTAINS, R"("x")", true},
+            {"tags", Predicate::CONTAINS, R"("z\"")", true},
+            {"tags", Predicate::CONTAINS, "7", true},
+            {"tags", Predicate::CONTAINS, R"("y")", false},
+            {"tags[-1]", Predicate::EQ, "7", true},
+            {"tags[1]", Predicate::NE, "1", true},
+            {"age", Predicate::CONTAINS, "21", false},
+            {"missing", Predicate::NE, "1", false},
+            {"tags.x", Predicate::EQ, R"("x")", false},
+    };
+
+    Predicate pred;
+    Segments segs;
+    std::vector<Loc> chunks;
+    for (size_t ii = 0; ii < doc.size(); ii += 2) {
+        chunks.emplace_back(doc.c_str() + ii, std::min<size_t>(2, doc.size() - ii));
+    }
+    segs.assign(Buffer<Loc>(chunks.data(), chunks.size()));
+
+    for (const auto& c : cases) {
+        ASSERT_EQ(Error::SUCCESS, pred.compile(c.path, c.op, c.literal))
+                << c.path << " " << c.literal;
+        bool result = !c.expected;
+        ASSERT_EQ(Error::SUCCESS, pred.eval(doc, jsn, result));
+        ASSERT_EQ(c.expected, result) << c.path << " " << c.literal;
+
+        result = !c.expected;
+        ASSERT_EQ(Error::SUCCESS, pred.eval(segs, jsn, result));
+        ASSERT_EQ(c.expected, result) << c.path << " " << c.literal;
+    }
+
+    // The scan stops once the predicate is decided
+    bool result = false;
+    ASSERT_EQ(Error::SUCCESS,
+              pred.compile("tags", Predicate::CONTAINS, R"("x")"));
+    std::string partial = doc.substr(0, doc.find("{\"y\""));
+    ASSERT_EQ(Error::SUCCESS, pred.eval(partial, jsn, result));
+    ASSERT_TRUE(result);
+
+    ASSERT_EQ(Error::VALUE_CANTINSERT,
+              pred.compile("age", Predicate::EQ, "[1]"));
+    ASSERT_EQ(Error::VALUE_CANTINSERT,
+              pred.compile("age", Predicate::EQ, "01"));
+    ASSERT_EQ(Error::VALUE_CANTINSERT,
+              pred.compile("age", Predicate::EQ, R"("\x")"));
+    ASSERT_EQ(Error::PATH_EINVAL, pred.compile("a..b", Predicate::EQ, "1"));
+}
+
+TEST_F(MatchTests, testPredicateProgram) {
+    const std::string order = R"({"type":"order","total":150,)"
+                              R"("items":["a","b"],"refunded":false})";
+    PredicateProgram prog;
+    ASSERT_EQ(Error::SUCCESS, prog.add("type", Predicate::EQ, R"("order")"));
+    ASSERT_EQ(Error::SUCCESS, prog.add("total", Predicate::GT, "100"));
+    ASSERT_TRUE(prog.op_and());
+    ASSERT_EQ(Error::SUCCESS, prog.add("refunded", Predicate::EQ, "true"));
+    ASSERT_TRUE(prog.op_not());
+    ASSERT_TRUE(prog.op_and());
+    ASSERT_EQ(Error::SUCCESS,
+              prog.add("items", Predicate::CONTAINS, R"("b")"));
+    ASSERT_EQ(Error::SUCCESS, prog.add("missing", Predicate::EQ, "1"));
+    ASSERT_TRUE(prog.op_or());
+    ASSERT_TRUE(prog.op_and());
+    ASSERT_TRUE(prog.valid());
+
+    bool result = false;
+    ASSERT_EQ(Error::SUCCESS, prog.eval(order, jsn, result));
+    ASSERT_TRUE(result);
+
+    // Segmented input
+    std::vector<Loc> chunks;
+    for (size_t ii = 0; ii < order.size(); ii += 3) {
+        chunks.emplace_back(order.c_str() + ii,
+                            std::min<size_t>(3, order.size() - ii));
+    }
+    Segments segs;
+    segs.assign(Buffer<Loc>(chunks.data(), chunks.size()));
+    result = false;
+    ASSERT_EQ(Error::SUCCESS, prog.eval(segs, jsn, result));
+    ASSERT_TRUE(result);
+
+    result = true;
+    ASSERT_EQ(Error::SUCCESS,
+              prog.eval(R"({"type":"order","total":150,"items":["a"],)"
+                        R"("refunded":false})",
+                        jsn, result));
+    ASSERT_FALSE(result);
+
+    result = true;
+    ASSERT_EQ(Error::SUCCESS,
+              prog.eval(R"({"total":150,"refunded":true,"type":"order",)"
+                        R"("items":["b"]})",
+                        jsn, result));
+    ASSERT_FALSE(result);
+
+    // The first conjunct decides the outcome, so the scan stops there: the
+    // rest of the document is never parsed
+    result = true;
+    ASSERT_EQ(Error::SUCCESS,
+              prog.eval(R"({"type":"refund","total":]]]})", jsn, result));
+    ASSERT_FALSE(result);
+
+    // Only "type" is known, so the document must be parsed further
+    ASSERT_EQ(Error::DOC_NOTJSON,
+              prog.eval(R"({"type":"order","total":]]]})", jsn, result));
+
+    // CONTAINS only looks at the elements of an array, as Predicate does
+    prog.clear();
+    ASSERT_EQ(Error::SUCCESS, prog.add("o", Predicate::CONTAINS, "1"));
+    result = true;
+    ASSERT_EQ(Error::SUCCESS, prog.eval(R"({"o":{"k":1}})", jsn, result));
+    ASSERT_FALSE(result);
+    ASSERT_EQ(Error::SUCCESS, prog.eval(R"({"o":[2,1]})", jsn, result));
+    ASSERT_TRUE(result);
+
+    // Malformed programs
+    prog.clear();
+    ASSERT_FALSE(prog.op_not());
+    ASSERT_EQ(Error::SUCCESS, prog.add("a", Predicate::EQ, "1"));
+    ASSERT_FALSE(prog.op_and());
+    ASSERT_TRUE(prog.valid());
+    ASSERT_EQ(Error::SUCCESS, prog.add("b", Predicate::EQ, "1"));
+    ASSERT_FALSE(prog.valid());
+    ASSERT_EQ(Error::GLOBAL_ENOSUPPORT,
+              prog.add("c[-1]", Predicate::EQ, "1"));
+}
+
+TEST_F(MatchTests, testMatchIterator) {
+    const std::string doc = "{"
+            JQ("items") ":["
+                "{" JQ("sku") ":" JQ("a1") "," JQ("qty") ":1},"
+                "{" JQ("qty") ":2},"
+                "{" JQ("sku") ":{" JQ("id") ":7}},"
+                "[" JQ("sku") "],"
+                "{" JQ("sku") ":" JQ("d4") "}"
+            "],"
+            JQ("meta") ":{" JQ("x") ":1," JQ("y") ":[2]}"
+        "}";
+
+    auto collect = [&](const char *path, size_t chunk_size) {
+        EXPECT_EQ(0, pth.parse_wildcard(path));
+        std::vector<std::string> found;
+        MatchIterator it;
+        it.begin(doc.data(), doc.size(), &pth, jsn, chunk_size);
+        while (it.next()) {
+            found.push_back(it.item().loc.to_string());
+        }
+        EXPECT_EQ(JSONSL_ERROR_SUCCESS, it.status);
+        return found;
+    };
+
+    // Matches are yielded in document order, regardless of how the document
+    // is split into chunks
+    const std::vector<std::string> skus = {
+            JQ("a1"), "{" JQ("id") ":7}", JQ("d4")};
+    for (size_t chunk_size : {size_t(1), size_t(7), doc.size()}) {
+        ASSERT_EQ(skus, collect("items[*].sku", chunk_size));
+    }
+
+    std::vector<std::string> exp = {"1", "[2]"};
+    ASSERT_EQ(exp, collect("meta.*", 3));
+    exp = {"{" JQ("qty") ":2}", "{" JQ("sku") ":{" JQ("id") ":7}}"};
+    ASSERT_EQ(exp, collect("items[1:3]", 5));
+    exp = {JQ("d4")};
+    ASSERT_EQ(exp, collect("items[3:].sku", 5));
+    exp = {"7"};
+    ASSERT_EQ(exp, collect("items[2].sku.id", 5));
+    ASSERT_TRUE(collect("items[9:]", 5).empty());
+
+    // The position and key of each match are reported
+    ASSERT_EQ(0, pth.parse_wildcard("meta.*"));
+    MatchIterator it;
+    it.begin(doc.data(), doc.size(), &pth, jsn, 4);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(JQ("x"), it.item().loc_key.to_string());
+    ASSERT_EQ(0UL, it.item().position);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ(JQ("y"), it.item().loc_key.to_string());
+    ASSERT_EQ(JSONSL_T_LIST, it.item().type);
+    ASSERT_EQ(1UL, it.item().position);
+    ASSERT_FALSE(it.next());
+
+    // A segmented document
+    Segments segs;
+    const Loc parts[] = {Loc(doc.data(), 20),
+                         Loc(doc.data() + 20, doc.size() - 20)};
+    segs.assign(Buffer<Loc>(parts, 2));
+    ASSERT_EQ(0, pth.parse_wildcard("items[*].sku"));
+    it.begin(segs, &pth, jsn);
+    std::vector<std::string> found;
+    while (it.next()) {
+        std::string s;
+        segs.copy(it.item().loc, s);
+        found.push_back(s);
+    }
+    ASSERT_EQ(skus, found);
+
+    // An invalid document ends the scan with an error, after any matches
+    // found before the error
+    const std::string bad = "[1,2,}";
+    ASSERT_EQ(0, pth.parse_wildcard("[*]"));
+    it.begin(bad.data(), bad.size(), &pth, jsn);
+    ASSERT_TRUE(it.next());
+    ASSERT_EQ("1", it.item().loc.to_string());
+    ASSERT_TRUE(it.next());
+    ASSERT_FALSE(it.next());
+    ASSERT_NE(JSONSL_ERROR_SUCCESS, it.status);
+
+    // Other paths do not recognize wildcards
+    Predicate pred;
+    ASSERT_EQ(Error::PATH_EINVAL,
+              pred.compile("items[*].sku", Predicate::EQ, JQ("a1")));
+}
+
+TEST_F(MatchTests, testContainerCursor) {
+    std::string doc = "{" JQ("feed") ":[";
+    for (int ii = 0; ii < 500; ii++) {
+        if (ii) {
+            doc += ",";
+        }
+        doc += "{" JQ("seq") ":" + std::to_string(ii) + "}";
+    }
+    doc += "]," JQ("meta") ":{" JQ("a") ":1," JQ("b") ":[true]}";
+    // Anything after the container is never parsed
+    const size_t meta_end = doc.size();
+    doc += ",garbage";
+
+    ContainerCursor cur;
+    ASSERT_EQ(0, pth.parse("feed"));
+    cur.open(doc.data(), doc.size(), &pth, jsn, 64);
+    size_t count = 0;
+    while (cur.next()) {
+        ASSERT_EQ(count, cur.child().position);
+        ASSERT_EQ("{" JQ("seq") ":" + std::to_string(count) + "}",
+                  cur.child().loc.to_string());
+        count++;
+    }
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, cur.status());
+    ASSERT_TRUE(!!cur.found);
+    ASSERT_EQ(JSONSL_T_LIST, cur.type);
+    ASSERT_EQ(500UL, count);
+    ASSERT_EQ(500UL, cur.num_children);
+
+    ASSERT_EQ(0, pth.parse("meta"));
+    cur.open(doc.data(), meta_end, &pth, jsn);
+    ASSERT_TRUE(cur.next());
+    ASSERT_EQ(JQ("a"), cur.child().loc_key.to_string());
+    ASSERT_EQ("1", cur.child().loc.to_string());
+    ASSERT_TRUE(cur.next());
+    ASSERT_EQ(JQ("b"), cur.child().loc_key.to_string());
+    ASSERT_EQ("[true]", cur.child().loc.to_string());
+    ASSERT_FALSE(cur.next());
+    ASSERT_EQ(JSONSL_T_OBJECT, cur.type);
+    ASSERT_EQ(2UL, cur.num_children);
+
+    // A container may be abandoned part way through
+    ASSERT_EQ(0, pth.parse("feed"));
+    cur.open(doc.data(), doc.size(), &pth, jsn);
+    ASSERT_TRUE(cur.next());
+    cur.close();
+    ASSERT_FALSE(cur.next());
+
+    // Not a container, or missing
+    ASSERT_EQ(0, pth.parse("meta.a"));
+    cur.open(doc.data(), doc.size(), &pth, jsn);
+    ASSERT_FALSE(cur.next());
+    ASSERT_TRUE(!!cur.found);
+    ASSERT_EQ(JSONSL_T_SPECIAL, cur.type);
+
+    ASSERT_EQ(0, pth.parse("feed[0].missing"));
+    cur.open(doc.data(), doc.size(), &pth, jsn);
+    ASSERT_FALSE(cur.next());
+    ASSERT_FALSE(!!cur.found);
+}
+
+TEST_F(MatchTests, testJsonEqual) {
+    auto equal = [&](const std::string& a, const std::string& b) {
+        return json_equal(Loc(a.data(), a.size()), Loc(b.data(), b.size()),
+                          jsn);
+    };
+    ASSERT_TRUE(equal("1", " 1.0 "));
+    ASSERT_TRUE(equal(R"("A")", R"("A")"));
+    ASSERT_TRUE(equal("[1, 2.0,[]]", "[1.0,2,[ ]]"));
+    ASSERT_TRUE(equal(R"({"x":1,"y":{"a":[true],"b":null}})",
+                      R"({ "y" : {"b":null,"a":[true]}, "x" : 1e0 })"));
+    ASSERT_TRUE(equal("{}", "{ }"));
+    // Strings keep their brackets and commas
+    ASSERT_TRUE(equal(R"(["a,]", {"k":"}"}])", R"(["a,]",{"k":"}"}])"));
+
+    ASSERT_FALSE(equal("[1,2]", "[2,1]"));
+    ASSERT_FALSE(equal("[1,2]", "[1]"));
+    ASSERT_FALSE(equal(R"({"x":1})", R"({"x":1,"y":1})"));
+    ASSERT_FALSE(equal(R"({"x":1,"y":2})", R"({"x":2,"y":1})"));
+    ASSERT_FALSE(equal(R"({"x":1})", R"(["x",1])"));
+    ASSERT_FALSE(equal("1", R"("1")"));
+    ASSERT_FALSE(equal("null", "false"));
+
+    // Malformed values are not equal, even to themselves
+    for (const std::string bad : {"[1,]", "[1 2]", "{\"x\"}", "{\"x\":1,}",
+                                  "[1}", "[[1]", "tru", "{x:1}", "",
+                                  "[\"a\"\"b\"]", "[1] 2"}) {
+        ASSERT_FALSE(equal(bad, bad)) << bad;
+    }
+
+    // No deeper than a document may be
+    std::string deep(Limits::PARSER_DEPTH - 1, '[');
+    deep += std::string(Limits::PARSER_DEPTH - 1, ']');
+    ASSERT_TRUE(equal(deep, deep));
+    deep = "[" + deep + "]";
+    ASSERT_FALSE(equal(deep, deep));
+}
@@ -8,7 +8,17 @@
  *   the file licenses/APL2.txt.
  */
 #include "subdoc-tests-common.h"
+#include "subdoc/childcount.h"
+#include "subdoc/docindex.h"
+#include "subdoc/docsource.h"
+#include "subdoc/docstats.h"
+#include "subdoc/jsonpatch.h"
+#include "subdoc/multicounter.h"
+#include "subdoc/multiremove.h"
+#include "subdoc/projection.h"
 #include "subdoc/validate.h"
+#include <filesystem>
+#include <fstream>
 
 using namespace Subdoc;
 
@@ -415,8 +425,13 @@ TEST_F(OpTests, testUnique) {
     rv = runOp(Command::ARRAY_ADD_UNIQUE, "unique", "[]");
     ASSERT_EQ(Error::VALUE_CANTINSERT, rv) << "Cannot unique-add non-primitive";
 
-    rv = runOp(Command::ARRAY_ADD_UNIQUE, "unique", "1,2,3");
-    ASSERT_EQ(Error::VALUE_CANTINSERT, rv) << "Cannot unique-add multivalue";
+    rv = runOp(Command::ARRAY_ADD_UNIQUE, "unique", R"(1,"z")");
+    ASSERT_TRUE(rv.success()) << "Multivalue adds only the missing values";
+    ASSERT_EQ("[false,true]", returnedMatch());
+    getAssignNewDoc(doc);
+
+    rv = runOp(Command::ARRAY_ADD_UNIQUE, "unique", "1,[]");
+    ASSERT_EQ(Error::VALUE_CANTINSERT, rv) << "Cannot unique-add non-primitive";
 
     rv = runOp(Command::ARRAY_APPEND, "unique", "[]");
     ASSERT_TRUE(rv.success());
@@ -668,6 +683,40 @@ TEST_F(OpTests, testNegativeIndex) {
     rv = runOp(Command::GET, "k1[1].k2[-1]");
     ASSERT_TRUE(rv.success());
     ASSERT_EQ("8", Util::match_match(op.match()));
+
+    // Any element may be addressed from the end
+    json = R"({"log": [1, {"a":[true]}, "three" , 4.5 ,[5] ]})";
+    op.set_doc(json);
+    rv = runOp(Command::GET, "log[-3]");
+    ASSERT_TRUE(rv.success());
+    ASSERT_EQ(R"("three")", Util::match_match(op.match()));
+    rv = runOp(Command::GET, "log[-2]");
+    ASSERT_TRUE(rv.success());
+    ASSERT_EQ("4.5", Util::match_match(op.match()));
+    rv = runOp(Command::GET, "log[-4].a[-1]");
+    ASSERT_TRUE(rv.success());
+    ASSERT_EQ("true", Util::match_match(op.match()));
+    rv = runOp(Command::GET, "log[-5]");
+    ASSERT_TRUE(rv.success());
+    ASSERT_EQ("1", Util::match_match(op.match()));
+    rv = runOp(Command::GET, "log[-6]");
+    ASSERT_EQ(Error::PATH_ENOENT, rv);
+
+    rv = runOp(Command::REPLACE, "log[-4]", "null");
+    ASSERT_TRUE(rv.success());
+    getAssignNewDoc(json);
+    ASSERT_EQ(R"({"log": [1, null, "three" , 4.5 ,[5] ]})", json);
+
+    rv = runOp(Command::REMOVE, "log[-2]");
+    ASSERT_TRUE(rv.success());
+    ASSERT_EQ("4.5", Util::match_match(op.match()));
+    getAssignNewDoc(json);
+    ASSERT_EQ(R"({"log": [1, null, "three" , [5] ]})", json);
+
+    rv = runOp(Command::REMOVE, "log[-4]");
+    ASSERT_TRUE(rv.success());
+    getAssignNewDoc(json);
+    ASSERT_EQ(R"({"log": [ null, "three" , [5] ]})", json);
 }
 
 TEST_F(OpTests, testRootOps) {
@@ -815,10 +864,19 @@ TEST_F(OpTests, testArrayInsert) {
     // Reset the doc
     doc = "[1,2,3,5]";
     op.set_doc(doc);
-    // -1 is not a valid insertion point.
+    // A negative index inserts before the element counting from the end
     rv = runOp(Command::ARRAY_INSERT, "[-1]", "4");
-    ASSERT_EQ(Error::PATH_EINVAL, rv)
-            << "Terminal negative index invalid for insert.";
+    ASSERT_TRUE(rv.success()) << "Insert at negative index OK";
+    getAssignNewDoc(doc);
+    ASSERT_EQ("[1,2,3,4,5]", doc) << "Insert before the last element";
+
+    rv = runOp(Command::ARRAY_INSERT, "[-5]", "0");
+    ASSERT_TRUE(rv.success()) << "Insert before the first element OK";
+    getAssignNewDoc(doc);
+    ASSERT_EQ("[0,1,2,3,4,5]", doc);
+
+    rv = runOp(Command::ARRAY_INSERT, "[-7]", "null");
+    ASSERT_EQ(Error::PATH_ENOENT, rv) << "Negative index past the beginning";
 
     // Insert at out-of-bounds element
     doc = "[1,2,3]";
@@ -926,6 +984,14 @@ TEST_F(OpTests, testEscapedJson) {
     getAssignNewDoc(doc);
 
     ASSERT_EQ(Error::PATH_EINVAL, runOp(Command::GET, R"("missing.quote)"));
+
+    // '*' is an ordinary key, quoted or not
+    doc = R"({"a":{"*":1}})";
+    op.set_doc(doc);
+    ASSERT_EQ(Error::SUCCESS, runOp(Command::GET, "a.*"));
+    ASSERT_EQ("1", Util::match_match(op.match()));
+    ASSERT_EQ(Error::SUCCESS, runOp(Command::GET, "a.`*`"));
+    ASSERT_EQ("1", Util::match_match(op.match()));
 }
 
 TEST_F(OpTests, testUpsertArrayIndex) {
@@ -1092,6 +1158,87 @@ TEST_F(OpTests, testGetCount) {
     ASSERT_EQ("2", returnedMatch());
 }
 
+TEST_F(OpTests, testGetCountLarge) {
+    // Elements whose strings contain structural characters and escapes,
+    // spread so that they straddle the 16-byte blocks
+    const std::vector<std::string> elems = {
+            "1",
+            R"("a,b")",
+            R"("[{,}]")",
+            R"("\"],")",
+            R"("\\")",
+            R"({"k":[1,2,{"x":"]"}],"j":","})",
+            "[[],[[]],{}]",
+            R"("\\\",")",
+            "  true  ",
+            "null"};
+    for (size_t count : {1, 2, 15, 16, 17, 1000}) {
+        std::string arr = "[";
+        for (size_t ii = 0; ii < count; ii++) {
+            if (ii) {
+                arr += ",";
+            }
+            arr += elems[ii % elems.size()];
+        }
+        arr += " ]";
+        const std::string doc = R"({"pad":"xyz","arr":)" + arr + R"(,"z":1})";
+
+        op.set_doc(doc);
+        op.set_doc_validated(true);
+        ASSERT_ERROK(runOp(Command::GET_COUNT, "arr"));
+        ASSERT_EQ(std::to_string(count), returnedMatch());
+        ASSERT_EQ(arr, op.match().loc_deepest.to_string());
+        ASSERT_TRUE(op.match().container_skipped);
+
+        // Unless the document is known to be valid, it is parsed
+        op.set_doc_validated(false);
+        ASSERT_ERROK(runOp(Command::GET_COUNT, "arr"));
+        ASSERT_EQ(std::to_string(count), returnedMatch());
+        ASSERT_FALSE(op.match().container_skipped);
+        op.set_doc_validated(true);
+
+        // A segmented document is parsed as before
+        const Loc segs[] = {Loc(doc.data(), 5),
+                            Loc(doc.data() + 5, doc.size() - 5)};
+        op.set_doc(Buffer<Loc>(segs, 2));
+        ASSERT_ERROK(runOp(Command::GET_COUNT, "arr"));
+        ASSERT_EQ(std::to_string(count), returnedMatch());
+
+        size_t nchildren = 0, length = 0;
+        ASSERT_TRUE(ChildCounter::count_scalar(
+                arr.data(), arr.size(), nchildren, length));
+        ASSERT_EQ(count, nchildren);
+        ASSERT_EQ(arr.size(), length);
+    }
+
+    std::string doc = R"({"o":{ "a" : [1,2] , "b":"}" } })";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::GET_COUNT, "o"));
+    ASSERT_EQ("2", returnedMatch());
+
+    doc = R"({"o":[ ]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::GET_COUNT, "o"));
+    ASSERT_EQ("0", returnedMatch());
+
+    size_t nchildren, length;
+    const std::string truncated = R"([1,2,"]")";
+    ASSERT_FALSE(ChildCounter::count(
+            truncated.data(), truncated.size(), nchildren, length));
+
+    // Malformed containers are reported, as the document is parsed by
+    // default
+    op.set_doc_validated(false);
+    for (const char *malformed : {R"({"a":[1,2,3,]})", R"({"a":[1,2,3,])",
+                                  R"({"a":[1,,2]})", R"({"a":[1,2}})",
+                                  R"({"a":{"b"}})"}) {
+        doc = malformed;
+        op.set_doc(doc);
+        ASSERT_ERREQ(runOp(Command::GET_COUNT, "a"), Error::DOC_NOTJSON)
+                << malformed;
+    }
+}
+
 // Some commands require paths with specific endings. For example, DICT_UPSERT
 // requires its last element MUST NOT be an array element, while ARRAY_INSERT
 // requires its last element MUST be an array element. Some commands
@@ -1204,3 +1351,1112 @@ TEST_F(OpTests, testUtf8Path) {
     ASSERT_EQ(Error::SUCCESS, runOp(Command::GET, path));
     ASSERT_EQ(R"("value")", returnedMatch());
 }
+
+TEST_F(OpTests, testIndexedLookups) {
+    std::string doc = "{";
+    for (int ii = 0; ii < 20; ii++) {
+        doc += "\"flag" + std::to_string(ii) + "\":true,";
+    }
+    doc += R"("sub":{"x":1}})";
+    op.set_doc(doc);
+
+    DocIndex index;
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, index.build(doc, op.parser()));
+    op.set_index(&index);
+
+    ASSERT_ERREQ(runOp(Command::EXISTS, "nonexist"), Error::PATH_ENOENT);
+    ASSERT_TRUE(op.match().index_resolved);
+    ASSERT_ERROK(runOp(Command::EXISTS, "flag7"));
+
+    // Insertion still gets the location of the parent
+    ASSERT_ERROK(runOp(Command::DICT_ADD, "newflag", "false"));
+    ASSERT_TRUE(op.match().index_resolved);
+    std::string newdoc;
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"(,"newflag":false})", newdoc.substr(newdoc.size() - 17));
+
+    // The index no longer applies to the new document
+    ASSERT_ERROK(runOp(Command::GET, "newflag"));
+    ASSERT_EQ("false", returnedMatch());
+    ASSERT_ERREQ(runOp(Command::DICT_ADD, "flag3", "false"), Error::DOC_EEXISTS);
+    ASSERT_FALSE(op.match().index_resolved);
+}
+
+TEST_F(OpTests, testSortedKeys) {
+    // Everything following "c" is never parsed when looking for "b"
+    std::string doc = R"({"a":1,"c":3,"e":[BAD)";
+    op.set_doc(doc);
+    ASSERT_ERREQ(runOp(Command::GET, "b"), Error::DOC_NOTJSON);
+
+    op.set_keys_sorted(true);
+    ASSERT_ERREQ(runOp(Command::GET, "b"), Error::PATH_ENOENT);
+    ASSERT_EQ("\"c\"", op.match().loc_next_key.to_string());
+
+    doc = R"({"a":1,"c":{"x":1,"z":3},"e":5})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::DICT_UPSERT, "b", "2"));
+    std::string newdoc;
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"a":1,"b":2,"c":{"x":1,"z":3},"e":5})", newdoc);
+
+    ASSERT_ERROK(runOp(Command::DICT_ADD, "0", "0"));
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"0":0,"a":1,"b":2,"c":{"x":1,"z":3},"e":5})", newdoc);
+
+    ASSERT_ERROK(runOp(Command::DICT_ADD, "c.y", "2"));
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"0":0,"a":1,"b":2,"c":{"x":1,"y":2,"z":3},"e":5})", newdoc);
+
+    // Past the last key; appended as usual
+    ASSERT_ERROK(runOp(Command::DICT_ADD, "f", "6"));
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"0":0,"a":1,"b":2,"c":{"x":1,"y":2,"z":3},"e":5,"f":6})", newdoc);
+
+    ASSERT_ERROK(runOp(Command::DICT_UPSERT_P, "d.p.q", "true"));
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"0":0,"a":1,"b":2,"c":{"x":1,"y":2,"z":3},"d":{"p":{"q":true}},"e":5,"f":6})", newdoc);
+
+    ASSERT_ERROK(runOp(Command::ARRAY_APPEND_P, "ca", "1"));
+    getAssignNewDoc(newdoc);
+    ASSERT_EQ(R"({"0":0,"a":1,"b":2,"c":{"x":1,"y":2,"z":3},"ca":[1],"d":{"p":{"q":true}},"e":5,"f":6})", newdoc);
+
+    // Existing keys are still found
+    ASSERT_ERROK(runOp(Command::GET, "c.z"));
+    ASSERT_EQ("3", returnedMatch());
+    ASSERT_ERREQ(runOp(Command::DICT_ADD, "e", "0"), Error::DOC_EEXISTS);
+}
+
+TEST_F(OpTests, testSegmentedDoc) {
+    const std::string doc =
+            R"({"a":1,"long_key_name":"some string value","arr":[1,2,3,"x"],)"
+            R"("sub":{"k":-15,"n":[[1],[2]]}})";
+    struct {
+        Command cmd;
+        const char *path;
+        const char *value;
+    } cmds[] = {{Command::GET, "long_key_name", ""},
+                {Command::GET, "sub.n[-1][0]", ""},
+                {Command::GET, "arr[-1]", ""},
+                {Command::GET, "sub", ""},
+                {Command::GET_COUNT, "arr", ""},
+                {Command::REMOVE, "a", ""},
+                {Command::REMOVE, "arr[1]", ""},
+                {Command::REMOVE, "sub", ""},
+                {Command::REPLACE, "sub.n[0]", "null"},
+                {Command::DICT_UPSERT, "long_key_name", "2"},
+                {Command::DICT_ADD_P, "sub.x.y", "true"},
+                {Command::ARRAY_APPEND, "arr", "4"},
+                {Command::ARRAY_APPEND, "", "4"},
+                {Command::ARRAY_PREPEND, "arr", "0"},
+                {Command::ARRAY_ADD_UNIQUE, "arr", "\"x\""},
+                {Command::ARRAY_ADD_UNIQUE, "arr", "\"y\""},
+                {Command::ARRAY_INSERT, "arr[2]", "9"},
+                {Command::COUNTER, "sub.k", "5"}};
+
+    for (size_t chunk : {1, 2, 5, 16}) {
+        std::vector<Loc> segs;
+        for (size_t off = 0; off < doc.size(); off += chunk) {
+            segs.emplace_back(doc.data() + off,
+                              std::min(chunk, doc.size() - off));
+        }
+
+        for (const auto& cmd : cmds) {
+            op.set_doc(doc);
+            Error expected = runOp(cmd.cmd, cmd.path, cmd.value);
+            std::string expdoc, expmatch = returnedMatch();
+            for (auto ii : res.newdoc()) {
+                expdoc.append(ii.at, ii.length);
+            }
+
+            op.set_doc(Buffer<Loc>(segs.data(), segs.size()));
+            ASSERT_ERREQ(runOp(cmd.cmd, cmd.path, cmd.value), expected)
+                    << cmd.path << " (chunk=" << chunk << ")";
+            ASSERT_EQ(expmatch, returnedMatch()) << cmd.path;
+            if (cmd.cmd != Command::GET && cmd.cmd != Command::GET_COUNT) {
+                std::string newdoc;
+                for (auto ii : res.newdoc()) {
+                    newdoc.append(ii.at, ii.length);
+                }
+                ASSERT_EQ(expdoc, newdoc) << cmd.path;
+            }
+        }
+    }
+}
+
+TEST_F(OpTests, testSegmentedChaining) {
+    // The same value (and the same constant tokens) appear several times in
+    // the chained documents
+    const std::string doc = R"({"a":1})";
+    const std::string value = R"("value")";
+    // The new keys refer to the paths, so they must remain valid too
+    const std::string path1 = "b", path2 = "c";
+    Result res1, res2;
+
+    op.set_doc(doc);
+    op.set_code(Command::DICT_UPSERT);
+    op.set_value(value);
+    op.set_result_buf(&res1);
+    ASSERT_ERROK(op.op_exec(path1));
+
+    op.clear();
+    op.set_doc(res1.newdoc());
+    op.set_code(Command::DICT_UPSERT);
+    op.set_value(value);
+    op.set_result_buf(&res2);
+    ASSERT_ERROK(op.op_exec(path2));
+
+    op.set_doc(res2.newdoc());
+    ASSERT_ERROK(runOp(Command::GET, "c"));
+    ASSERT_EQ(value, returnedMatch());
+    ASSERT_ERROK(runOp(Command::REMOVE, "b"));
+    ASSERT_EQ(R"({"a":1,"c":"value"})", getNewDoc());
+}
+
+namespace {
+// Counts the bytes pulled from another source
+class CountingSource : public DocSource {
+public:
+    explicit CountingSource(DocSource& src) : src(src) {
+    }
+    Loc next() override {
+        Loc chunk = src.next();
+        pulled += chunk.length;
+        return chunk;
+    }
+    DocSource& src;
+    size_t pulled = 0;
+};
+} // namespace
+
+TEST_F(OpTests, testLazySource) {
+    std::string doc = R"({"first":"near the start","big":[)";
+    for (int ii = 0; ii < 10000; ii++) {
+        doc += std::to_string(ii) + ",";
+    }
+    doc += R"("end"],"last":true})";
+
+    auto fname = std::filesystem::temp_directory_path() /
+                 "subjson-testLazySource.json";
+    std::ofstream(fname, std::ios::binary) << doc;
+
+    MmapSource mapped;
+    ASSERT_EQ(0, mapped.open(fname.string().c_str(), 1024));
+    ASSERT_EQ(doc.size(), mapped.size());
+
+    // Only the first chunk is needed to find "first"
+    CountingSource src(mapped);
+    op.set_doc(src);
+    ASSERT_ERROK(runOp(Command::GET, "first"));
+    ASSERT_EQ(R"("near the start")", returnedMatch());
+    ASSERT_EQ(1024, src.pulled);
+    ASSERT_EQ(src.pulled, op.consumed());
+
+    // Continues from where the previous lookup stopped
+    ASSERT_ERROK(runOp(Command::GET, "big[3]"));
+    ASSERT_EQ("3", returnedMatch());
+    ASSERT_EQ(1024, src.pulled);
+    ASSERT_ERROK(runOp(Command::GET, "last"));
+    ASSERT_EQ(doc.size(), src.pulled);
+
+    // Mutations read the whole document
+    mapped.rewind();
+    src.pulled = 0;
+    op.set_doc(src);
+    ASSERT_ERROK(runOp(Command::DICT_UPSERT, "first", "null"));
+    ASSERT_EQ(doc.size(), src.pulled);
+    std::string newdoc = getNewDoc();
+    ASSERT_EQ(R"({"first":null,"big":[0,1,2,)", newdoc.substr(0, 27));
+    ASSERT_EQ(doc.size() - 16 + 4, newdoc.size());
+
+    mapped.close();
+    std::filesystem::remove(fname);
+}
+
+TEST_F(OpTests, testIncrementalFeed) {
+    const std::string doc =
+            R"({"meta":{"id":"doc1","tags":["a","b"]},"body":[1,2,3,4,5]})";
+    const std::string path = "meta.id";
+
+    // Chunks of one byte each: the lookup completes once the match has been
+    // received, without the rest of the document
+    op.set_code(Command::GET);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(path), Error::NEED_MORE);
+    size_t fed = 0;
+    Error rv = Error::NEED_MORE;
+    while (rv == Error::NEED_MORE && fed < doc.size()) {
+        rv = op.op_feed(doc.c_str() + fed++, 1);
+    }
+    ASSERT_ERROK(rv);
+    ASSERT_EQ(R"("doc1")", returnedMatch());
+    ASSERT_EQ(doc.find(R"(,"tags")"), fed);
+    // The result is retained
+    ASSERT_ERROK(op.op_end());
+    ASSERT_EQ(R"("doc1")", returnedMatch());
+
+    // A missing key is known once its parent is closed
+    op.clear();
+    const std::string missing = "meta.missing";
+    op.set_code(Command::EXISTS);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(missing), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(doc.substr(0, 20)), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(doc.substr(20, 30)), Error::PATH_ENOENT);
+
+    // GET_COUNT, with a match spanning several chunks
+    op.clear();
+    const std::string tags = "meta.tags";
+    const std::string part1 = doc.substr(0, 33), part2 = doc.substr(33);
+    op.set_code(Command::GET_COUNT);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(tags), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part1), Error::NEED_MORE);
+    ASSERT_ERROK(op.op_feed(part2));
+    ASSERT_EQ("2", returnedMatch());
+
+    // Negative indexes and mutations need the whole document
+    op.clear();
+    const std::string last = "body[-1]";
+    op.set_code(Command::GET);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(last), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part1), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part2), Error::NEED_MORE);
+    ASSERT_ERROK(op.op_end());
+    ASSERT_EQ("5", returnedMatch());
+
+    op.clear();
+    const std::string value = "true";
+    op.set_code(Command::DICT_UPSERT);
+    op.set_value(value);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(path), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part1), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part2), Error::NEED_MORE);
+    ASSERT_ERROK(op.op_end());
+    ASSERT_EQ(
+            R"({"meta":{"id":true,"tags":["a","b"]},"body":[1,2,3,4,5]})",
+            getNewDoc());
+
+    // The document ends before the match is resolved
+    op.clear();
+    op.set_code(Command::GET);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(path), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(doc.substr(0, 10)), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_end(), Error::PATH_ENOENT);
+
+    // Errors are reported as soon as they are found
+    op.clear();
+    const std::string bad = R"({"meta":{"id"]})";
+    op.set_code(Command::GET);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(path), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(bad), Error::DOC_NOTJSON);
+
+    // A suspended operation may be abandoned
+    op.clear();
+    op.set_code(Command::GET);
+    op.set_result_buf(&res);
+    ASSERT_ERREQ(op.op_begin(path), Error::NEED_MORE);
+    ASSERT_ERREQ(op.op_feed(part1.substr(0, 12)), Error::NEED_MORE);
+    op.clear();
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::GET, "body[1]"));
+    ASSERT_EQ("2", returnedMatch());
+}
+
+TEST_F(OpTests, testProjection) {
+    const std::string doc = R"({"a":{"b":1,"x":2},"c":[3,4],"d":5,)"
+                            R"("l":[{"k":0},{"k":1,"j":2},{"k":2}],)"
+                            R"("e\"q":"escaped"})";
+
+    Projection proj;
+    ASSERT_ERROK(proj.add("a.b"));
+    ASSERT_ERROK(proj.add("c"));
+    ASSERT_ERROK(proj.add("missing.path"));
+    ASSERT_ERROK(proj.add("l[2].k"));
+    ASSERT_ERROK(proj.add("l[1].j"));
+    ASSERT_ERROK(proj.add("e\\\"q"));
+    ASSERT_ERREQ(proj.add("l[-1]"), Error::GLOBAL_ENOSUPPORT);
+    ASSERT_ERREQ(proj.add("a..b"), Error::PATH_EINVAL);
+
+    ASSERT_ERROK(proj.exec(doc, res));
+    const std::string expected =
+            R"({"a":{"b":1},"c":[3,4],"l":[{"j":2},{"k":2}],"e\"q":"escaped"})";
+    ASSERT_EQ(expected, getNewDoc());
+
+    // A path covering another
+    ASSERT_ERROK(proj.add("a"));
+    ASSERT_ERROK(proj.exec(doc, res));
+    ASSERT_EQ(R"({"a":{"b":1,"x":2},"c":[3,4],"l":[{"j":2},{"k":2}],)"
+              R"("e\"q":"escaped"})",
+              getNewDoc());
+
+    // Segmented input
+    std::vector<Loc> chunks;
+    for (size_t ii = 0; ii < doc.size(); ii += 3) {
+        chunks.emplace_back(doc.c_str() + ii, std::min<size_t>(3, doc.size() - ii));
+    }
+    Segments segs;
+    segs.assign(Buffer<Loc>(chunks.data(), chunks.size()));
+    proj.clear();
+    proj.add("a.b");
+    proj.add("c");
+    proj.add("l[2].k");
+    proj.add("l[1].j");
+    proj.add("e\\\"q");
+    ASSERT_ERROK(proj.exec(segs, res));
+    ASSERT_EQ(expected, getNewDoc());
+
+    // Nothing found
+    proj.clear();
+    proj.add("nothing");
+    ASSERT_ERROK(proj.exec(doc, res));
+    ASSERT_EQ("{}", getNewDoc());
+
+    ASSERT_ERREQ(proj.exec(std::string(R"({"a":]})"), res), Error::DOC_NOTJSON);
+}
+
+TEST_F(OpTests, testDocStats) {
+    const std::string doc = R"({"tags":["a","b","c"],"attrs":{"x":1,"y":2},)"
+                            R"("flag":true,"name":"abc","n":null})";
+
+    DocStats stats;
+    ASSERT_ERROK(stats.add("tags"));
+    ASSERT_ERROK(stats.add("attrs"));
+    ASSERT_ERROK(stats.add("flag"));
+    ASSERT_ERROK(stats.add("name"));
+    ASSERT_ERROK(stats.add("missing"));
+    ASSERT_ERROK(stats.add("attrs.y"));
+    ASSERT_ERROK(stats.add("tags"));
+    ASSERT_ERREQ(stats.add("tags[*]"), Error::PATH_EINVAL);
+    ASSERT_EQ(7UL, stats.size());
+
+    ASSERT_ERROK(stats.exec(doc));
+    ASSERT_ERROK(stats[0].status);
+    ASSERT_EQ(JSONSL_T_LIST, stats[0].type);
+    ASSERT_EQ(3UL, stats[0].count);
+    ASSERT_EQ(13UL, stats[0].length);
+    ASSERT_EQ(JSONSL_T_OBJECT, stats[1].type);
+    ASSERT_EQ(2UL, stats[1].count);
+    ASSERT_EQ(JSONSL_T_SPECIAL, stats[2].type);
+    ASSERT_EQ(JSONSL_SPECIALf_TRUE, stats[2].sflags);
+    ASSERT_EQ(0UL, stats[2].count);
+    ASSERT_EQ(JSONSL_T_STRING, stats[3].type);
+    ASSERT_EQ(5UL, stats[3].length);
+    ASSERT_ERREQ(stats[4].status, Error::PATH_ENOENT);
+    ASSERT_ERROK(stats[5].status);
+    ASSERT_EQ(1UL, stats[5].length);
+    ASSERT_EQ(3UL, stats[6].count);
+
+    // Results are reset by each scan
+    ASSERT_ERROK(stats.exec(std::string(R"({"tags":[]})")));
+    ASSERT_EQ(0UL, stats[0].count);
+    ASSERT_ERREQ(stats[1].status, Error::PATH_ENOENT);
+
+    ASSERT_ERREQ(stats.exec(std::string("{\"tags\":[}")), Error::DOC_NOTJSON);
+    ASSERT_ERREQ(stats[0].status, Error::PATH_ENOENT);
+}
+
+TEST_F(OpTests, testMergePatch) {
+    std::string doc = R"({"a":"b","c":{"d":"e","f":"g"},"n" : 1})";
+    op.set_doc(doc);
+    // Examples from RFC 7386
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "", R"({"a":"z","c":{"f":null}})"));
+    ASSERT_EQ(R"({"a":"z","c":{"d":"e"},"n" : 1})", getNewDoc());
+
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "", R"({"a":null,"x":{"y":null,"z":[1]}})"));
+    ASSERT_EQ(R"({"c":{"d":"e","f":"g"},"n" : 1,"x":{"z":[1]}})", getNewDoc());
+
+    // A value which is not an object replaces the element
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "c", "[1,2]"));
+    ASSERT_EQ(R"({"a":"b","c":[1,2],"n" : 1})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "n", R"({"m":2,"k":null})"));
+    ASSERT_EQ(R"({"a":"b","c":{"d":"e","f":"g"},"n" : {"m":2}})", getNewDoc());
+
+    // Later keys of the patch take precedence; an empty patch changes nothing
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "c", R"({"d":1,"q":2,"d":3,"q":4})"));
+    ASSERT_EQ(R"({"a":"b","c":{"d":3,"f":"g","q":4},"n" : 1})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "c", "{}"));
+    ASSERT_EQ(doc, getNewDoc());
+
+    // Keys are compared as strings, whichever way they are escaped
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "", R"({"\u0061":2,"\u006e":null})"));
+    ASSERT_EQ(R"({"a":2,"c":{"d":"e","f":"g"}})", getNewDoc());
+
+    ASSERT_ERREQ(runOp(Command::DICT_MERGE, "missing", "{}"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(runOp(Command::DICT_MERGE, "c[0]", "{}"), Error::PATH_MISMATCH);
+    ASSERT_ERREQ(runOp(Command::DICT_MERGE, "c", "{"), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(runOp(Command::DICT_MERGE, "c", "1,2"), Error::VALUE_CANTINSERT);
+
+    // Negative indexes, and a segmented document whose keys straddle segments
+    doc = R"({"arr":[{"k":1},{"key":{"x":1},"y":2}]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "arr[-1]", R"({"key":{"x":null,"z":3}})"));
+    ASSERT_EQ(R"({"arr":[{"k":1},{"key":{"z":3},"y":2}]})", getNewDoc());
+
+    const Loc segs[] = {Loc(doc.data(), 19),
+                        Loc(doc.data() + 19, 8),
+                        Loc(doc.data() + 27, doc.size() - 27)};
+    op.set_doc(Buffer<Loc>(segs, 3));
+    ASSERT_ERROK(runOp(Command::DICT_MERGE, "arr[1]", R"({"key":{"x":null,"z":3},"y":null})"));
+    ASSERT_EQ(R"({"arr":[{"k":1},{"key":{"z":3}}]})", getNewDoc());
+    ASSERT_LT(3, res.newdoc().size());
+}
+
+TEST_F(OpTests, testJsonPatch) {
+    auto apply = [this](JsonPatch& patch, const std::string& doc) {
+        Error rv = patch.exec(doc, res);
+        std::string newdoc;
+        if (rv.success()) {
+            newdoc = getNewDoc();
+        }
+        return std::make_pair(rv, newdoc);
+    };
+
+    JsonPatch patch;
+    const std::string doc = R"({"a":{"b":[1,2,3]},"c":"x","d":{"e":1}})";
+    std::string ops = R"([
+        {"op":"test","path":"/c","value":"x"},
+        {"op":"test","path":"/a/b/1","value":2.0},
+        {"op":"add","path":"/a/b/1","value":9},
+        {"op":"add","path":"/a/b/-","value":4},
+        {"op":"remove","path":"/a/b/0"},
+        {"op":"replace","path":"/c","value":{"y":true}},
+        {"op":"add","path":"/n","value":null},
+        {"op":"move","from":"/d/e","path":"/a/f"},
+        {"op":"copy","from":"/a/b","path":"/g"},
+        {"op":"test","path":"/g","value":[ 9, 2, 3, 4 ]}
+    ])";
+    ASSERT_ERROK(patch.compile(ops));
+    ASSERT_EQ(10UL, patch.size());
+    auto rv = apply(patch, doc);
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ(JsonPatch::NONE, patch.failed());
+    ASSERT_EQ(R"({"a":{"b":[9,2,3,4],"f":1},"c":{"y":true},"d":{},"n":null,"g":[9,2,3,4]})",
+              rv.second);
+
+    // The document is unchanged if a test fails, whether or not it precedes
+    // the changes
+    ops = R"([{"op":"remove","path":"/c"},{"op":"test","path":"/a/b/0","value":2}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, doc);
+    ASSERT_ERREQ(rv.first, Error::VALUE_MISMATCH);
+    ASSERT_EQ(1UL, patch.failed());
+    // Containers are compared structurally
+    ops = R"([{"op":"test","path":"/d","value":{"e":1.0}},{"op":"test","path":"","value":{"d":{"e":1},"c":"x","a":{"b":[1,2,3.0]}}}])";
+    ASSERT_ERROK(patch.compile(ops));
+    ASSERT_ERROK(apply(patch, doc).first);
+    ops = R"([{"op":"test","path":"/c","value":"x"},{"op":"test","path":"/a/b","value":[1,2]},{"op":"remove","path":"/c"}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, doc);
+    ASSERT_ERREQ(rv.first, Error::VALUE_MISMATCH);
+    ASSERT_EQ(1UL, patch.failed());
+
+    // Errors of the commands are those of the failing operation
+    ops = R"([{"op":"remove","path":"/zz"}])";
+    ASSERT_ERROK(patch.compile(ops));
+    ASSERT_ERREQ(apply(patch, doc).first, Error::PATH_ENOENT);
+    ASSERT_EQ(0UL, patch.failed());
+
+    // The whole document may be replaced
+    ops = R"([{"op":"replace","path":"","value":[1]},{"op":"add","path":"/0","value":0}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, doc);
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ("[0,1]", rv.second);
+
+    // Tokens which are all digits are keys within objects
+    ops = R"([{"op":"test","path":"/foo/0","value":1},{"op":"replace","path":"/foo/0","value":2},{"op":"add","path":"/foo/1","value":[5]},{"op":"add","path":"/foo/1/0","value":4},{"op":"add","path":"/bar/0","value":0}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, R"({"foo":{"0":1},"bar":{}})");
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ(R"({"foo":{"0":2,"1":[4,5]},"bar":{"0":0}})", rv.second);
+    ops = R"([{"op":"add","path":"/foo/0","value":3},{"op":"move","from":"/foo/0","path":"/foo/x"},{"op":"remove","path":"/foo/7"}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, R"({"foo":{"0":1,"7":[]}})");
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ(R"({"foo":{"x":3}})", rv.second);
+    ops = R"([{"op":"add","path":"/foo/0","value":3}])";
+    ASSERT_ERROK(patch.compile(ops));
+    ASSERT_ERREQ(apply(patch, R"({"foo":"s"})").first, Error::PATH_MISMATCH);
+
+    // Commands on such a path add keys only to objects, and insert only
+    // into arrays
+    Path ptr;
+    const std::string pointer = "/a/1";
+    ASSERT_EQ(0, ptr.parse_pointer(pointer));
+    const std::string arrdoc = R"({"a":[1]})";
+    const std::string objdoc = R"({"a":{}})";
+    auto exec_ptr = [&](Command code, const std::string& target) {
+        op.clear();
+        op.set_doc(target);
+        op.set_code(code);
+        op.set_value("2", 1);
+        res.clear();
+        op.set_result_buf(&res);
+        return op.op_exec(ptr);
+    };
+    ASSERT_ERREQ(exec_ptr(Command::DICT_UPSERT, arrdoc), Error::PATH_MISMATCH);
+    ASSERT_ERREQ(exec_ptr(Command::ARRAY_INSERT, objdoc), Error::PATH_MISMATCH);
+    ASSERT_ERROK(exec_ptr(Command::ARRAY_INSERT, arrdoc));
+    ASSERT_EQ(R"({"a":[1,2]})", getNewDoc());
+    ASSERT_ERROK(exec_ptr(Command::DICT_UPSERT, objdoc));
+    ASSERT_EQ(R"({"a":{"1":2}})", getNewDoc());
+
+    // A segmented document
+    const Loc segs[] = {Loc(doc.data(), 8), Loc(doc.data() + 8, doc.size() - 8)};
+    Segments segdoc;
+    segdoc.assign(Buffer<Loc>(segs, 2));
+    ops = R"([{"op":"test","path":"/a/b","value":[1,2,3]},{"op":"remove","path":"/a/b/1"}])";
+    ASSERT_ERROK(patch.compile(ops));
+    ASSERT_ERROK(patch.exec(segdoc, res));
+    ASSERT_EQ(R"({"a":{"b":[1,3]},"c":"x","d":{"e":1}})", getNewDoc());
+
+    // The separator before a final '-' may be escaped, unless its
+    // backslash belongs to the key
+    ops = R"([{"op":"add","path":"/a\/b\/-","value":4}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, doc);
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ(R"({"a":{"b":[1,2,3,4]},"c":"x","d":{"e":1}})", rv.second);
+    ops = R"([{"op":"add","path":"/a\\/-","value":1}])";
+    ASSERT_ERROK(patch.compile(ops));
+    rv = apply(patch, R"({"a\\":[]})");
+    ASSERT_ERROK(rv.first);
+    ASSERT_EQ(R"({"a\\":[1]})", rv.second);
+
+    ASSERT_ERREQ(patch.compile("{}"), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(patch.compile(R"([{"op":"add","path":"/a"}])"), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(patch.compile(R"([{"op":"remove","path":"/a"},{"op":"frob","path":"/a"}])"),
+                 Error::GLOBAL_ENOSUPPORT);
+    ASSERT_EQ(1UL, patch.failed());
+    ASSERT_EQ(0UL, patch.size());
+    ASSERT_ERREQ(patch.compile(R"([{"op":"remove","path":"/a"},5])"),
+                 Error::VALUE_CANTINSERT);
+    ASSERT_EQ(1UL, patch.failed());
+    ASSERT_ERREQ(patch.compile(R"([{"op":"move","from":"/a","path":"/a/b"}])"), Error::PATH_EINVAL);
+    ASSERT_ERREQ(patch.compile(R"([{"op":"move","from":"/a","path":"/a\/b"}])"), Error::PATH_EINVAL);
+    ASSERT_ERREQ(patch.compile(R"([{"op":"move","from":"/a\/b","path":"/a/b/-"}])"), Error::PATH_EINVAL);
+    ASSERT_ERROK(patch.compile(R"([{"op":"move","from":"/a","path":"/a"}])"));
+    ASSERT_ERROK(patch.compile(R"([{"op":"move","from":"/a","path":"/ab"}])"));
+    ASSERT_ERREQ(patch.compile(R"([{"op":"remove","path":"a"}])"), Error::PATH_EINVAL);
+}
+
+TEST_F(OpTests, testMultiRemove) {
+    MultiRemove rm;
+    auto remove = [&](const std::string& doc,
+                      const std::vector<std::string>& paths) {
+        rm.clear();
+        for (const auto& path : paths) {
+            EXPECT_PRED_FORMAT1(ensureErrorResult, rm.add(path));
+        }
+        EXPECT_PRED_FORMAT1(ensureErrorResult, rm.exec(doc, res));
+        return getNewDoc();
+    };
+
+    const std::string arr = "[0, 1 , 2,3 ,4]";
+    ASSERT_EQ("[0, 2,3 ,4]", remove(arr, {"[1]"}));
+    ASSERT_EQ("[0, 3 ,4]", remove(arr, {"[1]", "[2]"}));
+    ASSERT_EQ("[3 ,4]", remove(arr, {"[2]", "[0]", "[1]"}));
+    ASSERT_EQ("[0, 1 , 2]", remove(arr, {"[3]", "[4]"}));
+    ASSERT_EQ("[2]", remove(arr, {"[0]", "[1]", "[3]", "[4]"}));
+    ASSERT_EQ("[1 , 2,3]", remove(arr, {"[0]", "[4]"}));
+    ASSERT_EQ("[]", remove(arr, {"[0]", "[1]", "[2]", "[3]", "[4]"}));
+
+    // Unrelated paths, nested and duplicate paths, and missing paths
+    const std::string doc =
+            R"({"a":{"x":1,"y":[1,2]},"b":"s", "c":{"z":null},"d":[{"k":1}]})";
+    ASSERT_EQ(R"({"a":{"y":[1]},"c":{},"d":[{"k":1}]})",
+              remove(doc, {"a.x", "b", "c.z", "a.y[1]", "b"}));
+    ASSERT_EQ(R"({"b":"s", "c":{"z":null}})",
+              remove(doc, {"d", "a", "a.x", "d[0].k", "missing", "b[0]"}));
+    ASSERT_TRUE(rm.removed(0));
+    ASSERT_TRUE(rm.removed(3));
+    ASSERT_FALSE(rm.removed(4));
+    ASSERT_FALSE(rm.removed(5));
+    ASSERT_EQ(doc, remove(doc, {"missing"}));
+
+    // A segmented document
+    const Loc segs[] = {Loc(doc.data(), 10), Loc(doc.data() + 10, 20),
+                        Loc(doc.data() + 30, doc.size() - 30)};
+    Segments segdoc;
+    segdoc.assign(Buffer<Loc>(segs, 3));
+    rm.clear();
+    ASSERT_ERROK(rm.add("a.y"));
+    ASSERT_ERROK(rm.add("c"));
+    ASSERT_ERROK(rm.exec(segdoc, res));
+    ASSERT_EQ(R"({"a":{"x":1},"b":"s", "d":[{"k":1}]})", getNewDoc());
+
+    ASSERT_ERREQ(rm.add(""), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(rm.add("a[-1]"), Error::GLOBAL_ENOSUPPORT);
+    ASSERT_ERREQ(rm.add("a..b"), Error::PATH_EINVAL);
+    ASSERT_ERREQ(rm.exec(R"({"a":{"y"]}})", res), Error::DOC_NOTJSON);
+}
+
+TEST_F(OpTests, testAppendCapped) {
+    auto append = [&](std::string_view path, std::string_view value,
+                      size_t limit) {
+        op.clear();
+        op.set_value(value.data(), value.size());
+        op.set_code(Command::ARRAY_APPEND_CAPPED);
+        op.set_limit(limit);
+        res.clear();
+        op.set_result_buf(&res);
+        return op.op_exec(path.data(), path.size());
+    };
+
+    std::string doc = R"({"feed":[1, "two", {"x":3}],"n":1})";
+    op.set_doc(doc);
+    ASSERT_ERROK(append("feed", "4", 10));
+    ASSERT_EQ(R"({"feed":[1, "two", {"x":3},4],"n":1})", getNewDoc());
+    ASSERT_ERROK(append("feed", "4", 3));
+    ASSERT_EQ(R"({"feed":["two", {"x":3},4],"n":1})", getNewDoc());
+    ASSERT_ERROK(append("feed", "4,5", 3));
+    ASSERT_EQ(R"({"feed":[{"x":3},4,5],"n":1})", getNewDoc());
+
+    // Values beyond the limit drop every existing element, and their oldest
+    ASSERT_ERROK(append("feed", "4,5", 2));
+    ASSERT_EQ(R"({"feed":[4,5],"n":1})", getNewDoc());
+    ASSERT_ERROK(append("feed", R"(4, [5], "6")", 2));
+    ASSERT_EQ(R"({"feed":[[5], "6"],"n":1})", getNewDoc());
+
+    doc = R"({"feed":[ ],"arrs":[[1],[2,3]]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(append("feed", "1,2", 1));
+    ASSERT_EQ(R"({"feed":[2],"arrs":[[1],[2,3]]})", getNewDoc());
+    ASSERT_ERROK(append("arrs[-1]", "4", 2));
+    ASSERT_EQ(R"({"feed":[ ],"arrs":[[1],[3,4]]})", getNewDoc());
+
+    ASSERT_ERREQ(append("feed", "1", 0), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(append("feed", "1,", 1), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(append("missing", "1", 1), Error::PATH_ENOENT);
+    ASSERT_ERREQ(append("arrs.x", "1", 1), Error::PATH_MISMATCH);
+    ASSERT_ERREQ(append("arrs[0][0]", "1", 1), Error::PATH_MISMATCH);
+
+    // A segmented document
+    doc = R"({"feed":[10,20,30]})";
+    const Loc segs[] = {Loc(doc.data(), 12), Loc(doc.data() + 12, doc.size() - 12)};
+    op.set_doc(Buffer<Loc>(segs, 2));
+    ASSERT_ERROK(append("feed", "40", 2));
+    ASSERT_EQ(R"({"feed":[30,40]})", getNewDoc());
+}
+
+TEST_F(OpTests, testArrayPop) {
+    std::string doc = R"({"q":[{"job":1}, 2, "three"],"n":1})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_POP_FIRST, "q"));
+    ASSERT_EQ(R"({"job":1})", returnedMatch());
+    ASSERT_EQ(R"({"q":[ 2, "three"],"n":1})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::ARRAY_POP_LAST, "q"));
+    ASSERT_EQ(R"("three")", returnedMatch());
+    ASSERT_EQ(R"({"q":[{"job":1}, 2],"n":1})", getNewDoc());
+
+    // Popping the only element leaves an empty array
+    doc = R"({"q":[[1]],"e":[]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_POP_LAST, "q"));
+    ASSERT_EQ("[1]", returnedMatch());
+    ASSERT_EQ(R"({"q":[],"e":[]})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::ARRAY_POP_FIRST, "q[0]"));
+    ASSERT_EQ("1", returnedMatch());
+    ASSERT_EQ(R"({"q":[[]],"e":[]})", getNewDoc());
+
+    ASSERT_ERREQ(runOp(Command::ARRAY_POP_FIRST, "e"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_POP_LAST, "e"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_POP_FIRST, "missing"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_POP_LAST, ""), Error::PATH_MISMATCH);
+
+    // The root array, segmented so that the popped element spans segments
+    doc = R"(["first","second"])";
+    const Loc segs[] = {Loc(doc.data(), 4), Loc(doc.data() + 4, doc.size() - 4)};
+    op.set_doc(Buffer<Loc>(segs, 2));
+    ASSERT_ERROK(runOp(Command::ARRAY_POP_FIRST, ""));
+    ASSERT_EQ(R"("first")", returnedMatch());
+    ASSERT_EQ(R"(["second"])", getNewDoc());
+}
+
+TEST_F(OpTests, testArrayRemoveValue) {
+    std::string doc = R"({"tags":["a", "b", "a", ["a"], "a", 1,"a"],"n":1})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "tags", R"("a")"));
+    ASSERT_EQ("4", returnedMatch());
+    ASSERT_EQ(R"({"tags":["b", ["a"], 1],"n":1})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "tags", "1"));
+    ASSERT_EQ("1", returnedMatch());
+    ASSERT_EQ(R"({"tags":["a", "b", "a", ["a"], "a", "a"],"n":1})", getNewDoc());
+
+    // Nothing to remove
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "tags", R"("c")"));
+    ASSERT_EQ("0", returnedMatch());
+    ASSERT_EQ(doc, getNewDoc());
+
+    // Runs at the beginning and the end, and every element
+    doc = R"({"a":[true,true,false,true,true],"b":[null, null]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "a", "true"));
+    ASSERT_EQ("4", returnedMatch());
+    ASSERT_EQ(R"({"a":[false],"b":[null, null]})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "b", "null"));
+    ASSERT_EQ(R"({"a":[true,true,false,true,true],"b":[]})", getNewDoc());
+
+    ASSERT_ERREQ(runOp(Command::ARRAY_REMOVE_VALUE, "a", "[true]"), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_REMOVE_VALUE, "a", "true,false"), Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_REMOVE_VALUE, "missing", "true"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_REMOVE_VALUE, "", "true"), Error::PATH_MISMATCH);
+
+    // A segmented document, with an element straddling segments
+    doc = R"(["xyz","abc","xyz"])";
+    const Loc segs[] = {Loc(doc.data(), 3), Loc(doc.data() + 3, doc.size() - 3)};
+    op.set_doc(Buffer<Loc>(segs, 2));
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "", R"("xyz")"));
+    ASSERT_EQ("2", returnedMatch());
+    ASSERT_EQ(R"(["abc"])", getNewDoc());
+
+    // The array may be addressed with a negative index
+    doc = R"({"a":[[1,2,1],[3,1]]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "a[-2]", "1"));
+    ASSERT_EQ("2", returnedMatch());
+    ASSERT_EQ(R"({"a":[[2],[3,1]]})", getNewDoc());
+    ASSERT_ERROK(runOp(Command::ARRAY_REMOVE_VALUE, "a[-1]", "1"));
+    ASSERT_EQ("1", returnedMatch());
+    ASSERT_EQ(R"({"a":[[1,2,1],[3]]})", getNewDoc());
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "a[-1]", "3"),
+                 Error::DOC_EEXISTS);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "a[-1]", "4"));
+    ASSERT_EQ(R"({"a":[[1,2,1],[3,1,4]]})", getNewDoc());
+}
+
+TEST_F(OpTests, testIndexedAddUnique) {
+    std::string doc = R"({"small":[1,2],"mixed":[)";
+    for (int ii = 0; ii < 80; ii++) {
+        doc += "[" + std::to_string(ii) + "],";
+    }
+    doc += R"(1],"set":[)";
+    for (int ii = 0; ii < 100; ii++) {
+        doc += "\"tag" + std::to_string(ii) + "\",";
+    }
+    doc += R"(true]})";
+    op.set_doc(doc);
+
+    DocIndex index;
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, index.build(doc, op.parser()));
+    ASSERT_EQ(2U, index.num_arrays());
+    op.set_index(&index);
+
+    // Resolved from the set of values
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "set", R"("tag42")"),
+                 Error::DOC_EEXISTS);
+    ASSERT_TRUE(op.match().index_resolved);
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "set", "true"),
+                 Error::DOC_EEXISTS);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "set", R"("tag100")"));
+    ASSERT_TRUE(op.match().index_resolved);
+    std::string newdoc = getNewDoc();
+    ASSERT_EQ(R"(true,"tag100"]})", newdoc.substr(newdoc.size() - 15));
+
+    // Arrays with containers, or too short, are scanned as before
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "mixed", "2"),
+                 Error::PATH_MISMATCH);
+    ASSERT_FALSE(op.match().index_resolved);
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "small", "2"),
+                 Error::DOC_EEXISTS);
+    ASSERT_FALSE(op.match().index_resolved);
+
+    // Without an index, a value which does not occur in the document is not
+    // compared against the elements, but they must still be primitives
+    op.set_index(nullptr);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "set", R"("new")"));
+    ASSERT_TRUE(op.match().unique_absent);
+    newdoc = getNewDoc();
+    ASSERT_EQ(R"(true,"new"]})", newdoc.substr(newdoc.size() - 12));
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "mixed", "99"),
+                 Error::PATH_MISMATCH);
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "set", R"("tag99")"),
+                 Error::DOC_EEXISTS);
+    ASSERT_FALSE(op.match().unique_absent);
+}
+
+TEST_F(OpTests, testMultiUnique) {
+    std::string doc = R"({"tags":["a", "b,c", 1],"empty":[ ]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "tags", R"("x", "b,c",1 , "y")"));
+    ASSERT_EQ("[true,false,false,true]", returnedMatch());
+    ASSERT_EQ(R"({"tags":["a", "b,c", 1,"x","y"],"empty":[ ]})", getNewDoc());
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "tags", R"(1,"a")"),
+                 Error::DOC_EEXISTS);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "empty", "true,false"));
+    ASSERT_EQ("[true,true]", returnedMatch());
+    ASSERT_EQ(R"({"tags":["a", "b,c", 1],"empty":[true,false]})", getNewDoc());
+
+    // The values must be distinct primitives
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "tags", "2,2"),
+                 Error::VALUE_CANTINSERT);
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "tags", "2,{}"),
+                 Error::VALUE_CANTINSERT);
+
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE_P, "new.tags", "1,2"));
+    ASSERT_EQ("[true,true]", returnedMatch());
+    ASSERT_EQ(R"({"tags":["a", "b,c", 1],"empty":[ ],"new":{"tags":[1,2]}})",
+              getNewDoc());
+
+    doc = R"({"tags":["a",["b"]]})";
+    op.set_doc(doc);
+    ASSERT_ERREQ(runOp(Command::ARRAY_ADD_UNIQUE, "tags", R"("c","d")"),
+                 Error::PATH_MISMATCH);
+
+    // Segmented, with the matching element straddling segments
+    doc = R"(["first","second"])";
+    const Loc segs[] = {Loc(doc.data(), 4), Loc(doc.data() + 4, doc.size() - 4)};
+    op.set_doc(Buffer<Loc>(segs, 2));
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "", R"("first","third")"));
+    ASSERT_EQ("[false,true]", returnedMatch());
+    ASSERT_EQ(R"(["first","second","third"])", getNewDoc());
+
+    // Resolved from an index
+    doc = "[";
+    for (int ii = 0; ii < 100; ii++) {
+        doc += std::to_string(ii) + ",";
+    }
+    doc += "100]";
+    op.set_doc(doc);
+    DocIndex index;
+    ASSERT_EQ(JSONSL_ERROR_SUCCESS, index.build(doc, op.parser()));
+    op.set_index(&index);
+    ASSERT_ERROK(runOp(Command::ARRAY_ADD_UNIQUE, "", "5,101,100"));
+    ASSERT_TRUE(op.match().index_resolved);
+    ASSERT_EQ("[false,true,false]", returnedMatch());
+    std::string newdoc = getNewDoc();
+    ASSERT_EQ("99,100,101]", newdoc.substr(newdoc.size() - 11));
+}
+
+TEST_F(OpTests, testCounterBounds) {
+    auto counter = [&](Command code, std::string_view path,
+                       std::string_view delta,
+                       std::optional<std::pair<int64_t, int64_t>> bounds,
+                       std::optional<int64_t> initial = {}) {
+        op.clear();
+        op.set_value(delta.data(), delta.size());
+        op.set_code(code);
+        if (bounds) {
+            op.set_counter_bounds(bounds->first, bounds->second);
+        }
+        if (initial) {
+            op.set_counter_initial(*initial);
+        }
+        res.clear();
+        op.set_result_buf(&res);
+        return op.op_exec(path.data(), path.size());
+    };
+    const auto bounds = std::make_pair(int64_t(0), int64_t(10));
+
+    std::string doc = R"({"tokens":8,"big":9223372036854775806})";
+    op.set_doc(doc);
+    ASSERT_ERROK(counter(Command::COUNTER, "tokens", "1", bounds));
+    ASSERT_EQ("9", returnedMatch());
+    ASSERT_FALSE(res.clamped());
+    ASSERT_ERROK(counter(Command::COUNTER, "tokens", "5", bounds));
+    ASSERT_EQ("10", returnedMatch());
+    ASSERT_TRUE(res.clamped());
+    ASSERT_EQ(R"({"tokens":10,"big":9223372036854775806})", getNewDoc());
+    ASSERT_ERROK(counter(Command::COUNTER, "tokens", "-20", bounds));
+    ASSERT_EQ("0", returnedMatch());
+    ASSERT_TRUE(res.clamped());
+
+    // Saturates rather than overflowing
+    ASSERT_ERREQ(counter(Command::COUNTER, "big", "5", {}),
+                 Error::DELTA_OVERFLOW);
+    ASSERT_ERROK(counter(Command::COUNTER, "big", "5",
+                         std::make_pair(std::numeric_limits<int64_t>::min(),
+                                        std::numeric_limits<int64_t>::max())));
+    ASSERT_EQ("9223372036854775807", returnedMatch());
+    ASSERT_TRUE(res.clamped());
+
+    // Initial values, which are clamped as well
+    ASSERT_ERROK(counter(Command::COUNTER, "missing", "1", {}, 100));
+    ASSERT_EQ("100", returnedMatch());
+    ASSERT_ERROK(counter(Command::COUNTER, "missing", "1", bounds, 100));
+    ASSERT_EQ("10", returnedMatch());
+    ASSERT_TRUE(res.clamped());
+    ASSERT_ERROK(counter(Command::COUNTER_P, "a.b", "1", bounds, 3));
+    ASSERT_EQ("3", returnedMatch());
+    ASSERT_FALSE(res.clamped());
+    ASSERT_EQ(R"({"tokens":8,"big":9223372036854775806,"a":{"b":3}})",
+              getNewDoc());
+    // The initial value only applies to a missing counter
+    ASSERT_ERROK(counter(Command::COUNTER, "tokens", "1", {}, 100));
+    ASSERT_EQ("9", returnedMatch());
+
+    ASSERT_ERREQ(counter(Command::COUNTER, "tokens", "1",
+                         std::make_pair(int64_t(5), int64_t(1))),
+                 Error::DELTA_EINVAL);
+}
+
+TEST_F(OpTests, testFloatCounter) {
+    std::string doc = R"({"gauge":0.1,"int":3,"exp":1e2,"str":"1"})";
+    op.set_doc(doc);
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "gauge", "0.2"));
+    // The shortest round-trip form of 0.1 + 0.2
+    ASSERT_EQ("0.30000000000000004", returnedMatch());
+    ASSERT_EQ(R"({"gauge":0.30000000000000004,"int":3,"exp":1e2,"str":"1"})",
+              getNewDoc());
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "gauge", "-0.1"));
+    ASSERT_EQ("0", returnedMatch());
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "int", "0.5"));
+    ASSERT_EQ("3.5", returnedMatch());
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "exp", "1.5e2"));
+    ASSERT_EQ("250", returnedMatch());
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "exp", "1e300"));
+    ASSERT_EQ("1e+300", returnedMatch());
+
+    // Created as with COUNTER
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT, "new", "2.25"));
+    ASSERT_EQ("2.25", returnedMatch());
+    ASSERT_ERROK(runOp(Command::COUNTER_FLOAT_P, "a.b", "-1.5"));
+    ASSERT_EQ(R"({"gauge":0.1,"int":3,"exp":1e2,"str":"1","a":{"b":-1.5}})",
+              getNewDoc());
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "a.b", "1"), Error::PATH_ENOENT);
+
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "str", "1"), Error::PATH_MISMATCH);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge", "0"), Error::DELTA_EINVAL);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge", "inf"), Error::DELTA_EINVAL);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge", "1.5x"), Error::DELTA_EINVAL);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge", "1e400"), Error::DELTA_EINVAL);
+    // The delta follows the JSON number grammar
+    for (const char *delta : {".5", "1.", "00.5", "+1", " 1", "1e", "0x10"}) {
+        ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge", delta),
+                     Error::DELTA_EINVAL) << delta;
+    }
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "gauge"), Error::VALUE_EMPTY);
+
+    doc = R"({"big":1.7e308,"huge":1e400})";
+    op.set_doc(doc);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "big", "1.7e308"),
+                 Error::DELTA_OVERFLOW);
+    ASSERT_ERREQ(runOp(Command::COUNTER_FLOAT, "huge", "1"), Error::NUM_E2BIG);
+}
+
+TEST_F(OpTests, testMultiCounter) {
+    MultiCounter mc;
+    ASSERT_ERROK(mc.add("views", "1"));
+    ASSERT_ERROK(mc.add("stats.clicks", "-2"));
+    ASSERT_ERROK(mc.add("stats.list[1]", "10"));
+    ASSERT_ERROK(mc.add("views", "4"));
+    ASSERT_EQ(4U, mc.size());
+
+    std::string doc = R"({"stats":{"list":[1,2],"clicks":5},"views":100})";
+    ASSERT_ERROK(mc.exec(doc, res));
+    ASSERT_EQ(MultiCounter::NONE, mc.failed());
+    ASSERT_EQ(R"({"stats":{"list":[1,12],"clicks":3},"views":105})",
+              getNewDoc());
+    ASSERT_EQ("105", mc.value(0));
+    ASSERT_EQ("3", mc.value(1));
+    ASSERT_EQ("12", mc.value(2));
+    ASSERT_EQ("105", mc.value(3));
+
+    // Segmented, with a number straddling segments
+    const Loc segs[] = {Loc(doc.data(), 20), Loc(doc.data() + 20, 26),
+                        Loc(doc.data() + 46, doc.size() - 46)};
+    Segments segdoc;
+    segdoc.assign(Buffer<Loc>(segs, 3));
+    ASSERT_ERROK(mc.exec(segdoc, res));
+    ASSERT_EQ(R"({"stats":{"list":[1,12],"clicks":3},"views":105})",
+              getNewDoc());
+
+    // Any failure rejects the whole batch
+    ASSERT_ERROK(mc.add("missing", "1"));
+    ASSERT_ERREQ(mc.exec(doc, res), Error::PATH_ENOENT);
+    ASSERT_EQ(4U, mc.failed());
+    mc.clear();
+    ASSERT_ERROK(mc.add("views", "1"));
+    ASSERT_ERROK(mc.add("stats", "1"));
+    ASSERT_ERREQ(mc.exec(doc, res), Error::PATH_MISMATCH);
+    ASSERT_EQ(1U, mc.failed());
+    mc.clear();
+    ASSERT_ERROK(mc.add("views", "9223372036854775800"));
+    ASSERT_ERREQ(mc.exec(doc, res), Error::DELTA_OVERFLOW);
+    ASSERT_EQ(0U, mc.failed());
+    ASSERT_ERREQ(mc.exec(R"({"views":1.5})", res), Error::PATH_MISMATCH);
+    ASSERT_ERREQ(mc.exec(R"({"views":]})", res), Error::DOC_NOTJSON);
+
+    ASSERT_ERREQ(mc.add("views", "0"), Error::DELTA_EINVAL);
+    ASSERT_ERREQ(mc.add("views", ""), Error::VALUE_EMPTY);
+    ASSERT_ERREQ(mc.add("list[-1]", "1"), Error::GLOBAL_ENOSUPPORT);
+    ASSERT_ERREQ(mc.add("a..b", "1"), Error::PATH_EINVAL);
+    ASSERT_EQ(1U, mc.size());
+}
+
+TEST_F(OpTests, testReplaceIf) {
+    auto replace_if = [&](std::string_view path, std::string_view value,
+                          std::string_view expected, bool canonical = false) {
+        op.clear();
+        op.set_value(value.data(), value.size());
+        op.set_code(Command::REPLACE_IF);
+        op.set_expected(expected.data(), expected.size(), canonical);
+        res.clear();
+        op.set_result_buf(&res);
+        return op.op_exec(path.data(), path.size());
+    };
+
+    std::string doc = R"({"state":"idle","n":1,"obj":{"a": 1},"list":[1,2]})";
+    op.set_doc(doc);
+    ASSERT_ERROK(replace_if("state", R"("busy")", R"("idle")"));
+    ASSERT_EQ(R"({"state":"busy","n":1,"obj":{"a": 1},"list":[1,2]})",
+              getNewDoc());
+    ASSERT_ERREQ(replace_if("state", R"("busy")", R"("busy")"),
+                 Error::VALUE_MISMATCH);
+    ASSERT_ERROK(replace_if("list[1]", "3", "2"));
+    ASSERT_EQ(R"({"state":"idle","n":1,"obj":{"a": 1},"list":[1,3]})",
+              getNewDoc());
+
+    // Raw comparisons are byte for byte; canonical ones are not
+    ASSERT_ERREQ(replace_if("n", "2", "1.0"), Error::VALUE_MISMATCH);
+    ASSERT_ERROK(replace_if("n", "2", "1.0", true));
+    ASSERT_EQ(R"({"state":"idle","n":2,"obj":{"a": 1},"list":[1,2]})",
+              getNewDoc());
+    ASSERT_ERREQ(replace_if("obj", "null", R"({"a":1})"),
+                 Error::VALUE_MISMATCH);
+    ASSERT_ERROK(replace_if("obj", "null", R"({"a":1})", true));
+    ASSERT_EQ(R"({"state":"idle","n":1,"obj":null,"list":[1,2]})",
+              getNewDoc());
+    ASSERT_ERROK(replace_if("state", "0", R"("idle")", true));
+    ASSERT_ERROK(replace_if("state", "0", R"("\u0069dle")", true));
+    ASSERT_ERREQ(replace_if("n", "2", R"("1")", true), Error::VALUE_MISMATCH);
+
+    // Canonical comparisons ignore member order and number spelling within
+    // containers too
+    std::string nested = R"({"v":{"x":[1, 2.5],"y":{"z":"\u0041"}}})";
+    op.set_doc(nested);
+    ASSERT_ERROK(replace_if("v", "0", R"({"y":{"z":"A"},"x":[1.0,25e-1]})",
+                            true));
+    ASSERT_EQ(R"({"v":0})", getNewDoc());
+    ASSERT_ERREQ(replace_if("v", "0", R"({"y":{"z":"A"},"x":[2.5,1]})", true),
+                 Error::VALUE_MISMATCH);
+    ASSERT_ERREQ(replace_if("v", "0", R"({"y":{"z":"A"},"x":[1,2.5]})"),
+                 Error::VALUE_MISMATCH);
+    op.set_doc(doc);
+
+    ASSERT_ERREQ(replace_if("missing", "2", "1"), Error::PATH_ENOENT);
+    ASSERT_ERREQ(replace_if("", "2", "1"), Error::VALUE_CANTINSERT);
+
+    // The existing value may straddle segments
+    const Loc segs[] = {Loc(doc.data(), 12), Loc(doc.data() + 12, 6),
+                        Loc(doc.data() + 18, doc.size() - 18)};
+    op.set_doc(Buffer<Loc>(segs, 3));
+    ASSERT_ERROK(replace_if("state", R"("busy")", R"("idle")"));
+    ASSERT_EQ(R"({"state":"busy","n":1,"obj":{"a": 1},"list":[1,2]})",
+              getNewDoc());
+    ASSERT_ERREQ(replace_if("state", R"("busy")", R"("idl")"),
+                 Error::VALUE_MISMATCH);
+}
+
+TEST_F(OpTests, testErrorCodeValues) {
+    // Clients store and send the numeric values, which must not change
+    ASSERT_EQ(11, Error::DOC_ETOODEEP);
+    ASSERT_EQ(13, Error::VALUE_ETOODEEP);
+    ASSERT_EQ(15, Error::GLOBAL_ENOSUPPORT);
+    ASSERT_EQ(16, Error::NEED_MORE);
+    ASSERT_EQ(17, Error::VALUE_MISMATCH);
+}
@@ -113,10 +113,122 @@ TEST_F(PathTests, testNegativePath) {
     ASSERT_TRUE(!!ss.has_negix);
 
     ss.clear();
-    pth = "foo[-2]";
+    pth = "foo[-25]";
+    ASSERT_EQ(0, ss.parse(pth));
+    ASSERT_TRUE(!!ss.components_s[2].is_neg);
+    ASSERT_EQ(-25L, static_cast<long>(ss.components_s[2].idx));
+
+    pth = "foo[-0]";
+    ASSERT_NE(0, ss.parse(pth));
+    pth = "foo[-]";
+    ASSERT_NE(0, ss.parse(pth));
+    pth = "foo[--2]";
     ASSERT_NE(0, ss.parse(pth));
 }
 
+TEST_F(PathTests, testWildcards) {
+    Path ss;
+    std::string pth = "items[*].sku";
+    ASSERT_EQ(0, ss.parse_wildcard(pth));
+    ASSERT_EQ(4UL, ss.size());
+    ASSERT_TRUE(ss.has_wildcard);
+    ASSERT_EQ(JSONSL_PATH_WILDCARD, ss[2].ptype);
+    ASSERT_TRUE(!!ss[2].is_arridx);
+    ASSERT_EQ(0UL, ss[2].idx);
+    ASSERT_EQ(Path::WILDCARD_END, ss[2].idx_end);
+
+    ss.clear();
+    pth = "*.name";
+    ASSERT_EQ(0, ss.parse_wildcard(pth));
+    ASSERT_EQ(JSONSL_PATH_WILDCARD, ss[1].ptype);
+    ASSERT_FALSE(!!ss[1].is_arridx);
+    ASSERT_EQ("name", getComponentString(ss, 2));
+
+    ss.clear();
+    pth = "a[2:5][:3][4:]";
+    ASSERT_EQ(0, ss.parse_wildcard(pth));
+    ASSERT_EQ(2UL, ss[2].idx);
+    ASSERT_EQ(5UL, ss[2].idx_end);
+    ASSERT_EQ(0UL, ss[3].idx);
+    ASSERT_EQ(3UL, ss[3].idx_end);
+    ASSERT_EQ(4UL, ss[4].idx);
+    ASSERT_EQ(Path::WILDCARD_END, ss[4].idx_end);
+
+    // An escaped '*' is a literal key
+    ss.clear();
+    pth = "a.`*`";
+    ASSERT_EQ(0, ss.parse_wildcard(pth));
+    ASSERT_FALSE(ss.has_wildcard);
+    ASSERT_EQ("*", getComponentString(ss, 2));
+
+    ss.clear();
+    pth = "a[1:x]";
+    ASSERT_NE(0, ss.parse_wildcard(pth));
+    pth = "a[-2:]";
+    ASSERT_NE(0, ss.parse_wildcard(pth));
+    pth = "a[**]";
+    ASSERT_NE(0, ss.parse_wildcard(pth));
+
+    // Without parse_wildcard(), '*' is an ordinary key
+    ss.clear();
+    pth = "a.*";
+    ASSERT_EQ(0, ss.parse(pth));
+    ASSERT_FALSE(ss.has_wildcard);
+    ASSERT_EQ(JSONSL_PATH_STRING, ss[2].ptype);
+    ASSERT_EQ("*", getComponentString(ss, 2));
+    ss.clear();
+    pth = "a[*]";
+    ASSERT_NE(0, ss.parse(pth));
+    ss.clear();
+    pth = "a[2:5]";
+    ASSERT_NE(0, ss.parse(pth));
+}
+
+TEST_F(PathTests, testJsonPointer) {
+    Path ss;
+    ASSERT_EQ(0, ss.parse_pointer(""));
+    ASSERT_EQ(1UL, ss.size());
+
+    std::string pth = "/foo/0/a~1b/m~0n/01/";
+    ASSERT_EQ(0, ss.parse_pointer(pth));
+    ASSERT_EQ(7UL, ss.size());
+    ASSERT_EQ("foo", std::string(ss[1].pstr, ss[1].len));
+    ASSERT_EQ(JSONSL_PATH_NUMERIC, ss[2].ptype);
+    ASSERT_EQ(0UL, ss[2].idx);
+    // Within an object, the index is a key
+    ASSERT_TRUE(ss[2].maybe_key);
+    ASSERT_EQ("0", std::string(ss[2].pstr, ss[2].len));
+    ASSERT_EQ("a/b", std::string(ss[3].pstr, ss[3].len));
+    ASSERT_EQ("m~n", std::string(ss[4].pstr, ss[4].len));
+    // Not an index, because of the leading zero
+    ASSERT_EQ(JSONSL_PATH_STRING, ss[5].ptype);
+    ASSERT_FALSE(ss[5].maybe_key);
+    ASSERT_EQ("01", std::string(ss[5].pstr, ss[5].len));
+    ASSERT_EQ(0UL, ss[6].len);
+
+    // Keys keep their JSON escapes, except for escaped separators
+    pth = R"(/qu\"oted\/x)";
+    ASSERT_EQ(0, ss.parse_pointer(pth));
+    ASSERT_EQ(3UL, ss.size());
+    ASSERT_EQ(R"(qu\"oted)", std::string(ss[1].pstr, ss[1].len));
+    ASSERT_EQ("x", std::string(ss[2].pstr, ss[2].len));
+
+    // The copy refers to the same keys
+    Path copy;
+    pth = "/a~1b/3";
+    ASSERT_EQ(0, ss.parse_pointer(pth));
+    copy.assign(ss);
+    ASSERT_EQ(3UL, copy.size());
+    ASSERT_EQ(ss[1].pstr, copy[1].pstr);
+    ASSERT_EQ(3UL, copy[2].idx);
+
+    ASSERT_NE(0, ss.parse_pointer("foo"));
+    ASSERT_NE(0, ss.parse_pointer("/a~2"));
+    ASSERT_NE(0, ss.parse_pointer("/a~"));
+    ASSERT_NE(0, ss.parse_pointer(R"(/\u0041)"));
+    ASSERT_NE(0, ss.parse_pointer("/a\"b"));
+}
+
 TEST_F(PathTests, testInvalidSequence) {
     Path ss;
     std::string pth = "hello[0]world";